@@ -11,6 +11,9 @@
 
 #include <termios.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <linux/sync_file.h>
 #include "../include/fl2000_ioctl.h"
 
 #define	FL2K_NAME	"/dev/fl2000-0"
@@ -24,6 +27,8 @@
 
 #define MAX_FRAME_BUFFER_SIZE			1920*1080*3
 #define	NUM_FRAME_BUFFERS			16
+#define	NUM_BENCH_FRAMES			600
+#define	NUM_PIN_ROUNDS				1000
 
 /*
  * data structures
@@ -41,6 +46,9 @@ struct resolution  resolution_list[64];
 uint32_t num_resolution;
 uint8_t frame_buffers[NUM_FRAME_BUFFERS][MAX_FRAME_BUFFER_SIZE];
 uint32_t mem_type = 0;
+uint32_t surface_flags = 0;
+bool bench_mode = false;
+bool pin_bench_mode = false;
 
 struct test_alloc phy_frame_buffers[NUM_FRAME_BUFFERS];
 
@@ -311,6 +319,122 @@ exit:
 	return file_ok;
 }
 
+/*
+ * copy len bytes of pixels from src to dst in FL2000 wire order, ie. with the
+ * two 32-bit words of every 8-byte group swapped. A renderer can produce its
+ * frames through this, in place (dst == src) or on the way to the surface,
+ * for SURFACE_FLAG_ZERO_COPY surfaces. Each group is one 64-bit rotate, which
+ * the compiler turns into SIMD shuffles. len is a multiple of 8.
+ */
+void swizzle_pixels(uint8_t * dst, const uint8_t * src, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 8) {
+		uint64_t group;
+
+		memcpy(&group, src + i, sizeof(group));
+		group = (group >> 32) | (group << 32);
+		memcpy(dst + i, &group, sizeof(group));
+	}
+}
+
+/*
+ * re-order the pixels into FL2000 wire order, in place. Required by
+ * SURFACE_FLAG_ZERO_COPY surfaces.
+ */
+void swap_pixels(uint8_t * buf, uint32_t len)
+{
+	swizzle_pixels(buf, buf, len);
+}
+
+/*
+ * read busy and total jiffies of all cpus from /proc/stat, so that the
+ * time spent in kernel worker/softirq context is accounted as well.
+ */
+bool read_cpu_time(uint64_t * busy, uint64_t * total)
+{
+	unsigned long long user, nice, system, idle, iowait, irq, softirq;
+	FILE * stat_file;
+	int num;
+
+	stat_file = fopen("/proc/stat", "r");
+	if (stat_file == NULL)
+		return false;
+
+	num = fscanf(stat_file, "cpu %llu %llu %llu %llu %llu %llu %llu",
+		&user, &nice, &system, &idle, &iowait, &irq, &softirq);
+	fclose(stat_file);
+	if (num != 7)
+		return false;
+
+	*busy = user + nice + system + irq + softirq;
+	*total = *busy + idle + iowait;
+	return true;
+}
+
+double elapsed_sec(struct timespec * start, struct timespec * end)
+{
+	return (end->tv_sec - start->tv_sec) +
+		(end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/*
+ * wait for a frame fence, then close it. Returns true if the frame was
+ * streamed, false if it was replaced, dropped or did not complete in time.
+ */
+bool wait_frame_fence(int fence_fd)
+{
+	struct sync_file_info file_info;
+	struct pollfd pfd;
+	bool completed = false;
+
+	pfd.fd = fence_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 1000) != 1) {
+		fprintf(stderr, "frame fence timed out?\n");
+		goto exit;
+	}
+
+	memset(&file_info, 0, sizeof(file_info));
+	if (ioctl(fence_fd, SYNC_IOC_FILE_INFO, &file_info) < 0) {
+		fprintf(stderr, "SYNC_IOC_FILE_INFO failed %d\n", errno);
+		goto exit;
+	}
+	completed = (file_info.status == 1);
+
+exit:
+	close(fence_fd);
+	return completed;
+}
+
+/*
+ * queue a frame and keep exactly one frame in flight: wait for the fence of
+ * the previous frame, and count it if it reached the wire. NOTIFY returns
+ * as soon as the frame is queued, so only completions measure throughput.
+ */
+int notify_and_wait_previous(
+	int fd,
+	struct surface_update_info * update_info,
+	int * fence_fd,
+	unsigned int * num_done)
+{
+	struct surface_update_fence_info fence_info;
+	int ret_val;
+
+	memset(&fence_info, 0, sizeof(fence_info));
+	fence_info.update_info = *update_info;
+	ret_val = ioctl(fd, IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE,
+		&fence_info);
+	if (ret_val < 0)
+		return ret_val;
+
+	if (*fence_fd >= 0 && wait_frame_fence(*fence_fd))
+		(*num_done)++;
+	*fence_fd = fence_info.fence_fd;
+	return 0;
+}
+
 int _alloc_frame(int fd, struct test_alloc * phy_alloc, uint32_t size)
 {
 	int ret;
@@ -391,6 +515,8 @@ void test_display(int fd, uint32_t width, uint32_t height, uint32_t index)
 
 	if (!init_frame_by_bmp_file(frame_buffer, width, height, index))
 		init_frame_by_test_pattern(frame_buffer, width, height);
+	if (surface_flags & SURFACE_FLAG_ZERO_COPY)
+		swap_pixels(frame_buffer, width * height * 3);
 
 	surface_info.buffer_length	= width * height * 3;
 	surface_info.width		= width;
@@ -398,11 +524,12 @@ void test_display(int fd, uint32_t width, uint32_t height, uint32_t index)
 	surface_info.pitch		= width * 3;
 	surface_info.color_format	= COLOR_FORMAT_RGB_24;
 	surface_info.type		= mem_type;
+	surface_info.flags		= surface_flags;
 	fprintf(stderr, "create_surface(%u, %u) , type(0x%x)\n",
 		width, height, surface_info.type);
-	ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE, &surface_info);
+	ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE_EX, &surface_info);
 	if (ret_val < 0) {
-		fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE failed %d\n",
+		fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE_EX failed %d\n",
 			ret_val);
 		goto exit;
 	}
@@ -504,6 +631,13 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 	int index;
 	bool bmp_ok;
 	unsigned int num_bmp;
+	unsigned int num_frames;
+	unsigned int num_done;
+	int fence_fd = -1;
+	struct timespec start_time;
+	uint64_t start_busy;
+	uint64_t start_total;
+	bool have_cpu_time;
 
 	/*
 	 * find how many bmp files are available, look for at most
@@ -590,15 +724,19 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 			break;
 		}
 
+		if (surface_flags & SURFACE_FLAG_ZERO_COPY)
+			swap_pixels(frame_buffer, width * height * 3);
+
 		surface_info.buffer_length	= width * height * 3;
 		surface_info.width		= width;
 		surface_info.height		= height;
 		surface_info.pitch		= width * 3;
 		surface_info.color_format	= COLOR_FORMAT_RGB_24;
 		surface_info.type		= mem_type;
-		ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE, &surface_info);
+		surface_info.flags		= surface_flags;
+		ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE_EX, &surface_info);
 		if (ret_val < 0) {
-			fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE failed %d\n",
+			fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE_EX failed %d\n",
 				ret_val);
 			goto exit;
 		}
@@ -607,6 +745,10 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 	/*
 	 * for each primary surfaces, send update to kernel driver.
 	 */
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	have_cpu_time = read_cpu_time(&start_busy, &start_total);
+	num_frames = 0;
+	num_done = 0;
 	index = 0;
 	do {
 		int c;
@@ -638,7 +780,11 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 		}
 		update_info.buffer_length 	= width * height * 3;
 
-		ret_val = ioctl(fd, IOCTL_FL2000_NOTIFY_SURFACE_UPDATE, &update_info);
+		if (bench_mode)
+			ret_val = notify_and_wait_previous(fd, &update_info,
+				&fence_fd, &num_done);
+		else
+			ret_val = ioctl(fd, IOCTL_FL2000_NOTIFY_SURFACE_UPDATE, &update_info);
 		if (ret_val < 0) {
 			fprintf(stderr, "IOCTL_FL2000_NOTIFY_SURFACE_UPDATE failed %d\n",
 				ret_val);
@@ -647,6 +793,12 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 
 		if (++index >= num_bmp)
 			index = 0;
+
+		if (bench_mode) {
+			if (++num_frames < NUM_BENCH_FRAMES)
+				continue;
+			break;
+		}
 
 		if (kbhit() == 0) {
 			usleep(1000*10);	// sleep for 10 ms
@@ -658,6 +810,31 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 			break;
 	} while (true);
 
+	if (fence_fd >= 0 && wait_frame_fence(fence_fd))
+		num_done++;
+	fence_fd = -1;
+
+	if (bench_mode && num_frames != 0) {
+		struct timespec end_time;
+		uint64_t end_busy;
+		uint64_t end_total;
+		double seconds;
+
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		seconds = elapsed_sec(&start_time, &end_time);
+		fprintf(stdout, "bench: %s, %u of %u frames streamed in %.3f sec, "
+			"%.2f fps",
+			(surface_flags & SURFACE_FLAG_ZERO_COPY) ?
+				"zero copy" : "memcpy",
+			num_done, num_frames, seconds, num_done / seconds);
+		if (have_cpu_time && read_cpu_time(&end_busy, &end_total) &&
+		    end_total != start_total)
+			fprintf(stdout, ", cpu %.1f%%",
+				100.0 * (end_busy - start_busy) /
+				(end_total - start_total));
+		fprintf(stdout, "\n");
+	}
+
 	/*
 	 * disable output
 	 */
@@ -693,6 +870,104 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 		surface_info.pitch		= width * 3;
 		surface_info.color_format	= COLOR_FORMAT_RGB_24;
 		surface_info.type		= mem_type;
+		surface_info.flags		= surface_flags;
+		ret_val = ioctl(fd, IOCTL_FL2000_DESTROY_SURFACE, &surface_info);
+		if (ret_val < 0) {
+			fprintf(stderr, "IOCTL_FL2000_DESTROY_SURFACE failed %d\n",
+				ret_val);
+			goto exit;
+		}
+	}
+
+exit:
+	if (fence_fd >= 0)
+		close(fence_fd);
+}
+
+/*
+ * time how long the driver takes to pin a surface: create/destroy for
+ * persistent and contiguous surfaces, which are pinned at creation, and
+ * lock/unlock for volatile surfaces, which are pinned by the lock.
+ */
+void bench_pin(int fd, uint32_t width, uint32_t height)
+{
+	struct surface_info surface_info;
+	struct surface_update_info update_info;
+	struct test_alloc * phy_alloc = &phy_frame_buffers[0];
+	struct timespec start_time;
+	struct timespec end_time;
+	uint32_t const buffer_length = width * height * 3;
+	unsigned int round;
+	double seconds;
+	bool created = false;
+	bool allocated = false;
+	int ret_val;
+
+	memset(&surface_info, 0, sizeof(surface_info));
+	switch (mem_type) {
+	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE:
+	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT:
+		surface_info.handle	 = (unsigned long) frame_buffers[0];
+		surface_info.user_buffer = (unsigned long) frame_buffers[0];
+		break;
+
+	case SURFACE_TYPE_VIRTUAL_CONTIGUOUS:
+	case SURFACE_TYPE_PHYSICAL_CONTIGUOUS:
+		if (_alloc_frame(fd, phy_alloc, buffer_length) < 0)
+			return;
+		allocated = true;
+		surface_info.handle	 = phy_alloc->usr_addr;
+		surface_info.user_buffer = mem_type == SURFACE_TYPE_VIRTUAL_CONTIGUOUS ?
+			phy_alloc->usr_addr : phy_alloc->phy_addr;
+		break;
+	}
+	surface_info.buffer_length	= buffer_length;
+	surface_info.width		= width;
+	surface_info.height		= height;
+	surface_info.pitch		= width * 3;
+	surface_info.color_format	= COLOR_FORMAT_RGB_24;
+	surface_info.type		= mem_type;
+	surface_info.flags		= surface_flags;
+
+	memset(&update_info, 0, sizeof(update_info));
+	update_info.handle		= surface_info.handle;
+	update_info.user_buffer		= surface_info.user_buffer;
+	update_info.buffer_length	= buffer_length;
+
+	if (mem_type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE) {
+		ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE_EX, &surface_info);
+		if (ret_val < 0) {
+			fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE_EX failed %d\n",
+				ret_val);
+			goto exit;
+		}
+		created = true;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	for (round = 0; round < NUM_PIN_ROUNDS; round++) {
+		if (mem_type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE) {
+			ret_val = ioctl(fd, IOCTL_FL2000_LOCK_SURFACE, &update_info);
+			if (ret_val < 0) {
+				fprintf(stderr, "IOCTL_FL2000_LOCK_SURFACE failed %d\n",
+					ret_val);
+				goto exit;
+			}
+			ret_val = ioctl(fd, IOCTL_FL2000_UNLOCK_SURFACE, &update_info);
+			if (ret_val < 0) {
+				fprintf(stderr, "IOCTL_FL2000_UNLOCK_SURFACE failed %d\n",
+					ret_val);
+				goto exit;
+			}
+			continue;
+		}
+
+		ret_val = ioctl(fd, IOCTL_FL2000_CREATE_SURFACE_EX, &surface_info);
+		if (ret_val < 0) {
+			fprintf(stderr, "IOCTL_FL2000_CREATE_SURFACE_EX failed %d\n",
+				ret_val);
+			goto exit;
+		}
 		ret_val = ioctl(fd, IOCTL_FL2000_DESTROY_SURFACE, &surface_info);
 		if (ret_val < 0) {
 			fprintf(stderr, "IOCTL_FL2000_DESTROY_SURFACE failed %d\n",
@@ -700,8 +975,21 @@ void test_display_on_resolution(int fd, uint32_t width, uint32_t height)
 			goto exit;
 		}
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
 
-exit:;
+	seconds = elapsed_sec(&start_time, &end_time);
+	fprintf(stdout, "pin: type %u, %u %s of %u bytes in %.3f sec, "
+		"%.1f us each\n",
+		mem_type, NUM_PIN_ROUNDS,
+		mem_type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE ?
+			"lock/unlock" : "create/destroy",
+		buffer_length, seconds, seconds * 1e6 / NUM_PIN_ROUNDS);
+
+exit:
+	if (created)
+		ioctl(fd, IOCTL_FL2000_DESTROY_SURFACE, &surface_info);
+	if (allocated)
+		_release_frame(fd, phy_alloc);
 }
 
 void main(int argc, char* argv[])
@@ -735,8 +1023,9 @@ void main(int argc, char* argv[])
 
 	if (argc < 2) {
 usage:
-		fprintf(stderr, "usage: %s mem_type [[width] [height]]\n"
-			"mem_type is 0..3\n", argv[0]);
+		fprintf(stderr, "usage: %s mem_type[z] [[width] [height] [bench|pin]]\n"
+			"mem_type is 0..3, append z to stream pre-swizzled "
+			"pixels with zero copy\n", argv[0]);
 		fprintf(stderr,
 			"eg1: to test with SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE, type\n"
 			"%s 0\n", argv[0]);
@@ -746,6 +1035,13 @@ usage:
 		fprintf(stderr,
 			"eg3: to test 1920x1080 with SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT, type\n"
 			"%s 1 1920 1080\n", argv[0]);
+		fprintf(stderr,
+			"eg4: to compare fps and cpu usage of zero copy against memcpy, type\n"
+			"%s 1z 1920 1080 bench; %s 1 1920 1080 bench\n",
+			argv[0], argv[0]);
+		fprintf(stderr,
+			"eg5: to time surface pinning of SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE, type\n"
+			"%s 0 1920 1080 pin\n", argv[0]);
 		goto exit;
 	}
 
@@ -764,11 +1060,22 @@ usage:
 			mem_type = SURFACE_TYPE_PHYSICAL_CONTIGUOUS;
 			break;
 		}
+		if (argv[1][1] == 'z')
+			surface_flags |= SURFACE_FLAG_ZERO_COPY;
 	}
 
 	if (argc > 2 && argc < 4)
 		goto usage;
 
+	if (argc >= 5) {
+		if (strcmp(argv[4], "bench") == 0)
+			bench_mode = true;
+		else if (strcmp(argv[4], "pin") == 0)
+			pin_bench_mode = true;
+		else
+			goto usage;
+	}
+
 	parse_edid();
 
 	if (argc >= 4) {
@@ -781,7 +1088,10 @@ usage:
 				width, height);
 			goto exit;
 		}
-		test_display_on_resolution(fd, width, height);
+		if (pin_bench_mode)
+			bench_pin(fd, width, height);
+		else
+			test_display_on_resolution(fd, width, height);
 	}
 	else
 		test_display_all(fd);
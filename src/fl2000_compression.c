@@ -140,7 +140,71 @@ void fl2000_comp_apply_safest_mask(struct dev_ctx * dev_ctx)
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
 }
 
-__inline
+/*
+ * bytes one compressed frame may take on the bus: render_compression_share
+ * percent of the measured link throughput, split over the refresh rate.
+ * Until a frame has been measured, the fixed target is used.
+ */
+uint32_t fl2000_comp_frame_budget(struct dev_ctx * dev_ctx)
+{
+	uint64_t const link_bytes_per_sec = dev_ctx->render.link_bytes_per_sec;
+	uint32_t const freq = dev_ctx->vr_params.freq ? dev_ctx->vr_params.freq : 60;
+	uint32_t share = render_compression_share;
+	uint64_t budget;
+
+	if (link_bytes_per_sec == 0)
+		return MMX_COMPRESSION_BANDWIDTH_TARGET_PER_FRAME_BYTES;
+
+	if (share == 0 || share > 100)
+		share = 100;
+	budget = div_u64(link_bytes_per_sec * share, 100 * freq);
+	if (budget < MINIMUM_COMPRESSED_LENGH_IN_BYTES)
+		budget = MINIMUM_COMPRESSED_LENGH_IN_BYTES;
+	if (budget > U32_MAX)
+		budget = U32_MAX;
+	return (uint32_t) budget;
+}
+
+/*
+ * closed loop on the frame budget, called after each compression pass.
+ * Returns true if the frame should be compressed again with the lowered mask.
+ * The mask is raised only after COMPRESSION_CALM_FRAMES frames in a row fit in
+ * 3/4 of the budget, so it does not flip between two indexes every frame.
+ */
+bool fl2000_comp_control(
+	struct dev_ctx * dev_ctx,
+	size_t compressed_length,
+	uint32_t retry_count)
+{
+	struct vr_params * const vr_params = &dev_ctx->vr_params;
+	struct render * const render = &dev_ctx->render;
+	uint32_t const budget = fl2000_comp_frame_budget(dev_ctx);
+
+	render->comp_budget = budget;
+
+	if (compressed_length > budget) {
+		render->comp_calm_frames = 0;
+		if (vr_params->compression_mask_index >=
+		    vr_params->compression_mask_index_max ||
+		    retry_count >= MAX_COMPRESSION_RETRY_COUNT_COUNT)
+			return false;
+
+		fl2000_comp_lower_mask(dev_ctx);
+		return true;
+	}
+
+	if (compressed_length < budget / 4 * 3) {
+		if (++render->comp_calm_frames >= COMPRESSION_CALM_FRAMES) {
+			render->comp_calm_frames = 0;
+			fl2000_comp_raise_mask(dev_ctx);
+		}
+	} else
+		render->comp_calm_frames = 0;
+
+	return false;
+}
+
+static __always_inline
 uint32_t fl2000_comp_get_pixel(
 	uint8_t * source,
 	uint32_t byte_per_pixel
@@ -164,15 +228,13 @@ uint32_t fl2000_comp_get_pixel(
 	return (pixelData);
 }
 
-__inline
+static __always_inline
 void fl2000_comp_save_repeated_data(
 	uint8_t * target,
 	uint8_t * source,
 	uint32_t bytes_per_pixel
 	)
 {
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
-
 	switch (bytes_per_pixel) {
 	case PIXEL_BYTE_1:
 		target[0] =  (source[ 0 ] >> 1);
@@ -197,10 +259,9 @@ void fl2000_comp_save_repeated_data(
 	default:
 		break;
 	}
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
 }
 
-__inline void
+static __always_inline void
 fl2000_comp_save_repeated_count(
 	uint8_t** target_ptr,
 	uint8_t* repeat_data,
@@ -210,8 +271,6 @@ fl2000_comp_save_repeated_count(
 	uint32_t repeat_chunk_size;
 	uint8_t* target = *target_ptr;
 
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
-
 	switch (bytes_per_pixel) {
 	case PIXEL_BYTE_1:
 		do {
@@ -231,7 +290,7 @@ fl2000_comp_save_repeated_count(
 				target += PIXEL_BYTE_1;
 				repeat_count -= 1;
 			}
-		} while (repeat_count > 1);
+		} while (repeat_count > 0);
 		break;
 
 	case PIXEL_BYTE_2:
@@ -256,7 +315,7 @@ fl2000_comp_save_repeated_count(
 				target += PIXEL_BYTE_2;
 				repeat_count -= 1;
 			}
-		} while ( repeat_count > 1 );
+		} while ( repeat_count > 0 );
 		break;
 
 	case PIXEL_BYTE_3:
@@ -281,7 +340,7 @@ fl2000_comp_save_repeated_count(
 				target += PIXEL_BYTE_3;
 				repeat_count -= 1;
 			}
-		} while (repeat_count > 1);
+		} while (repeat_count > 0);
 		break;
 
 	default:
@@ -289,7 +348,62 @@ fl2000_comp_save_repeated_count(
 	}
 
 	*target_ptr = target;
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+}
+
+static __always_inline
+void fl2000_comp_save_repeated_data2(
+	uint8_t * target,
+	uint8_t * source)
+{
+	uint8_t r, g, b;
+
+	// Optimized function to process pixel fromat transform and compression
+	// together.
+	//
+	r = source[2] >> 3;
+	g = source[1] >> 3;
+	b = source[0] >> 3;
+
+	target[1] = 0x80 | (r << 2) | (g >> 3);
+	target[0] = ((g & 0x07) << 5 ) | b;
+}
+
+static __always_inline void
+fl2000_comp_save_repeated_count2(
+	uint8_t ** target_ptr,
+	uint8_t *  repeat_data,
+	uint32_t   bytes_per_pixel,
+	uint32_t   repeat_count)
+{
+	uint32_t repeat_chunk_size;
+	uint8_t r, g, b;
+	uint8_t * target = *target_ptr;
+
+	do  {
+		if (repeat_count > 0x7FFF)
+			repeat_chunk_size = 0x7FFF;
+		else
+			repeat_chunk_size = repeat_count;
+
+		target[0] = (uint8_t)(repeat_chunk_size);
+		target[1] = (uint8_t)((repeat_chunk_size & 0x7FFF) >> 8);
+		target += PIXEL_BYTE_2;
+		repeat_count -= repeat_chunk_size;
+
+		if (repeat_count > 0) {
+			r = repeat_data[2] >> 3;
+			g = repeat_data[1] >> 3;
+			b = repeat_data[0] >> 3;
+
+			target[1] = 0x80 | (r << 2) | (g >> 3);
+			target[0] = ((g & 0x07) << 5) | b;
+			target += PIXEL_BYTE_2;
+
+			repeat_count -= 1;
+		}
+	} while ( repeat_count > 0 );
+
+	*target_ptr = target;
 }
 
 void fl2000_comp_padding_alignment(
@@ -312,275 +426,335 @@ void fl2000_comp_padding_alignment(
 	*data_buffer_length = length;
 }
 
-size_t fl2000_comp_gravity_low(
-	struct dev_ctx * dev_ctx,
-	struct render_ctx * render_ctx,		// NOT USED
-	size_t data_buffer_length,
-	uint8_t * source,
-	uint8_t * target,
-	uint32_t num_of_pixels,
-	uint32_t bytes_per_pixel,
-	bool NoCompressionToFirst1K)
+static __always_inline
+uint64_t fl2000_comp_load64(const uint8_t * source)
 {
-	uint32_t i;
-	uint32_t looselyColorMaskRGB;
-	int32_t repeatCount;
-	uint32_t markPixel;
-	uint32_t currentPixel;
-	uint32_t previousPixel;
-	uint8_t * repeatDataPointer;
-	uint8_t * targetOriginalPointer;
-	uint8_t * sourceOriginalPointer;
-	uint32_t isochSourcePacketIndex;
-	uint8_t *  isochNextBoundry;
-	bool isochCompression;
-	uint32_t currentPixelWithMask;
-	uint32_t markPixelWithMask;
+	uint64_t data;
 
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
-
-	targetOriginalPointer = target;
-	sourceOriginalPointer = source;
-	repeatDataPointer = source;
+	memcpy(&data, source, sizeof(data));
+	return (data);
+}
 
-	markPixel = 0;
-	previousPixel = 0;
-	repeatCount = 0;
+/*
+ * count the pixels, up to limit, that are byte for byte the same as the mark
+ * pixel. Those always extend the current run, so they are compared 8 pixels
+ * at a time, 64-bit words against the mark pixel repeated.
+ */
+static __always_inline
+uint32_t fl2000_comp_exact_run(
+	const uint8_t * source,
+	const uint8_t * mark,
+	uint32_t limit,
+	const uint32_t bytes_per_pixel)
+{
+	uint32_t const mark_pixel =
+		fl2000_comp_get_pixel((uint8_t *) mark, bytes_per_pixel);
+	uint32_t count = 0;
+
+	/*
+	 * most runs are short; look at the first 8 pixels one by one.
+	 */
+	while (count < limit && count < 8 &&
+	       fl2000_comp_get_pixel((uint8_t *) source, bytes_per_pixel) ==
+	       mark_pixel) {
+		source += bytes_per_pixel;
+		count++;
+	}
 
-	isochSourcePacketIndex = 0;
-	isochNextBoundry = source;
-	isochCompression = false;
+	if (count < 8)
+		return (count);
 
-	looselyColorMaskRGB = fl2000_comp_get_current_mask_value(dev_ctx);
+	if (bytes_per_pixel == PIXEL_BYTE_2) {
+		uint16_t mark16;
+		uint64_t pattern;
 
-	// Check if the start pixel exceeds the boundary of compression by
-	// Precise-Isoch compress mode.
-	// Mark the first isochNextBoundry.
-	if (isochCompression) {
-		// TODO:
-		//
+		memcpy(&mark16, mark, sizeof(mark16));
+		pattern = mark16 * 0x0001000100010001ULL;
+		while (limit - count >= 8 &&
+		       fl2000_comp_load64(source) == pattern &&
+		       fl2000_comp_load64(source + 8) == pattern) {
+			source += 16;
+			count += 8;
+		}
+	} else if (bytes_per_pixel == PIXEL_BYTE_3) {
+		uint8_t pattern[8 * PIXEL_BYTE_3];
+		uint64_t pattern0, pattern1, pattern2;
+		uint32_t i;
+
+		for (i = 0; i < sizeof(pattern); i++)
+			pattern[i] = mark[i % PIXEL_BYTE_3];
+		pattern0 = fl2000_comp_load64(pattern);
+		pattern1 = fl2000_comp_load64(pattern + 8);
+		pattern2 = fl2000_comp_load64(pattern + 16);
+		while (limit - count >= 8 &&
+		       fl2000_comp_load64(source) == pattern0 &&
+		       fl2000_comp_load64(source + 8) == pattern1 &&
+		       fl2000_comp_load64(source + 16) == pattern2) {
+			source += 24;
+			count += 8;
+		}
 	}
-	else {
-		/*
-		 * Bulk transfer doesn't need to consider packet boundry, and
-		 * set the value to the end of transfer.
-		 */
-		isochNextBoundry = source + data_buffer_length;
+
+	while (count < limit &&
+	       fl2000_comp_get_pixel((uint8_t *) source, bytes_per_pixel) ==
+	       mark_pixel) {
+		source += bytes_per_pixel;
+		count++;
 	}
 
+	return (count);
+}
 
-	for (i = 0; i < num_of_pixels; i++) {
-		currentPixel = fl2000_comp_get_pixel(source, bytes_per_pixel);
+/*
+ * gravity run detection, specialized at compile time on the source pixel
+ * size and on whether the output is packed to RGB555 (gravity2).
+ *
+ * A pixel extends the run when it equals the mark pixel under the loose mask,
+ * unless it differs from the mark but repeats the previous pixel exactly;
+ * that starts a new run, to keep color trailing in check. A run is written as
+ * the mark pixel followed by the number of additional copies. The last
+ * compressed pixel must be a single one (hardware bug).
+ *
+ * Returns the compressed length, without padding.
+ */
+
+static __always_inline
+size_t fl2000_comp_gravity_run(
+	uint8_t * source,
+	uint8_t * source_boundary,
+	uint8_t * target,
+	uint32_t num_of_pixels,
+	uint32_t loosely_mask,
+	const uint32_t bytes_per_pixel,
+	const bool pack_555)
+{
+	uint32_t const target_bytes_per_pixel =
+		pack_555 ? PIXEL_BYTE_2 : bytes_per_pixel;
+	uint8_t * const source_end = source + num_of_pixels * bytes_per_pixel;
+	uint8_t * const run_end = source_boundary < source_end ?
+		source_boundary : source_end;
+	uint8_t * const target_start = target;
+	uint8_t * repeat_data = source;
+	uint32_t mark_pixel = 0;
+	uint32_t current_pixel;
+	uint32_t repeat_count = 0;
+	uint32_t exact;
+	uint32_t i;
 
-		currentPixelWithMask = (currentPixel | looselyColorMaskRGB);
-		markPixelWithMask = (markPixel | looselyColorMaskRGB);
+	for (i = 0; i < num_of_pixels; i++) {
+		current_pixel = fl2000_comp_get_pixel(source, bytes_per_pixel);
 
-		if (repeatCount > 0) {
-			/* It's loosely comparsion, if current pixel after the
-			 * mask that looks like repeatDataPointer pixel, then we
-			 * treat it as the same group of current compression
-			 * run.
+		if (repeat_count > 0) {
+			/*
+			 * the same pixel again: skip the whole exact run.
 			 */
-			if (currentPixelWithMask == markPixelWithMask) {
-				bool notExactlyTheSameAsMarkPixel;
-				bool exactlyTheSameAsPreviousPixel;
-
-				if ( markPixel != currentPixel )
-					notExactlyTheSameAsMarkPixel = true;
-				else
-					notExactlyTheSameAsMarkPixel = false;
-
-				previousPixel = fl2000_comp_get_pixel(
-					source - bytes_per_pixel,
+			if (current_pixel == mark_pixel &&
+			    source + bytes_per_pixel <= run_end) {
+				exact = fl2000_comp_exact_run(
+					source,
+					repeat_data,
+					(run_end - source) / bytes_per_pixel,
 					bytes_per_pixel);
+				source += exact * bytes_per_pixel;
+				repeat_count += exact;
+				i += exact - 1;
+				continue;
+			}
 
-				if  (previousPixel == currentPixel)
-					exactlyTheSameAsPreviousPixel = true;
-				else
-					exactlyTheSameAsPreviousPixel = false;
-
-				// This algorithem check two condtions to
-				// prevent worse color trailing issue.
-				// If we match these two conditions, we have to
-				// start a new compression run.
-				//
-				// 1. Current pixel is *not the same* as
-				//    repeatDataPointer pixel.
-				// 2. Current pixel is *the same* as previous
-				//    pixel.
-				//
-				if (notExactlyTheSameAsMarkPixel &&
-				    exactlyTheSameAsPreviousPixel) {
-					// Start over a new compression run.
-					//
-					if (repeatCount > 1) {
-						// A real compression run.
-						// And we send device the number
-						// of additional copies - not the
-						// length
-						//
-						repeatCount--;
-						fl2000_comp_save_repeated_count(
-							&target,
-							repeatDataPointer,
-							bytes_per_pixel,
-							repeatCount);
-					}
-					repeatCount = 0;
-				}
-				else if (source >= isochNextBoundry) {
-					if (repeatCount > 1) {
-						repeatCount--;
-						fl2000_comp_save_repeated_count(
-							&target,
-							repeatDataPointer,
-							bytes_per_pixel,
-							repeatCount);
-					}
-					repeatCount = 0;
-				}
-				else {
-					// After the mask, this pixel is same as
-					// previous one.
-					//
-					repeatCount++;
-					source += bytes_per_pixel;
-				}
+			if ((current_pixel | loosely_mask) ==
+			    (mark_pixel | loosely_mask) &&
+			    (current_pixel == mark_pixel ||
+			     current_pixel != fl2000_comp_get_pixel(
+				source - bytes_per_pixel, bytes_per_pixel)) &&
+			    source < source_boundary) {
+				repeat_count++;
+				source += bytes_per_pixel;
+				continue;
 			}
-			else {
-				// Start over a new compression run.
-				//
-				if (repeatCount > 1) {
-				// A real compression run.
-				// And we send device the number of additional copies - not the length
-				//
-				repeatCount--;
-				fl2000_comp_save_repeated_count(
-					&target,
-					repeatDataPointer,
-					bytes_per_pixel,
-					repeatCount);
-				}
-				repeatCount = 0;
+
+			// A real compression run.
+			// And we send device the number of additional copies - not the length
+			//
+			if (repeat_count > 1) {
+				if (pack_555)
+					fl2000_comp_save_repeated_count2(
+						&target,
+						repeat_data,
+						target_bytes_per_pixel,
+						repeat_count - 1);
+				else
+					fl2000_comp_save_repeated_count(
+						&target,
+						repeat_data,
+						bytes_per_pixel,
+						repeat_count - 1);
 			}
 		}
 
-		if ( repeatCount == 0 ) {
-			fl2000_comp_save_repeated_data(
-				target, source, bytes_per_pixel);
-			markPixel = fl2000_comp_get_pixel(
-				source, bytes_per_pixel);
-			repeatDataPointer = source;
-
-			target += bytes_per_pixel;
-			source += bytes_per_pixel;
-
-			if (isochCompression) {
-				ASSERT(false);
-			}
+		if (pack_555)
+			fl2000_comp_save_repeated_data2(target, source);
+		else
+			fl2000_comp_save_repeated_data(target, source, bytes_per_pixel);
+		mark_pixel = current_pixel;
+		repeat_data = source;
 
-			repeatCount++;
-		}
+		target += target_bytes_per_pixel;
+		source += bytes_per_pixel;
+		repeat_count = 1;
 	}
 
 	// When we exit, we could be in the middle of a run. If so we need to do
 	// a special termination.
 	//
-	if (repeatCount > 1)  {
-		// A real compression run.
-		// And we send device the number of additional copies - not the length
-		//
-		repeatCount--;
-
-		if (repeatCount > 1) {
-			fl2000_comp_save_repeated_count(
-				&target,
-				repeatDataPointer,
-				bytes_per_pixel,
-				repeatCount - 1 );
+	if (repeat_count > 1) {
+		if (repeat_count > 2) {
+			if (pack_555)
+				fl2000_comp_save_repeated_count2(
+					&target,
+					repeat_data,
+					target_bytes_per_pixel,
+					repeat_count - 2);
+			else
+				fl2000_comp_save_repeated_count(
+					&target,
+					repeat_data,
+					bytes_per_pixel,
+					repeat_count - 2);
 		}
 
 		// Hardware bug: The end of compressed data must be single pixel.
 		//
-		fl2000_comp_save_repeated_data(
-			target, repeatDataPointer, bytes_per_pixel);
-		target += bytes_per_pixel;
+		if (pack_555)
+			fl2000_comp_save_repeated_data2(target, repeat_data);
+		else
+			fl2000_comp_save_repeated_data(
+				target, repeat_data, bytes_per_pixel);
+		target += target_bytes_per_pixel;
 	}
 
-	if (dev_ctx->vr_params.use_compression)
-		data_buffer_length = target - targetOriginalPointer;
+	return (target - target_start);
+}
 
-	if (isochCompression) {
-		ASSERT(false);
-	}
-	else {
-		// Make sure compressed data buffer length is aligned.
-		//
-		fl2000_comp_padding_alignment(
-			dev_ctx,
-			target,
-			&data_buffer_length);
-		// target is invalid here.
-		//
-	}
+/*
+ * one instance of the run loop per supported pixel layout.
+ */
+static size_t
+fl2000_comp_gravity_pass(
+	uint8_t * source,
+	uint8_t * source_boundary,
+	uint8_t * target,
+	uint32_t num_of_pixels,
+	uint32_t loosely_mask,
+	uint32_t bytes_per_pixel,
+	bool pack_555)
+{
+	if (pack_555)
+		return fl2000_comp_gravity_run(
+			source, source_boundary, target, num_of_pixels,
+			loosely_mask, PIXEL_BYTE_3, true);
 
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+	switch (bytes_per_pixel) {
+	case PIXEL_BYTE_2:
+		return fl2000_comp_gravity_run(
+			source, source_boundary, target, num_of_pixels,
+			loosely_mask, PIXEL_BYTE_2, false);
 
-	return (data_buffer_length);
+	case PIXEL_BYTE_3:
+		return fl2000_comp_gravity_run(
+			source, source_boundary, target, num_of_pixels,
+			loosely_mask, PIXEL_BYTE_3, false);
+
+	default:
+		return fl2000_comp_gravity_run(
+			source, source_boundary, target, num_of_pixels,
+			loosely_mask, PIXEL_BYTE_1, false);
+	}
 }
 
-__inline
-void fl2000_comp_save_repeated_data2(
-	uint8_t * target,
-	uint8_t * source)
+void
+fl2000_comp_stripe_work(struct work_struct * work_item)
 {
-	uint8_t r, g, b;
+	struct comp_stripe * const stripe =
+		container_of(work_item, struct comp_stripe, work);
+
+	stripe->length = fl2000_comp_gravity_pass(
+		stripe->source,
+		stripe->source_boundary,
+		stripe->target,
+		stripe->num_of_pixels,
+		stripe->mask,
+		stripe->bytes_per_pixel,
+		stripe->pack_555);
+}
 
-	// Optimized function to process pixel fromat transform and compression
-	// together.
-	//
-	r = source[2] >> 3;
-	g = source[1] >> 3;
-	b = source[0] >> 3;
+/*
+ * how many stripes to cut a frame of this height into.
+ */
+static uint32_t
+fl2000_comp_num_stripes(struct dev_ctx * dev_ctx, uint32_t height)
+{
+	uint32_t num_stripes = render_compression_stripes;
 
-	target[1] = 0x80 | (r << 2) | (g >> 3);
-	target[0] = ((g & 0x07) << 5 ) | b;
+	if (dev_ctx->render.comp_wq == NULL)
+		return 1;
+
+	if (num_stripes == 0)
+		num_stripes = num_online_cpus();
+	num_stripes = min_t(uint32_t, num_stripes, MAX_COMPRESSION_STRIPES);
+	num_stripes = min_t(uint32_t, num_stripes,
+		height / COMPRESSION_MIN_STRIPE_ROWS);
+	return max_t(uint32_t, num_stripes, 1);
 }
 
-__inline void
-fl2000_comp_save_repeated_count2(
-	uint8_t ** target_ptr,
-	uint8_t *  repeat_data,
-	uint32_t   bytes_per_pixel,
-	uint32_t   repeat_count)
+size_t fl2000_comp_gravity_low(
+	struct dev_ctx * dev_ctx,
+	struct render_ctx * render_ctx,		// NOT USED
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t num_of_pixels,
+	uint32_t bytes_per_pixel,
+	bool NoCompressionToFirst1K)
 {
-	uint32_t repeat_chunk_size;
-	uint8_t r, g, b;
-	uint8_t * target = *target_ptr;
+	uint32_t looselyColorMaskRGB;
+	uint8_t * sourceBoundary;
+	size_t compressed_length;
 
-	do  {
-		if (repeat_count > 0x7FFF)
-			repeat_chunk_size = 0x7FFF;
-		else
-			repeat_chunk_size = repeat_count;
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
 
-		target[0] = (uint8_t)(repeat_chunk_size);
-		target[1] = (uint8_t)((repeat_chunk_size & 0x7FFF) >> 8);
-		target += PIXEL_BYTE_2;
-		repeat_count -= repeat_chunk_size;
+	looselyColorMaskRGB = fl2000_comp_get_current_mask_value(dev_ctx);
 
-		if (repeat_count > 0) {
-			r = repeat_data[2] >> 3;
-			g = repeat_data[1] >> 3;
-			b = repeat_data[0] >> 3;
+	/*
+	 * Bulk transfer doesn't need to consider packet boundry, and
+	 * set the value to the end of transfer.
+	 */
+	sourceBoundary = source + data_buffer_length;
 
-			target[1] = 0x80 | (r << 2) | (g >> 3);
-			target[0] = ((g & 0x07) << 5) | b;
-			target += PIXEL_BYTE_2;
+	compressed_length = fl2000_comp_gravity_pass(
+		source,
+		sourceBoundary,
+		target,
+		num_of_pixels,
+		looselyColorMaskRGB,
+		bytes_per_pixel,
+		false);
+	target += compressed_length;
 
-			repeat_count -= 1;
-		}
-	} while ( repeat_count > 1 );
+	if (dev_ctx->vr_params.use_compression)
+		data_buffer_length = compressed_length;
+
+	// Make sure compressed data buffer length is aligned.
+	//
+	fl2000_comp_padding_alignment(
+		dev_ctx,
+		target,
+		&data_buffer_length);
+	// target is invalid here.
+	//
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+
+	return (data_buffer_length);
 }
 
 size_t
@@ -595,171 +769,28 @@ fl2000_comp_gravity_low2(
 	uint32_t num_of_pixels,
 	bool NoCompressionToFirst1K)
 {
-	uint32_t i;
 	uint32_t looselyColorMaskRGB;
-	uint32_t repeatCount;
-	uint32_t markPixel;
-	uint32_t currentPixel;
-	uint32_t previousPixel;
-	uint8_t * repeatDataPointer;
-	uint8_t * targetOriginalPointer;
-	uint8_t * sourceOriginalPointer;
-	uint32_t currentPixelWithMask;
-	uint32_t markPixelWithMask;
-	uint8_t * sourceBoundary;
 
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
 
 	ASSERT(SourcePixelBytes == PIXEL_BYTE_3 &&
 	       TargetPixelBytes == PIXEL_BYTE_2);
 
-	targetOriginalPointer = target;
-	sourceOriginalPointer = source;
-	repeatDataPointer = source;
-
-	markPixel = 0;
-	previousPixel = 0;
-	repeatCount = 0;
-
 	looselyColorMaskRGB = fl2000_comp_get_current_mask_value(dev_ctx);
 
 	// source only care about RGB555.
 	//
 	looselyColorMaskRGB |= 0x00070707;
 
-	sourceBoundary = source + data_buffer_length;
-
-	for ( i = 0; i < num_of_pixels; i++ ) {
-		currentPixel = fl2000_comp_get_pixel(source, SourcePixelBytes);
-		currentPixelWithMask = (currentPixel | looselyColorMaskRGB);
-		markPixelWithMask = (markPixel | looselyColorMaskRGB);
-		if (repeatCount > 0) {
-			// It's loosely comparsion, if current pixel after the
-			// mask that looks like repeatDataPointer pixel, then we
-			// treat it as the same group of current compression
-			// run.
-			//
-			if (currentPixelWithMask == markPixelWithMask) {
-				bool notExactlyTheSameAsMarkPixel;
-				bool exactlyTheSameAsPreviousPixel;
-
-				if (markPixel != currentPixel)
-					notExactlyTheSameAsMarkPixel = true;
-				else
-					notExactlyTheSameAsMarkPixel = false;
-
-				previousPixel = fl2000_comp_get_pixel(
-					source - SourcePixelBytes, SourcePixelBytes);
-
-				if (previousPixel == currentPixel)
-					exactlyTheSameAsPreviousPixel = true;
-				else
-					exactlyTheSameAsPreviousPixel = false;
-
-				// This algorithem check two condtions to prevent worse
-				// color trailing issue.
-				// If we match these two conditions, we have to start a
-				// new compression run.
-				//
-				// 1. Current pixel is *not the same* as repeatDataPointer
-				//    pixel.
-				// 2. Current pixel is *the same* as previous pixel.
-				//
-				if (notExactlyTheSameAsMarkPixel &&
-				    exactlyTheSameAsPreviousPixel) {
-					// Start over a new compression run.
-					//
-					if (repeatCount > 1) {
-						// A real compression run.
-						// And we send device the number of
-						// additional copies - not the length
-						//
-						repeatCount--;
-						fl2000_comp_save_repeated_count2(
-							&target,
-							repeatDataPointer,
-							TargetPixelBytes,
-							repeatCount);
-					}
-					repeatCount = 0;
-				}
-				else if (source >= sourceBoundary) {
-					// USE_COMPRESSION_SKIP_FIRSTPIXEL_WORKAROUND
-					// will hit the case.
-					//
-					if (repeatCount > 1) {
-						repeatCount--;
-						fl2000_comp_save_repeated_count2(
-							&target,
-							repeatDataPointer,
-							TargetPixelBytes,
-							repeatCount);
-					}
-					repeatCount = 0;
-				}
-				else {
-					// After the mask, this pixel is same as
-					// previous one.
-					//
-					repeatCount++;
-					source += SourcePixelBytes;
-				}
-			}
-			else  {
-			// Start over a new compression run.
-			//
-				if (repeatCount > 1) {
-					// A real compression run.
-					// And we send device the number of additional
-					// copies - not the length
-					//
-					repeatCount--;
-					fl2000_comp_save_repeated_count2(
-						&target,
-						repeatDataPointer,
-						TargetPixelBytes,
-						repeatCount);
-				}
-				repeatCount = 0;
-			}
-		}
-
-		if (repeatCount == 0) {
-			fl2000_comp_save_repeated_data2(target, source);
-
-			markPixel = fl2000_comp_get_pixel(
-				source, SourcePixelBytes);
-			repeatDataPointer = source;
-
-			target += TargetPixelBytes;
-			source += SourcePixelBytes;
-
-			repeatCount++;
-		}
-	}
-
-	// When we exit, we could be in the middle of a run. If so we need to do a special termination.
-	//
-	if (repeatCount > 1) {
-		// A real compression run.
-		// And we send device the number of additional copies - not the length
-		//
-		repeatCount--;
-
-		if (repeatCount > 1)
-			fl2000_comp_save_repeated_count2(
-				&target,
-				repeatDataPointer,
-				TargetPixelBytes,
-				repeatCount - 1);
-
-		// Hardware bug: The end of compressed data must be single pixel.
-		//
-		fl2000_comp_save_repeated_data2( target, repeatDataPointer );
-		target += TargetPixelBytes;
-	}
-
-	data_buffer_length = (target - targetOriginalPointer);
+	data_buffer_length = fl2000_comp_gravity_pass(
+		source,
+		source + data_buffer_length,
+		target,
+		num_of_pixels,
+		looselyColorMaskRGB,
+		PIXEL_BYTE_3,
+		true);
+	target += data_buffer_length;
 
 	// Make sure compressed data buffer length is aligned.
 	//
@@ -913,6 +944,88 @@ fl2000_compression_gravity2(
 	return (compressed_length);
 }
 
+/*
+ * gravity compression of a whole frame, cut into horizontal stripes that are
+ * compressed in parallel on render.comp_wq. The calling thread takes the
+ * first stripe itself.
+ *
+ * Every stripe starts with a single pixel and ends on one (the hardware
+ * wants the last compressed pixel single), so each stripe decodes to exactly
+ * its own pixels. Joining them is then just closing the gaps: stripe i is
+ * compressed in place at its worst case offset, and moved down right behind
+ * stripe i - 1.
+ */
+size_t
+fl2000_compression_gravity_striped(
+	struct dev_ctx * dev_ctx,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t width,
+	uint32_t height,
+	bool pack_555)
+{
+	struct comp_stripe * const stripes = dev_ctx->render.comp_stripe;
+	uint32_t const bytes_per_pixel = pack_555 ? PIXEL_BYTE_3 :
+		GET_BYTES_PER_PIXEL(dev_ctx->vr_params.output_image_type);
+	uint32_t const target_bytes_per_pixel =
+		pack_555 ? PIXEL_BYTE_2 : bytes_per_pixel;
+	uint32_t mask;
+	uint32_t num_stripes;
+	uint32_t stripe_rows;
+	uint32_t first_row;
+	uint32_t i;
+	size_t compressed_length;
+
+	mask = fl2000_comp_get_current_mask_value(dev_ctx);
+	if (pack_555)
+		mask |= 0x00070707;
+
+	num_stripes = fl2000_comp_num_stripes(dev_ctx, height);
+	stripe_rows = DIV_ROUND_UP(height, num_stripes);
+	num_stripes = DIV_ROUND_UP(height, stripe_rows);
+
+	for (i = 0; i < num_stripes; i++) {
+		struct comp_stripe * const stripe = &stripes[i];
+
+		first_row = i * stripe_rows;
+		stripe->source = source + first_row * width * bytes_per_pixel;
+		stripe->source_boundary = source + data_buffer_length;
+		stripe->target =
+			target + first_row * width * target_bytes_per_pixel;
+		stripe->num_of_pixels =
+			min(stripe_rows, height - first_row) * width;
+		stripe->bytes_per_pixel = bytes_per_pixel;
+		stripe->mask = mask;
+		stripe->pack_555 = pack_555;
+		stripe->length = 0;
+
+		if (i > 0)
+			queue_work(dev_ctx->render.comp_wq, &stripe->work);
+	}
+
+	fl2000_comp_stripe_work(&stripes[0].work);
+
+	compressed_length = stripes[0].length;
+	for (i = 1; i < num_stripes; i++) {
+		flush_work(&stripes[i].work);
+		memmove(target + compressed_length,
+			stripes[i].target,
+			stripes[i].length);
+		compressed_length += stripes[i].length;
+	}
+	dev_ctx->render.last_comp_stripes = num_stripes;
+
+	// Make sure compressed data buffer length is aligned.
+	//
+	fl2000_comp_padding_alignment(
+		dev_ctx,
+		target + compressed_length,
+		&compressed_length);
+
+	return (compressed_length);
+}
+
 size_t
 fl2000_comp_decompress_and_check(
 	struct dev_ctx * dev_ctx,
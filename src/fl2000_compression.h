@@ -59,6 +59,14 @@
 
 #define MAX_COMPRESSION_RETRY_COUNT_COUNT 120
 
+// Frames in a row well under budget before the mask is raised again.
+//
+#define COMPRESSION_CALM_FRAMES 30
+
+// A frame is not cut into stripes of fewer rows than this.
+//
+#define COMPRESSION_MIN_STRIPE_ROWS 32
+
 size_t fl2000_comp_gravity_low(
 	struct dev_ctx * dev_ctx,
 	struct render_ctx * render_ctx,
@@ -85,6 +93,16 @@ size_t fl2000_compression_gravity2(
 	uint8_t * target,
 	uint32_t num_of_pixels);
 
+void fl2000_comp_stripe_work(struct work_struct * work_item);
+size_t fl2000_compression_gravity_striped(
+	struct dev_ctx * dev_ctx,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t width,
+	uint32_t height,
+	bool pack_555);
+
 size_t fl2000_comp_decompress_and_check(
     struct dev_ctx * dev_ctx,
     size_t CompressedBufferLength,
@@ -96,6 +114,12 @@ size_t fl2000_comp_decompress_and_check(
 void fl2000_comp_raise_mask(struct dev_ctx * dev_ctx);
 void fl2000_comp_lower_mask(struct dev_ctx * dev_ctx);
 void fl2000_comp_apply_safest_mask(struct dev_ctx * dev_ctx);
+uint32_t fl2000_comp_get_current_mask_value(struct dev_ctx * dev_ctx);
+uint32_t fl2000_comp_frame_budget(struct dev_ctx * dev_ctx);
+bool fl2000_comp_control(
+	struct dev_ctx * dev_ctx,
+	size_t compressed_length,
+	uint32_t retry_count);
 
 #endif // _FL2000_COMPRESSION_H_
 
@@ -65,7 +65,39 @@ struct vr_params
 	uint32_t	color_mode_16bit;
 };
 
-#define	MAX_NUM_FRAGMENT	((MAX_BUFFER_SIZE + PAGE_SIZE - 1) >> PAGE_SHIFT)
+/*
+ * rows per band of the shadow_buffer change detection
+ */
+#define SURFACE_BAND_ROWS		64
+
+/*
+ * shadow buffers given back by destroyed surfaces, kept for the next ones
+ */
+#define SHADOW_POOL_SIZE		4
+
+/*
+ * what shadow_buffer holds
+ */
+#define SHADOW_FORMAT_NONE		0
+#define SHADOW_FORMAT_SWAPPED		1	/* pixel_swap of the user buffer */
+#define SHADOW_FORMAT_PACKED_16		2	/* pixel_pack_16 of the user buffer */
+#define SHADOW_FORMAT_RAW		3	/* the user buffer, to be compressed */
+
+/*
+ * SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE surfaces keep their user pages
+ * pinned and mapped across updates, until the mm tells us the range changed.
+ */
+#if defined(CONFIG_MMU_NOTIFIER) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+#define FL2000_PIN_CACHE
+#endif
+
+/*
+ * frame completion fences, handed out as sync_file fds by
+ * IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE.
+ */
+#if defined(CONFIG_SYNC_FILE) && LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+#define FL2000_FENCE
+#endif
 
 struct primary_surface {
 	struct list_head 	list_entry;
@@ -77,24 +109,76 @@ struct primary_surface {
 	uint32_t		pitch;
 	uint32_t		color_format;
 	uint32_t		type;
+	uint32_t		flags;
 	uint32_t		frame_num;
 	uint32_t		start_offset;
 	uint64_t		physical_address;
 	struct page *		first_page;
-	uint8_t *		shadow_buffer;
+	uint8_t *		shadow_buffer;	/* allocated on first conversion */
+	uint32_t		shadow_size;
 	uint8_t *		mapped_buffer;	/* return from vm_map_ram */
 	uint8_t *		system_buffer;	/* offset corrected buffer */
 	uint8_t *		render_buffer;
 	bool			pre_locked;
+	bool			flip_ring;	/* owned by fl2000_flip_ring */
+	bool			swap_pending;	/* system_buffer to shadow_buffer */
+	uint32_t		shadow_length;	/* valid bytes in shadow_buffer */
+	uint32_t		shadow_format;
+	uint32_t		shadow_pack_flags;
+
+	/*
+	 * content hash of each SURFACE_BAND_ROWS rows of the user buffer, as
+	 * last converted into shadow_buffer, and the bands damaged since.
+	 */
+	uint64_t *		band_hash;
+	unsigned long *		band_dirty;
+	uint32_t		num_bands;
+	bool			band_hash_valid;
+
+	/*
+	 * the last compressed frame, sent again as is for redundant frames.
+	 * comp_cache_users counts the render_ctx streaming from it.
+	 */
+	uint8_t *		comp_cache;
+	uint32_t		comp_cache_size;
+	uint32_t		comp_cache_length;
+	uint32_t		comp_cache_frame_num;
+	uint32_t		comp_cache_users;
+	bool			comp_cache_pack_555;
+	bool			comp_cache_valid;
 
 	struct page **		pages;
 	unsigned int		nr_pages;
 	int			pages_pinned;
-	struct scatterlist 	sglist[MAX_NUM_FRAGMENT];
+	bool			pages_foll_pin;	/* pinned by pin_user_pages */
+#ifdef FL2000_PIN_CACHE
+	struct mmu_interval_notifier	pin_notifier;
+	unsigned long		pin_seq;
+	bool			pin_notifier_active;
+#endif
+	bool			pin_cached;	/* pages/mapping kept after update */
+	struct sg_table		sg_table;	/* zero-copy surfaces only */
+
+	/*
+	 * SURFACE_TYPE_DMA_BUF: dma_buf_sgt is already mapped for the host
+	 * controller.
+	 */
+	struct dma_buf *		dma_buf;
+	struct dma_buf_attachment *	dma_buf_attach;
+	struct sg_table *		dma_buf_sgt;
 };
 
+/*
+ * how the render_ctx gets its frame onto the bus
+ */
+#define RENDER_TRANSFER_SG		0	/* DMA straight from the surface */
+#define RENDER_TRANSFER_COPY		1	/* memcpy into the urbs */
+#define RENDER_TRANSFER_SWAP		2	/* pixel_swap into the urbs */
+#define RENDER_TRANSFER_PACK_16		3	/* pixel_pack_16 into the urbs */
+
 struct render_ctx {
 	struct list_head 	list_entry;
+	struct list_head 	stream_entry;	/* on urbs.stream_list */
 
 	struct dev_ctx *	dev_ctx;
 	struct primary_surface*	primary_surface;
@@ -102,8 +186,35 @@ struct render_ctx {
 	uint32_t		transfer_buffer_length;
 	struct urb*		main_urb;
 	struct urb*		zero_length_urb;
+	uint32_t		transfer_offset;
+	uint32_t		transfer_mode;
+	uint32_t		pack_flags;
+	uint8_t *		comp_buffer;
+	uint32_t		comp_buffer_size;
+	bool			comp_cached;	/* streams the surface comp_cache */
+	bool			transfer_done;	/* all URBs submitted */
+	int			transfer_status;
 	uint32_t		pending_count;
 	struct tasklet_struct	tasklet;
+	ktime_t			submit_time;	/* queued for streaming */
+	struct dma_fence *	fence;		/* of the NOTIFY that queued it */
+};
+
+/*
+ * a horizontal stripe of the frame, compressed on render.comp_wq.
+ */
+#define MAX_COMPRESSION_STRIPES	8
+
+struct comp_stripe {
+	struct work_struct	work;
+	uint8_t *		source;
+	uint8_t *		source_boundary;
+	uint8_t *		target;
+	uint32_t		num_of_pixels;
+	uint32_t		bytes_per_pixel;
+	uint32_t		mask;
+	bool			pack_555;
+	size_t			length;
 };
 
 struct render {
@@ -130,19 +241,128 @@ struct render {
 	struct primary_surface* last_updated_surface;
 
 	uint32_t		green_light;
+
+	/*
+	 * pixel conversion and submission run here, decoupled from the
+	 * caller of IOCTL_FL2000_NOTIFY_SURFACE_UPDATE.
+	 */
+	struct workqueue_struct *	render_wq;
+	struct work_struct		render_work;
+
+	/*
+	 * render_mailbox mode: the single frame waiting for the render work
+	 * item. A newer update replaces it, and the stale one is dropped.
+	 * mailbox_fence is the fence of that frame, if any.
+	 */
+	struct primary_surface*		mailbox_surface;
+	struct dma_fence *		mailbox_fence;
+	spinlock_t			mailbox_lock;
+	uint32_t			dropped_frame_count;
+
+	/*
+	 * gravity compression, when vr_params.use_compression is set.
+	 * comp_scratch holds zero-copy frames put back in user order.
+	 */
+	uint8_t *			comp_scratch;
+	uint32_t			comp_scratch_size;
+	uint32_t			compressed_frame_count;
+	uint32_t			last_compressed_bytes;
+	uint64_t			compressed_bytes;
+
+	/*
+	 * compression bandwidth control. link_bytes_per_sec is measured on
+	 * completed frames; comp_budget is what one frame may take on the bus.
+	 */
+	uint64_t			link_bytes_per_sec;
+	ktime_t				link_last_done;
+	uint32_t			comp_budget;
+	uint32_t			comp_calm_frames;
+	uint32_t			last_uncompressed_bytes;
+	uint32_t			last_comp_retries;
+	uint32_t			comp_retries;
+
+	/*
+	 * stripes of one frame are compressed in parallel, on an unbound
+	 * workqueue.
+	 */
+	struct workqueue_struct *	comp_wq;
+	struct comp_stripe		comp_stripe[MAX_COMPRESSION_STRIPES];
+	uint32_t			last_comp_stripes;
+	uint32_t			last_comp_us;
+	uint32_t			comp_cache_hits;
+
+	/*
+	 * shadow_buffer updates: bytes converted, bytes skipped because
+	 * their band did not change, and updates with no change at all.
+	 */
+	uint64_t			band_bytes_converted;
+	uint64_t			band_bytes_skipped;
+	uint32_t			unchanged_frame_count;
+
+	/*
+	 * volatile surface updates that found their pages still pinned, and
+	 * those that had to pin them again.
+	 */
+	uint32_t			pin_cache_hits;
+	uint32_t			pin_cache_misses;
+
+	/*
+	 * shadow_buffer pool of the device, reused across surfaces and
+	 * display modes.
+	 */
+	spinlock_t			shadow_pool_lock;
+	uint8_t *			shadow_pool[SHADOW_POOL_SIZE];
+	uint32_t			shadow_pool_size[SHADOW_POOL_SIZE];
+	uint32_t			shadow_pool_hits;
+	uint32_t			shadow_pool_misses;
+
+	/*
+	 * the timeline of the frame completion fences.
+	 */
+	spinlock_t			fence_lock;
+	uint64_t			fence_context;
+	uint64_t			fence_seqno;
+};
+
+/*
+ * a frame buffer handed out by IOCTL_FL2000_ALLOC_FRAME_BUFFER, mapped into
+ * user space at the mmap page offset pgoff.
+ */
+struct fl2000_fb {
+	struct list_head	list_entry;
+	struct page **		pages;
+	unsigned long		nr_pages;
+	unsigned long		pgoff;
+	unsigned long		usr_addr;
+	uint32_t		num_segments;
+	bool			flip_ring;	/* owned by fl2000_flip_ring */
+	struct dma_buf *	dma_buf;	/* exported, see fl2000_dma_buf_export */
+};
+
+/*
+ * a ring of surfaces on one frame buffer, shown by IOCTL_FL2000_FLIP.
+ * buffer i starts at fb->usr_addr + i * buffer_stride.
+ */
+struct fl2000_flip_ring {
+	struct fl2000_fb *	fb;
+	uint32_t		num_buffers;
+	unsigned long		buffer_stride;
+	uint32_t		flip_count;
+	struct primary_surface*	surfaces[MAX_FLIP_BUFFERS];
 };
 
 struct urb_node {
 	struct list_head entry;
 	struct dev_ctx *fl2k;
-	struct delayed_work release_urb_work;
+	struct render_ctx *render_ctx;
 	struct urb *urb;
 };
 
 struct urb_list {
 	struct list_head list;
+	struct list_head stream_list; /* render_ctx waiting for urbs, in bus order */
+	struct work_struct stream_work; /* fills free urbs from stream_list */
 	spinlock_t lock;
-	struct semaphore limit_sem;
 	int available;
 	int count;
 	size_t size;
@@ -220,6 +440,22 @@ struct dev_ctx {
 	 * allocation management
 	 */
 	struct page * 			start_page;
+
+	/*
+	 * IOCTL_FL2000_ALLOC_FRAME_BUFFER allocations
+	 */
+	struct list_head		fb_list;
+	struct mutex			fb_mutex;
+	uint32_t			fb_count;
+	unsigned long			fb_next_pgoff;
+
+	/*
+	 * IOCTL_FL2000_CREATE_FLIP_RING
+	 */
+	struct mutex			flip_mutex;
+	struct fl2000_flip_ring *	flip_ring;
+
+	struct dentry *			debugfs_dir;
 };
 
 #endif // _FL2000_CTX_H_
@@ -0,0 +1,256 @@
+// fl2000_debugfs.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: debugfs statistics, under /sys/kernel/debug/fl2000/<usb device>/
+//
+
+#include "fl2000_include.h"
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+static struct dentry *	fl2000_debugfs_root;
+
+static int
+fl2000_debugfs_compression_show(struct seq_file * m, void * unused)
+{
+	struct dev_ctx * const dev_ctx = m->private;
+	struct vr_params * const vr_params = &dev_ctx->vr_params;
+	struct render * const render = &dev_ctx->render;
+	uint32_t compressed_bytes;
+	uint32_t uncompressed_bytes;
+	uint32_t ratio = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	compressed_bytes = render->last_compressed_bytes;
+	uncompressed_bytes = render->last_uncompressed_bytes;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	/*
+	 * ratio in 1/100, source bytes over bytes on the bus.
+	 */
+	if (compressed_bytes)
+		ratio = (uint32_t) div_u64(
+			(uint64_t) uncompressed_bytes * 100, compressed_bytes);
+
+	seq_printf(m, "enabled: %u\n", vr_params->use_compression);
+	seq_printf(m, "mask_index: %u (%u..%u)\n",
+		vr_params->compression_mask_index,
+		vr_params->compression_mask_index_min,
+		vr_params->compression_mask_index_max);
+	seq_printf(m, "mask: 0x%08x\n",
+		fl2000_comp_get_current_mask_value(dev_ctx));
+	seq_printf(m, "link_bytes_per_sec: %llu\n",
+		(unsigned long long) render->link_bytes_per_sec);
+	seq_printf(m, "frame_budget_bytes: %u\n",
+		fl2000_comp_frame_budget(dev_ctx));
+	seq_printf(m, "compressed_frames: %u\n",
+		render->compressed_frame_count);
+	seq_printf(m, "last_compressed_bytes: %u\n", compressed_bytes);
+	seq_printf(m, "last_ratio: %u.%02u\n", ratio / 100, ratio % 100);
+	seq_printf(m, "last_retries: %u\n", render->last_comp_retries);
+	seq_printf(m, "total_retries: %u\n", render->comp_retries);
+	seq_printf(m, "last_stripes: %u\n", render->last_comp_stripes);
+	seq_printf(m, "last_compress_us: %u\n", render->last_comp_us);
+	seq_printf(m, "cache_hits: %u\n", render->comp_cache_hits);
+	return 0;
+}
+
+static int
+fl2000_debugfs_shadow_show(struct seq_file * m, void * unused)
+{
+	struct dev_ctx * const dev_ctx = m->private;
+	struct render * const render = &dev_ctx->render;
+	uint64_t converted;
+	uint64_t skipped;
+	uint32_t unchanged;
+	uint32_t pin_hits;
+	uint32_t pin_misses;
+	uint32_t pool_buffers = 0;
+	uint64_t pool_bytes = 0;
+	uint32_t i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	converted = render->band_bytes_converted;
+	skipped = render->band_bytes_skipped;
+	unchanged = render->unchanged_frame_count;
+	pin_hits = render->pin_cache_hits;
+	pin_misses = render->pin_cache_misses;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	seq_printf(m, "band_rows: %u\n", SURFACE_BAND_ROWS);
+	seq_printf(m, "bytes_converted: %llu\n",
+		(unsigned long long) converted);
+	seq_printf(m, "bytes_skipped: %llu\n",
+		(unsigned long long) skipped);
+	seq_printf(m, "unchanged_frames: %u\n", unchanged);
+	seq_printf(m, "pin_cache_hits: %u\n", pin_hits);
+	seq_printf(m, "pin_cache_misses: %u\n", pin_misses);
+
+	spin_lock(&render->shadow_pool_lock);
+	for (i = 0; i < SHADOW_POOL_SIZE; i++) {
+		if (render->shadow_pool[i] == NULL)
+			continue;
+		pool_buffers++;
+		pool_bytes += render->shadow_pool_size[i];
+	}
+	spin_unlock(&render->shadow_pool_lock);
+	seq_printf(m, "pool_buffers: %u\n", pool_buffers);
+	seq_printf(m, "pool_bytes: %llu\n", (unsigned long long) pool_bytes);
+	seq_printf(m, "pool_hits: %u\n", render->shadow_pool_hits);
+	seq_printf(m, "pool_misses: %u\n", render->shadow_pool_misses);
+	return 0;
+}
+
+/*
+ * one line per surface, with the kernel memory it takes.
+ */
+static int
+fl2000_debugfs_surfaces_show(struct seq_file * m, void * unused)
+{
+	struct dev_ctx * const dev_ctx = m->private;
+	struct primary_surface* surface;
+	size_t total = 0;
+	size_t shadow_total = 0;
+	size_t shadow_saved = 0;
+	size_t metadata;
+
+	seq_puts(m, "handle width height type pages sg_entries "
+		"metadata_bytes shadow_bytes comp_cache_bytes\n");
+	spin_lock_bh(&dev_ctx->render.surface_list_lock);
+	list_for_each_entry(surface, &dev_ctx->render.surface_list,
+			    list_entry) {
+		metadata = fl2000_surface_metadata_size(surface);
+		total += metadata;
+		if (surface->shadow_buffer != NULL)
+			shadow_total += surface->shadow_size;
+		else
+			shadow_saved += surface->buffer_length;
+		seq_printf(m, "0x%llx %u %u %u %u %u %zu %u %u\n",
+			(unsigned long long) surface->handle,
+			surface->width,
+			surface->height,
+			surface->type,
+			surface->nr_pages,
+			surface->sg_table.orig_nents,
+			metadata,
+			surface->shadow_buffer ? surface->shadow_size : 0,
+			surface->comp_cache_size);
+	}
+	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
+	seq_printf(m, "total_metadata_bytes: %zu\n", total);
+	seq_printf(m, "total_shadow_bytes: %zu\n", shadow_total);
+	seq_printf(m, "shadow_bytes_not_allocated: %zu\n", shadow_saved);
+	fl2000_fb_show(dev_ctx, m);
+	fl2000_flip_show(dev_ctx, m);
+	return 0;
+}
+
+static int
+fl2000_debugfs_compression_open(struct inode * inode, struct file * file)
+{
+	return single_open(file, fl2000_debugfs_compression_show,
+		inode->i_private);
+}
+
+static const struct file_operations fl2000_debugfs_compression_fops = {
+	.owner		= THIS_MODULE,
+	.open		= fl2000_debugfs_compression_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int
+fl2000_debugfs_shadow_open(struct inode * inode, struct file * file)
+{
+	return single_open(file, fl2000_debugfs_shadow_show,
+		inode->i_private);
+}
+
+static const struct file_operations fl2000_debugfs_shadow_fops = {
+	.owner		= THIS_MODULE,
+	.open		= fl2000_debugfs_shadow_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int
+fl2000_debugfs_surfaces_open(struct inode * inode, struct file * file)
+{
+	return single_open(file, fl2000_debugfs_surfaces_show,
+		inode->i_private);
+}
+
+static const struct file_operations fl2000_debugfs_surfaces_fops = {
+	.owner		= THIS_MODULE,
+	.open		= fl2000_debugfs_surfaces_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * debugfs is optional; if it's not there, the driver works without the
+ * statistics.
+ */
+void __init fl2000_debugfs_init(void)
+{
+	fl2000_debugfs_root = debugfs_create_dir("fl2000", NULL);
+	if (IS_ERR(fl2000_debugfs_root))
+		fl2000_debugfs_root = NULL;
+}
+
+void fl2000_debugfs_exit(void)
+{
+	debugfs_remove_recursive(fl2000_debugfs_root);
+	fl2000_debugfs_root = NULL;
+}
+
+void fl2000_debugfs_create(struct dev_ctx * dev_ctx)
+{
+	struct dentry * dir;
+
+	if (fl2000_debugfs_root == NULL)
+		return;
+
+	dir = debugfs_create_dir(dev_name(&dev_ctx->usb_dev->dev),
+		fl2000_debugfs_root);
+	if (IS_ERR_OR_NULL(dir)) {
+		dbg_msg(TRACE_LEVEL_WARNING, DBG_PNP,
+			"no debugfs directory for %s",
+			dev_name(&dev_ctx->usb_dev->dev));
+		return;
+	}
+	dev_ctx->debugfs_dir = dir;
+
+	debugfs_create_file("compression", 0444, dir, dev_ctx,
+		&fl2000_debugfs_compression_fops);
+	debugfs_create_file("shadow", 0444, dir, dev_ctx,
+		&fl2000_debugfs_shadow_fops);
+	debugfs_create_file("surfaces", 0444, dir, dev_ctx,
+		&fl2000_debugfs_surfaces_fops);
+}
+
+void fl2000_debugfs_destroy(struct dev_ctx * dev_ctx)
+{
+	debugfs_remove_recursive(dev_ctx->debugfs_dir);
+	dev_ctx->debugfs_dir = NULL;
+}
+
+// eof: fl2000_debugfs.c
+//
@@ -0,0 +1,22 @@
+// fl2000_debugfs.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_DEBUGFS_H_
+#define _FL2000_DEBUGFS_H_
+
+void fl2000_debugfs_init(void);
+void fl2000_debugfs_exit(void);
+void fl2000_debugfs_create(struct dev_ctx * dev_ctx);
+void fl2000_debugfs_destroy(struct dev_ctx * dev_ctx);
+
+#endif // _FL2000_DEBUGFS_H_
+
+// eof: fl2000_debugfs.h
+//
@@ -57,6 +57,8 @@ int fl2000_dev_init(struct dev_ctx * dev_ctx)
 
 	spin_lock_init(&dev_ctx->count_lock);
 	fl2000_init_flags(dev_ctx);
+	fl2000_fb_init(dev_ctx);
+	fl2000_flip_init(dev_ctx);
 
 	ret_val = fl2000_dev_select_interface(dev_ctx);
 	if (ret_val < 0) {
@@ -75,6 +77,7 @@ int fl2000_dev_init(struct dev_ctx * dev_ctx)
 		goto exit;
 	}
 
+	fl2000_debugfs_create(dev_ctx);
 	fl2000_monitor_manual_check_connection(dev_ctx);
 
 exit:
@@ -93,10 +96,12 @@ void fl2000_dev_destroy(
 	struct dev_ctx * dev_ctx
 	)
 {
+	fl2000_debugfs_destroy(dev_ctx);
 	fl2000_render_stop(dev_ctx);
 	fl2000_dongle_stop(dev_ctx);
 	fl2000_render_destroy(dev_ctx);
 	fl2000_surface_destroy_all(dev_ctx);
+	fl2000_surface_free_shadow_pool(dev_ctx);
 }
 
 // eof: fl2000_dev.c
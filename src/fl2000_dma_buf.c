@@ -0,0 +1,487 @@
+// fl2000_dma_buf.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: dma-buf Sharing
+//
+
+#include "fl2000_include.h"
+
+/*
+ * how long a frame waits for the producer of its dma-buf to finish writing.
+ */
+#define DMA_BUF_FENCE_TIMEOUT_MS	1000
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+#define FL2000_DMA_BUF_EXPORT
+#endif
+
+/*
+ * a frame buffer exported by IOCTL_FL2000_EXPORT_FRAME_BUFFER. It holds its
+ * own page references, so the frame buffer can be freed before the dma-buf.
+ */
+struct fl2000_dma_buf_export {
+	struct page **	pages;
+	unsigned long	nr_pages;
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * the device doing the DMA is the host controller, not the FL2000.
+ */
+static struct device *
+fl2000_dma_buf_device(struct dev_ctx * dev_ctx)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	return dev_ctx->usb_dev->bus->sysdev;
+#else
+	return dev_ctx->usb_dev->bus->controller;
+#endif
+}
+
+static struct sg_table *
+fl2000_dma_buf_map(struct dma_buf_attachment * attach)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+	return dma_buf_map_attachment_unlocked(attach, DMA_TO_DEVICE);
+#else
+	return dma_buf_map_attachment(attach, DMA_TO_DEVICE);
+#endif
+}
+
+static void
+fl2000_dma_buf_unmap(
+	struct dma_buf_attachment * attach,
+	struct sg_table * sgt)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+	dma_buf_unmap_attachment_unlocked(attach, sgt, DMA_TO_DEVICE);
+#else
+	dma_buf_unmap_attachment(attach, sgt, DMA_TO_DEVICE);
+#endif
+}
+
+/*
+ * the attachment is mapped once, when the surface is created. Hand the
+ * pages to the host controller again for each frame, so that on platforms
+ * without coherent DMA the writes of the producer are not left in the cpu
+ * caches.
+ */
+static void
+fl2000_dma_buf_sync_for_device(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	struct sg_table * const sgt = surface->dma_buf_sgt;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	dma_sync_sgtable_for_device(fl2000_dma_buf_device(dev_ctx), sgt,
+		DMA_TO_DEVICE);
+#else
+	dma_sync_sg_for_device(fl2000_dma_buf_device(dev_ctx), sgt->sgl,
+		sgt->orig_nents, DMA_TO_DEVICE);
+#endif
+}
+
+/*
+ * implicit sync: wait until the producer of the dma-buf is done writing the
+ * frame of the surface, as told by the write fences in its reservation
+ * object.
+ */
+static int
+fl2000_dma_buf_wait(
+	struct dma_buf * dma_buf,
+	struct primary_surface* surface)
+{
+	unsigned long const timeout =
+		msecs_to_jiffies(DMA_BUF_FENCE_TIMEOUT_MS);
+	long ret_val;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+	ret_val = dma_resv_wait_timeout(dma_buf->resv,
+		DMA_RESV_USAGE_WRITE, true, timeout);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,15,0)
+	ret_val = dma_resv_wait_timeout(dma_buf->resv,
+		false, true, timeout);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	ret_val = dma_resv_wait_timeout_rcu(dma_buf->resv,
+		false, true, timeout);
+#else
+	ret_val = reservation_object_wait_timeout_rcu(dma_buf->resv,
+		false, true, timeout);
+#endif
+	if (ret_val == 0) {
+		dbg_msg(TRACE_LEVEL_WARNING, DBG_PNP,
+			"surface(%x): dma-buf not written in %u ms?",
+			(unsigned int) surface->handle,
+			DMA_BUF_FENCE_TIMEOUT_MS);
+		return -ETIMEDOUT;
+	}
+	return ret_val < 0 ? (int) ret_val : 0;
+}
+
+#ifdef FL2000_DMA_BUF_EXPORT
+static struct sg_table *
+fl2000_dma_buf_map_dma_buf(
+	struct dma_buf_attachment * attach,
+	enum dma_data_direction dir)
+{
+	struct fl2000_dma_buf_export * const export = attach->dmabuf->priv;
+	struct sg_table * sgt;
+	int ret_val;
+
+	sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+	if (sgt == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	ret_val = sg_alloc_table_from_pages(sgt, export->pages,
+		export->nr_pages, 0, export->nr_pages << PAGE_SHIFT,
+		GFP_KERNEL);
+	if (ret_val < 0)
+		goto free;
+
+	ret_val = dma_map_sgtable(attach->dev, sgt, dir, 0);
+	if (ret_val < 0)
+		goto free_table;
+
+	return sgt;
+
+free_table:
+	sg_free_table(sgt);
+free:
+	kfree(sgt);
+	return ERR_PTR(ret_val);
+}
+
+static void
+fl2000_dma_buf_unmap_dma_buf(
+	struct dma_buf_attachment * attach,
+	struct sg_table * sgt,
+	enum dma_data_direction dir)
+{
+	dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+	sg_free_table(sgt);
+	kfree(sgt);
+}
+
+static void
+fl2000_dma_buf_release_export(struct dma_buf * dma_buf)
+{
+	struct fl2000_dma_buf_export * const export = dma_buf->priv;
+	unsigned long i;
+
+	for (i = 0; i < export->nr_pages; i++)
+		put_page(export->pages[i]);
+	kvfree(export->pages);
+	kfree(export);
+}
+
+static int
+fl2000_dma_buf_mmap(struct dma_buf * dma_buf, struct vm_area_struct * vma)
+{
+	struct fl2000_dma_buf_export * const export = dma_buf->priv;
+	unsigned long const num_pages =
+		(vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	unsigned long i;
+	int ret_val;
+
+	if (vma->vm_pgoff + num_pages > export->nr_pages)
+		return -EINVAL;
+
+	fl2000_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	for (i = 0; i < num_pages; i++) {
+		ret_val = vm_insert_page(vma,
+			vma->vm_start + (i << PAGE_SHIFT),
+			export->pages[vma->vm_pgoff + i]);
+		if (ret_val)
+			return ret_val;
+	}
+	return 0;
+}
+
+static const struct dma_buf_ops fl2000_dma_buf_ops = {
+	.map_dma_buf	= fl2000_dma_buf_map_dma_buf,
+	.unmap_dma_buf	= fl2000_dma_buf_unmap_dma_buf,
+	.release	= fl2000_dma_buf_release_export,
+	.mmap		= fl2000_dma_buf_mmap,
+};
+
+/*
+ * the dma-buf a frame buffer is exported as. The dma-buf core gives it its
+ * own reservation object, for implicit sync between the devices sharing it.
+ */
+static struct dma_buf *
+fl2000_dma_buf_create(struct fl2000_fb * fb)
+{
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct fl2000_dma_buf_export * export;
+	struct dma_buf * dma_buf;
+	unsigned long i;
+
+	export = kzalloc(sizeof(*export), GFP_KERNEL);
+	if (export == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	export->pages = fl2000_fb_get_pages(fb);
+	if (export->pages == NULL) {
+		kfree(export);
+		return ERR_PTR(-ENOMEM);
+	}
+	export->nr_pages = fb->nr_pages;
+
+	exp_info.ops = &fl2000_dma_buf_ops;
+	exp_info.size = export->nr_pages << PAGE_SHIFT;
+	exp_info.flags = O_RDWR;
+	exp_info.priv = export;
+	dma_buf = dma_buf_export(&exp_info);
+	if (IS_ERR(dma_buf)) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma_buf_export failed %ld?", PTR_ERR(dma_buf));
+		for (i = 0; i < export->nr_pages; i++)
+			put_page(export->pages[i]);
+		kvfree(export->pages);
+		kfree(export);
+	}
+	return dma_buf;
+}
+
+/*
+ * implicit sync the other way: the frame fence goes into the reservation
+ * object as a read fence, so devices writing the buffer next wait until the
+ * frame is read out.
+ */
+static int
+fl2000_dma_buf_add_read_fence(
+	struct dma_buf * dma_buf,
+	struct dma_fence * fence)
+{
+	int ret_val;
+
+	ret_val = dma_resv_lock(dma_buf->resv, NULL);
+	if (ret_val < 0)
+		return ret_val;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+	ret_val = dma_resv_reserve_fences(dma_buf->resv, 1);
+	if (ret_val == 0)
+		dma_resv_add_fence(dma_buf->resv, fence, DMA_RESV_USAGE_READ);
+#else
+	ret_val = dma_resv_reserve_shared(dma_buf->resv, 1);
+	if (ret_val == 0)
+		dma_resv_add_shared_fence(dma_buf->resv, fence);
+#endif
+	dma_resv_unlock(dma_buf->resv);
+	return ret_val;
+}
+#endif // FL2000_DMA_BUF_EXPORT
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * attach the dma-buf whose fd is in user_buffer, and map it for the host
+ * controller once. The bulk urbs then DMA straight from the mapped sg_table.
+ */
+int fl2000_dma_buf_import(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	struct dma_buf * dma_buf;
+	struct dma_buf_attachment * attach;
+	struct sg_table * sgt;
+	int fd = (int) surface->user_buffer;
+	int ret_val;
+
+	dma_buf = dma_buf_get(fd);
+	if (IS_ERR(dma_buf)) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"fd(%d) is not a dma-buf?", fd);
+		return PTR_ERR(dma_buf);
+	}
+
+	if (dma_buf->size < surface->buffer_length) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma-buf size(0x%zx) below buffer_length(0x%x)?",
+			dma_buf->size, surface->buffer_length);
+		ret_val = -EINVAL;
+		goto put;
+	}
+
+	attach = dma_buf_attach(dma_buf, fl2000_dma_buf_device(dev_ctx));
+	if (IS_ERR(attach)) {
+		ret_val = PTR_ERR(attach);
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma_buf_attach failed %d?", ret_val);
+		goto put;
+	}
+
+	sgt = fl2000_dma_buf_map(attach);
+	if (IS_ERR(sgt)) {
+		ret_val = PTR_ERR(sgt);
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma_buf_map_attachment failed %d?", ret_val);
+		goto detach;
+	}
+
+	surface->dma_buf = dma_buf;
+	surface->dma_buf_attach = attach;
+	surface->dma_buf_sgt = sgt;
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+		"surface(%x): dma-buf of 0x%zx bytes in %u sg entries",
+		(unsigned int) surface->handle, dma_buf->size, sgt->nents);
+	return 0;
+
+detach:
+	dma_buf_detach(dma_buf, attach);
+put:
+	dma_buf_put(dma_buf);
+	return ret_val;
+}
+
+/*
+ * a new frame of the surface, shared through a dma-buf.
+ *
+ * An imported dma-buf goes out as it is, so the frame is refused while the
+ * display mode needs the cpu to read it. Otherwise wait for the producer to
+ * finish writing it, and sync its pages for the host controller.
+ *
+ * A surface on an exported frame buffer waits for the writes of the devices
+ * it is shared with. fence, the frame fence if any, then keeps their next
+ * writes off the buffer until the frame is read out.
+ */
+int fl2000_dma_buf_begin_frame(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface,
+	struct dma_fence * fence)
+{
+	struct dma_buf * exported;
+	int ret_val;
+
+	if (surface->dma_buf != NULL) {
+		if (fl2000_render_needs_cpu(dev_ctx, surface)) {
+			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+				"surface(%x): dma-buf cannot be packed or compressed?",
+				(unsigned int) surface->handle);
+			return -EINVAL;
+		}
+		ret_val = fl2000_dma_buf_wait(surface->dma_buf, surface);
+		if (ret_val == 0)
+			fl2000_dma_buf_sync_for_device(dev_ctx, surface);
+		return ret_val;
+	}
+
+	exported = fl2000_fb_get_dma_buf(dev_ctx,
+		(unsigned long) surface->user_buffer, surface->buffer_length);
+	if (exported == NULL)
+		return 0;
+
+	ret_val = fl2000_dma_buf_wait(exported, surface);
+#ifdef FL2000_DMA_BUF_EXPORT
+	if (ret_val == 0 && fence != NULL)
+		ret_val = fl2000_dma_buf_add_read_fence(exported, fence);
+#endif
+	dma_buf_put(exported);
+	return ret_val;
+}
+
+void fl2000_dma_buf_release(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	if (surface->dma_buf == NULL)
+		return;
+
+	fl2000_dma_buf_unmap(surface->dma_buf_attach, surface->dma_buf_sgt);
+	dma_buf_detach(surface->dma_buf, surface->dma_buf_attach);
+	dma_buf_put(surface->dma_buf);
+
+	surface->dma_buf_sgt = NULL;
+	surface->dma_buf_attach = NULL;
+	surface->dma_buf = NULL;
+}
+
+long fl2000_dma_buf_export(struct dev_ctx * dev_ctx, unsigned long arg)
+{
+#ifdef FL2000_DMA_BUF_EXPORT
+	struct frame_buffer_export info;
+	struct fl2000_fb * fb;
+	struct dma_buf * dma_buf;
+	long ret_val;
+	int fd;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	/*
+	 * the fd is only installed once nothing can fail any more, so the
+	 * process never sees an fd that is taken back.
+	 */
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		return fd;
+
+	/*
+	 * a frame buffer is exported once; later exports hand out the same
+	 * dma-buf, so that all its users share one reservation object.
+	 */
+	fb = fl2000_fb_lock(dev_ctx, (unsigned long) info.usr_addr);
+	if (fb == NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no frame buffer at usr_addr(0x%llx)?",
+			(unsigned long long) info.usr_addr);
+		ret_val = -EINVAL;
+		goto put_fd;
+	}
+	if (fb->dma_buf == NULL) {
+		dma_buf = fl2000_dma_buf_create(fb);
+		if (!IS_ERR(dma_buf))
+			fb->dma_buf = dma_buf;
+	} else {
+		dma_buf = fb->dma_buf;
+	}
+	if (!IS_ERR(dma_buf))
+		get_dma_buf(dma_buf);
+	fl2000_fb_unlock(dev_ctx);
+
+	if (IS_ERR(dma_buf)) {
+		ret_val = PTR_ERR(dma_buf);
+		goto put_fd;
+	}
+
+	info.fd = fd;
+	if (copy_to_user((void *) arg, &info, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_to_user fails?");
+		ret_val = -EFAULT;
+		goto put_dma_buf;
+	}
+
+	fd_install(fd, dma_buf->file);
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+		"frame buffer at usr_addr(0x%llx) exported as fd(%d)",
+		(unsigned long long) info.usr_addr, fd);
+	return 0;
+
+put_dma_buf:
+	dma_buf_put(dma_buf);
+put_fd:
+	put_unused_fd(fd);
+	return ret_val;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+// eof: fl2000_dma_buf.c
+//
@@ -0,0 +1,32 @@
+// fl2000_dma_buf.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_DMA_BUF_H_
+#define _FL2000_DMA_BUF_H_
+
+int fl2000_dma_buf_import(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+int fl2000_dma_buf_begin_frame(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface,
+	struct dma_fence * fence);
+
+void fl2000_dma_buf_release(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+long fl2000_dma_buf_export(struct dev_ctx * dev_ctx, unsigned long arg);
+
+#endif // _FL2000_DMA_BUF_H_
+
+// eof: fl2000_dma_buf.h
+//
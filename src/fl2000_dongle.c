@@ -189,6 +189,15 @@ fl2000_set_display_mode(
 		vr_params.color_mode_16bit = VR_16_BIT_COLOR_MODE_555;
 		vr_params.use_compression = 1;
 	}
+	else if (display_mode->use_compression) {
+		vr_params.use_compression = 1;
+
+		/*
+		 * compressed 16bpp data uses bit 15 as the run marker.
+		 */
+		if (vr_params.output_image_type == OUTPUT_IMAGE_TYPE_RGB_16)
+			vr_params.color_mode_16bit = VR_16_BIT_COLOR_MODE_555;
+	}
 
 	ret_val = fl2000_dongle_set_params(dev_ctx, &vr_params);
 	if (ret_val < 0) {
@@ -0,0 +1,465 @@
+// fl2000_fb.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Frame Buffer Allocation
+//
+
+#include "fl2000_include.h"
+
+/*
+ * the largest order the page allocator hands out. MAX_ORDER counts it in
+ * since 6.4, and is named MAX_PAGE_ORDER since 6.8.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,8,0)
+#define FB_MAX_ORDER		MAX_PAGE_ORDER
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+#define FB_MAX_ORDER		MAX_ORDER
+#else
+#define FB_MAX_ORDER		(MAX_ORDER - 1)
+#endif
+
+/*
+ * frame buffers are made of chunks of up to 2MB, allocated as compound pages.
+ * The chunks are mapped to user space page by page; being physically
+ * contiguous, they only save scatter-gather segments.
+ */
+#define FB_CHUNK_ORDER		min_t(unsigned int, get_order(SZ_2M), FB_MAX_ORDER)
+
+/*
+ * mmap page offsets below FB_MMAP_PGOFF_BASE belong to
+ * IOCTL_FL2000_TEST_ALLOC_SURFACE.
+ */
+#define FB_MMAP_PGOFF_BASE	0x10000UL
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * free the chunks of a frame buffer. Each chunk starts with its head page,
+ * which knows the order it was allocated with.
+ */
+static void
+fl2000_fb_free_pages(struct fl2000_fb * fb, unsigned long nr_pages)
+{
+	unsigned long i = 0;
+	unsigned int order;
+
+	while (i < nr_pages) {
+		order = compound_order(fb->pages[i]);
+		__free_pages(fb->pages[i], order);
+		i += 1UL << order;
+	}
+}
+
+/*
+ * allocate nr_pages pages, in chunks as large as the memory allows, falling
+ * back to smaller orders when a chunk cannot be had. After a fallback, each
+ * chunk allocated tries one order higher for the next one, up to
+ * FB_CHUNK_ORDER again.
+ */
+static int
+fl2000_fb_alloc_pages(struct fl2000_fb * fb)
+{
+	unsigned int order = FB_CHUNK_ORDER;
+	unsigned long done = 0;
+	unsigned long i;
+	struct page * page;
+	gfp_t gfp;
+
+	while (done < fb->nr_pages) {
+		while ((1UL << order) > fb->nr_pages - done)
+			order--;
+
+		gfp = GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN;
+		if (order)
+			gfp |= __GFP_COMP | __GFP_NORETRY;
+		page = alloc_pages(gfp, order);
+		if (page == NULL) {
+			if (order == 0) {
+				fl2000_fb_free_pages(fb, done);
+				return -ENOMEM;
+			}
+			order--;
+			continue;
+		}
+
+		for (i = 0; i < (1UL << order); i++)
+			fb->pages[done + i] = page + i;
+		done += 1UL << order;
+
+		if (order < FB_CHUNK_ORDER)
+			order++;
+	}
+
+	/*
+	 * count the physically contiguous runs, which is what the
+	 * scatterlist of a surface on this buffer will have.
+	 */
+	fb->num_segments = 1;
+	for (i = 1; i < fb->nr_pages; i++) {
+		if (page_to_pfn(fb->pages[i]) !=
+		    page_to_pfn(fb->pages[i - 1]) + 1)
+			fb->num_segments++;
+	}
+	return 0;
+}
+
+static void
+fl2000_fb_destroy(struct fl2000_fb * fb)
+{
+	/*
+	 * the dma-buf holds its own page references, and lives on as long as
+	 * somebody has it.
+	 */
+	if (fb->dma_buf != NULL)
+		dma_buf_put(fb->dma_buf);
+	fl2000_fb_free_pages(fb, fb->nr_pages);
+	kvfree(fb->pages);
+	kfree(fb);
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+void fl2000_fb_init(struct dev_ctx * dev_ctx)
+{
+	INIT_LIST_HEAD(&dev_ctx->fb_list);
+	mutex_init(&dev_ctx->fb_mutex);
+	dev_ctx->fb_count = 0;
+	dev_ctx->fb_next_pgoff = FB_MMAP_PGOFF_BASE;
+}
+
+/*
+ * allocate a frame buffer of nr_pages pages, and give it an mmap page offset.
+ */
+struct fl2000_fb *
+fl2000_fb_create(struct dev_ctx * dev_ctx, unsigned long nr_pages)
+{
+	struct fl2000_fb * fb;
+	int ret_val;
+
+	fb = kzalloc(sizeof(*fb), GFP_KERNEL);
+	if (fb == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&fb->list_entry);
+	fb->nr_pages = nr_pages;
+	fb->pages = kvmalloc_array(fb->nr_pages, sizeof(struct page *),
+		GFP_KERNEL);
+	if (fb->pages == NULL) {
+		kfree(fb);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	ret_val = fl2000_fb_alloc_pages(fb);
+	if (ret_val < 0) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no pages for 0x%lx pages?", fb->nr_pages);
+		kvfree(fb->pages);
+		kfree(fb);
+		return ERR_PTR(ret_val);
+	}
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	if (dev_ctx->fb_count >= MAX_FRAME_BUFFERS) {
+		mutex_unlock(&dev_ctx->fb_mutex);
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"fb_count(%u) reaches %u?",
+			dev_ctx->fb_count, MAX_FRAME_BUFFERS);
+		fl2000_fb_destroy(fb);
+		return ERR_PTR(-ENOSPC);
+	}
+	fb->pgoff = dev_ctx->fb_next_pgoff;
+	dev_ctx->fb_next_pgoff += fb->nr_pages;
+	list_add_tail(&fb->list_entry, &dev_ctx->fb_list);
+	dev_ctx->fb_count++;
+	mutex_unlock(&dev_ctx->fb_mutex);
+
+	return fb;
+}
+
+/*
+ * map the frame buffer into the calling process. fl2000_mmap() finds the
+ * buffer by its page offset, so fb_mutex must not be held here.
+ */
+int fl2000_fb_map(struct file * file, struct fl2000_fb * fb)
+{
+	unsigned long usr_addr;
+
+	usr_addr = vm_mmap(file, 0, fb->nr_pages << PAGE_SHIFT,
+		PROT_READ | PROT_WRITE, MAP_SHARED, fb->pgoff << PAGE_SHIFT);
+	if (IS_ERR_VALUE(usr_addr)) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "vm_mmap fails %ld?",
+			(long) usr_addr);
+		return (int) usr_addr;
+	}
+
+	fb->usr_addr = usr_addr;
+	return 0;
+}
+
+/*
+ * take the frame buffer off fb_list and free it. unmap is false when the
+ * device file is being closed, as nothing maps it any more.
+ */
+void fl2000_fb_release(
+	struct dev_ctx * dev_ctx,
+	struct fl2000_fb * fb,
+	bool unmap)
+{
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_del(&fb->list_entry);
+	dev_ctx->fb_count--;
+	mutex_unlock(&dev_ctx->fb_mutex);
+
+	if (unmap && fb->usr_addr)
+		vm_munmap(fb->usr_addr, fb->nr_pages << PAGE_SHIFT);
+	fl2000_fb_destroy(fb);
+}
+
+long fl2000_fb_alloc(struct file * file, unsigned long arg)
+{
+	struct dev_ctx * const dev_ctx = file->private_data;
+	struct frame_buffer_info info;
+	struct fl2000_fb * fb;
+	int ret_val;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	if (info.buffer_size == 0 || info.buffer_size > MAX_BUFFER_SIZE) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"buffer_size(0x%llx) out of range?",
+			(unsigned long long) info.buffer_size);
+		return -EINVAL;
+	}
+
+	fb = fl2000_fb_create(dev_ctx,
+		PAGE_ALIGN(info.buffer_size) >> PAGE_SHIFT);
+	if (IS_ERR(fb))
+		return PTR_ERR(fb);
+
+	ret_val = fl2000_fb_map(file, fb);
+	if (ret_val < 0) {
+		fl2000_fb_release(dev_ctx, fb, false);
+		return ret_val;
+	}
+
+	info.buffer_size = fb->nr_pages << PAGE_SHIFT;
+	info.usr_addr = fb->usr_addr;
+	info.mmap_offset = fb->pgoff << PAGE_SHIFT;
+	info.num_segments = fb->num_segments;
+	if (copy_to_user((void *) arg, &info, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_to_user fails?");
+		fl2000_fb_release(dev_ctx, fb, true);
+		return -EFAULT;
+	}
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+		"frame buffer of 0x%lx pages in %u segments at usr_addr(0x%lx)",
+		fb->nr_pages, fb->num_segments, fb->usr_addr);
+	return 0;
+}
+
+long fl2000_fb_free(struct dev_ctx * dev_ctx, unsigned long arg)
+{
+	struct frame_buffer_info info;
+	struct fl2000_fb * fb;
+	struct fl2000_fb * found = NULL;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry(fb, &dev_ctx->fb_list, list_entry) {
+		if (fb->usr_addr == info.usr_addr && !fb->flip_ring) {
+			list_del(&fb->list_entry);
+			dev_ctx->fb_count--;
+			found = fb;
+			break;
+		}
+	}
+	mutex_unlock(&dev_ctx->fb_mutex);
+
+	if (found == NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no frame buffer at usr_addr(0x%llx)?",
+			(unsigned long long) info.usr_addr);
+		return -EINVAL;
+	}
+
+	/*
+	 * surfaces still on the buffer hold their own page references.
+	 */
+	vm_munmap(found->usr_addr, found->nr_pages << PAGE_SHIFT);
+	fl2000_fb_destroy(found);
+	return 0;
+}
+
+/*
+ * called when the device file is closed, so nothing maps the buffers any
+ * more.
+ */
+void fl2000_fb_free_all(struct dev_ctx * dev_ctx)
+{
+	struct fl2000_fb * fb;
+	struct fl2000_fb * next;
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry_safe(fb, next, &dev_ctx->fb_list, list_entry) {
+		list_del(&fb->list_entry);
+		fl2000_fb_destroy(fb);
+	}
+	dev_ctx->fb_count = 0;
+	mutex_unlock(&dev_ctx->fb_mutex);
+}
+
+/*
+ * find the frame buffer at usr_addr. It is returned with fb_mutex held, so
+ * that it stays, until fl2000_fb_unlock(); NULL, without the mutex, if there
+ * is no such buffer.
+ */
+struct fl2000_fb *
+fl2000_fb_lock(struct dev_ctx * dev_ctx, unsigned long usr_addr)
+{
+	struct fl2000_fb * fb;
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry(fb, &dev_ctx->fb_list, list_entry) {
+		if (fb->usr_addr == usr_addr)
+			return fb;
+	}
+	mutex_unlock(&dev_ctx->fb_mutex);
+
+	return NULL;
+}
+
+void fl2000_fb_unlock(struct dev_ctx * dev_ctx)
+{
+	mutex_unlock(&dev_ctx->fb_mutex);
+}
+
+/*
+ * copy the page array of a frame buffer, with a reference on each page, so
+ * the copy outlives the frame buffer.
+ */
+struct page ** fl2000_fb_get_pages(struct fl2000_fb * fb)
+{
+	struct page ** pages;
+	unsigned long i;
+
+	pages = kvmalloc_array(fb->nr_pages, sizeof(struct page *),
+		GFP_KERNEL);
+	if (pages == NULL)
+		return NULL;
+	for (i = 0; i < fb->nr_pages; i++) {
+		pages[i] = fb->pages[i];
+		get_page(pages[i]);
+	}
+	return pages;
+}
+
+/*
+ * the dma-buf a user buffer of length bytes at usr_addr is shared through,
+ * if it lies in an exported frame buffer. The caller puts the reference.
+ */
+struct dma_buf *
+fl2000_fb_get_dma_buf(
+	struct dev_ctx * dev_ctx,
+	unsigned long usr_addr,
+	unsigned long length)
+{
+	struct fl2000_fb * fb;
+	struct dma_buf * dma_buf = NULL;
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry(fb, &dev_ctx->fb_list, list_entry) {
+		if (fb->dma_buf == NULL || usr_addr < fb->usr_addr ||
+		    usr_addr - fb->usr_addr + length >
+		    (fb->nr_pages << PAGE_SHIFT))
+			continue;
+
+		dma_buf = fb->dma_buf;
+		get_dma_buf(dma_buf);
+		break;
+	}
+	mutex_unlock(&dev_ctx->fb_mutex);
+
+	return dma_buf;
+}
+
+/*
+ * map a frame buffer, if vma->vm_pgoff is one of ours. Returns -ENOENT for
+ * the test allocation offsets.
+ */
+int fl2000_fb_mmap(struct dev_ctx * dev_ctx, struct vm_area_struct * vma)
+{
+	unsigned long const num_pages =
+		(vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	struct fl2000_fb * fb;
+	struct fl2000_fb * found = NULL;
+	unsigned long i;
+	int ret_val = 0;
+
+	if (vma->vm_pgoff < FB_MMAP_PGOFF_BASE)
+		return -ENOENT;
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry(fb, &dev_ctx->fb_list, list_entry) {
+		if (fb->pgoff == vma->vm_pgoff) {
+			found = fb;
+			break;
+		}
+	}
+
+	if (found == NULL || num_pages > found->nr_pages) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no frame buffer of 0x%lx pages at pgoff(0x%lx)?",
+			num_pages, vma->vm_pgoff);
+		ret_val = -EINVAL;
+		goto exit;
+	}
+
+	fl2000_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	for (i = 0; i < num_pages; i++) {
+		ret_val = vm_insert_page(vma,
+			vma->vm_start + (i << PAGE_SHIFT),
+			found->pages[i]);
+		if (ret_val) {
+			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+				"vm_insert_page(0x%lx) failed %d",
+				i, ret_val);
+			break;
+		}
+	}
+
+exit:
+	mutex_unlock(&dev_ctx->fb_mutex);
+	return ret_val;
+}
+
+void fl2000_fb_show(struct dev_ctx * dev_ctx, struct seq_file * m)
+{
+	struct fl2000_fb * fb;
+
+	mutex_lock(&dev_ctx->fb_mutex);
+	list_for_each_entry(fb, &dev_ctx->fb_list, list_entry)
+		seq_printf(m, "frame_buffer 0x%lx %lu pages %u segments\n",
+			fb->usr_addr, fb->nr_pages, fb->num_segments);
+	mutex_unlock(&dev_ctx->fb_mutex);
+}
+
+// eof: fl2000_fb.c
+//
@@ -0,0 +1,41 @@
+// fl2000_fb.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_FB_H_
+#define _FL2000_FB_H_
+
+void fl2000_fb_init(struct dev_ctx * dev_ctx);
+struct fl2000_fb * fl2000_fb_create(
+	struct dev_ctx * dev_ctx,
+	unsigned long nr_pages);
+int fl2000_fb_map(struct file * file, struct fl2000_fb * fb);
+void fl2000_fb_release(
+	struct dev_ctx * dev_ctx,
+	struct fl2000_fb * fb,
+	bool unmap);
+long fl2000_fb_alloc(struct file * file, unsigned long arg);
+long fl2000_fb_free(struct dev_ctx * dev_ctx, unsigned long arg);
+void fl2000_fb_free_all(struct dev_ctx * dev_ctx);
+struct fl2000_fb * fl2000_fb_lock(
+	struct dev_ctx * dev_ctx,
+	unsigned long usr_addr);
+void fl2000_fb_unlock(struct dev_ctx * dev_ctx);
+struct page ** fl2000_fb_get_pages(struct fl2000_fb * fb);
+struct dma_buf * fl2000_fb_get_dma_buf(
+	struct dev_ctx * dev_ctx,
+	unsigned long usr_addr,
+	unsigned long length);
+int fl2000_fb_mmap(struct dev_ctx * dev_ctx, struct vm_area_struct * vma);
+void fl2000_fb_show(struct dev_ctx * dev_ctx, struct seq_file * m);
+
+#endif // _FL2000_FB_H_
+
+// eof: fl2000_fb.h
+//
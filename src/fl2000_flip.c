@@ -0,0 +1,277 @@
+// fl2000_flip.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Page Flipping
+//
+
+#include "fl2000_include.h"
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * destroy the surfaces of the ring, then its frame buffer. unmap is false
+ * when the device file is being closed.
+ */
+static void
+fl2000_flip_ring_destroy(
+	struct dev_ctx * dev_ctx,
+	struct fl2000_flip_ring * ring,
+	bool unmap)
+{
+	struct primary_surface* surface;
+	unsigned long flags;
+	uint32_t i;
+
+	for (i = 0; i < ring->num_buffers; i++) {
+		surface = ring->surfaces[i];
+		if (surface == NULL)
+			continue;
+
+		spin_lock_bh(&dev_ctx->render.surface_list_lock);
+		list_del_init(&surface->list_entry);
+		spin_lock_irqsave(&dev_ctx->count_lock, flags);
+		dev_ctx->render.surface_list_count--;
+		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		spin_unlock_bh(&dev_ctx->render.surface_list_lock);
+
+		fl2000_surface_destroy(dev_ctx, surface);
+	}
+
+	if (ring->fb)
+		fl2000_fb_release(dev_ctx, ring->fb, unmap);
+	kfree(ring);
+}
+
+static uint32_t
+fl2000_flip_free_mask(
+	struct dev_ctx * dev_ctx,
+	struct fl2000_flip_ring * ring)
+{
+	uint32_t free_mask = 0;
+	uint32_t i;
+
+	for (i = 0; i < ring->num_buffers; i++) {
+		if (!fl2000_render_surface_busy(dev_ctx, ring->surfaces[i]))
+			free_mask |= 1U << i;
+	}
+	return free_mask;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+void fl2000_flip_init(struct dev_ctx * dev_ctx)
+{
+	mutex_init(&dev_ctx->flip_mutex);
+	dev_ctx->flip_ring = NULL;
+}
+
+long fl2000_flip_create_ring(struct file * file, unsigned long arg)
+{
+	struct dev_ctx * const dev_ctx = file->private_data;
+	struct flip_ring_info info;
+	struct surface_info surface_info;
+	struct fl2000_flip_ring * ring = NULL;
+	struct primary_surface* surface;
+	uint64_t buffer_length;
+	uint32_t i;
+	int ret_val = 0;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	buffer_length = (uint64_t) info.pitch * info.height;
+	if (info.num_buffers == 0 || info.num_buffers > MAX_FLIP_BUFFERS ||
+	    info.color_format != COLOR_FORMAT_RGB_24 ||
+	    info.pitch != info.width * 3 ||
+	    (info.flags & ~SURFACE_FLAG_ZERO_COPY) ||
+	    buffer_length == 0 || buffer_length > MAX_BUFFER_SIZE) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"num_buffers(%u)/width(%u)/height(%u)/pitch(%u)/"
+			"color_format(%u)/flags(0x%x) not supported?",
+			info.num_buffers, info.width, info.height, info.pitch,
+			info.color_format, info.flags);
+		return -EINVAL;
+	}
+
+	mutex_lock(&dev_ctx->flip_mutex);
+	if (dev_ctx->flip_ring != NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "flip ring exists?");
+		ret_val = -EBUSY;
+		goto exit;
+	}
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (ring == NULL) {
+		ret_val = -ENOMEM;
+		goto exit;
+	}
+	ring->buffer_stride = PAGE_ALIGN(buffer_length);
+
+	ring->fb = fl2000_fb_create(dev_ctx,
+		(ring->buffer_stride >> PAGE_SHIFT) * info.num_buffers);
+	if (IS_ERR(ring->fb)) {
+		ret_val = PTR_ERR(ring->fb);
+		ring->fb = NULL;
+		goto exit;
+	}
+	ring->fb->flip_ring = true;
+
+	ret_val = fl2000_fb_map(file, ring->fb);
+	if (ret_val < 0)
+		goto exit;
+
+	/*
+	 * the buffers are pinned down and mapped here, once, so a flip has
+	 * nothing left to do but queue the surface.
+	 */
+	for (i = 0; i < info.num_buffers; i++) {
+		memset(&surface_info, 0, sizeof(surface_info));
+		surface_info.handle = ring->fb->usr_addr +
+			i * ring->buffer_stride;
+		surface_info.user_buffer = surface_info.handle;
+		surface_info.buffer_length = buffer_length;
+		surface_info.width = info.width;
+		surface_info.height = info.height;
+		surface_info.pitch = info.pitch;
+		surface_info.color_format = info.color_format;
+		surface_info.type = SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT;
+		surface_info.flags = info.flags;
+
+		surface = fl2000_surface_create(dev_ctx, &surface_info, true);
+		if (IS_ERR(surface)) {
+			ret_val = PTR_ERR(surface);
+			goto exit;
+		}
+		ring->surfaces[i] = surface;
+		ring->num_buffers++;
+	}
+
+	info.buffer_stride = ring->buffer_stride;
+	info.usr_addr = ring->fb->usr_addr;
+	info.mmap_offset = ring->fb->pgoff << PAGE_SHIFT;
+	if (copy_to_user((void *) arg, &info, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_to_user fails?");
+		ret_val = -EFAULT;
+		goto exit;
+	}
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+		"flip ring of %u buffers at usr_addr(0x%lx), stride(0x%lx)",
+		ring->num_buffers, ring->fb->usr_addr, ring->buffer_stride);
+	dev_ctx->flip_ring = ring;
+	ring = NULL;
+
+exit:
+	if (ring != NULL)
+		fl2000_flip_ring_destroy(dev_ctx, ring, true);
+	mutex_unlock(&dev_ctx->flip_mutex);
+	return ret_val;
+}
+
+long fl2000_flip_destroy_ring(struct dev_ctx * dev_ctx)
+{
+	struct fl2000_flip_ring * ring;
+
+	mutex_lock(&dev_ctx->flip_mutex);
+	ring = dev_ctx->flip_ring;
+	dev_ctx->flip_ring = NULL;
+	if (ring != NULL)
+		fl2000_flip_ring_destroy(dev_ctx, ring, true);
+	mutex_unlock(&dev_ctx->flip_mutex);
+
+	if (ring == NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "no flip ring?");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+long fl2000_flip(struct dev_ctx * dev_ctx, unsigned long arg)
+{
+	struct fl2000_flip_ring * ring;
+	struct primary_surface* surface;
+	struct flip_info info;
+	long ret_val = 0;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	mutex_lock(&dev_ctx->flip_mutex);
+	ring = dev_ctx->flip_ring;
+	if (ring == NULL || info.index >= ring->num_buffers) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no flip ring buffer at index(%u)?", info.index);
+		ret_val = -EINVAL;
+		goto exit;
+	}
+
+	surface = ring->surfaces[info.index];
+
+	/*
+	 * the ring buffer may be exported, and written by another device.
+	 */
+	ret_val = fl2000_dma_buf_begin_frame(dev_ctx, surface, NULL);
+	if (ret_val < 0)
+		goto exit;
+
+	surface->frame_num++;
+	if (!(surface->flags & SURFACE_FLAG_ZERO_COPY))
+		surface->swap_pending = true;
+	fl2000_primary_surface_update(dev_ctx, surface, NULL);
+	ring->flip_count++;
+
+	info.free_mask = fl2000_flip_free_mask(dev_ctx, ring);
+	if (copy_to_user((void *) arg, &info, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_to_user fails?");
+		ret_val = -EFAULT;
+	}
+
+exit:
+	mutex_unlock(&dev_ctx->flip_mutex);
+	return ret_val;
+}
+
+/*
+ * called when the device file is closed, before the remaining surfaces and
+ * frame buffers are freed.
+ */
+void fl2000_flip_free(struct dev_ctx * dev_ctx)
+{
+	mutex_lock(&dev_ctx->flip_mutex);
+	if (dev_ctx->flip_ring != NULL)
+		fl2000_flip_ring_destroy(dev_ctx, dev_ctx->flip_ring, false);
+	dev_ctx->flip_ring = NULL;
+	mutex_unlock(&dev_ctx->flip_mutex);
+}
+
+void fl2000_flip_show(struct dev_ctx * dev_ctx, struct seq_file * m)
+{
+	struct fl2000_flip_ring * ring;
+
+	mutex_lock(&dev_ctx->flip_mutex);
+	ring = dev_ctx->flip_ring;
+	if (ring != NULL)
+		seq_printf(m, "flip_ring 0x%lx %u buffers stride 0x%lx "
+			"flips %u free_mask 0x%x\n",
+			ring->fb->usr_addr, ring->num_buffers,
+			ring->buffer_stride, ring->flip_count,
+			fl2000_flip_free_mask(dev_ctx, ring));
+	mutex_unlock(&dev_ctx->flip_mutex);
+}
+
+// eof: fl2000_flip.c
+//
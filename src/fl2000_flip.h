@@ -0,0 +1,24 @@
+// fl2000_flip.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_FLIP_H_
+#define _FL2000_FLIP_H_
+
+void fl2000_flip_init(struct dev_ctx * dev_ctx);
+long fl2000_flip_create_ring(struct file * file, unsigned long arg);
+long fl2000_flip_destroy_ring(struct dev_ctx * dev_ctx);
+long fl2000_flip(struct dev_ctx * dev_ctx, unsigned long arg);
+void fl2000_flip_free(struct dev_ctx * dev_ctx);
+void fl2000_flip_show(struct dev_ctx * dev_ctx, struct seq_file * m);
+
+#endif // _FL2000_FLIP_H_
+
+// eof: fl2000_flip.h
+//
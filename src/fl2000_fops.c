@@ -64,6 +64,7 @@ int fl2000_release(struct inode * inode, struct file * file)
 	struct dev_ctx * const dev_ctx = file->private_data;
 	uint32_t open_count;
 	unsigned long flags;
+	bool pool_unused;
 
 	if (dev_ctx == NULL)
 		return -ENODEV;
@@ -78,7 +79,19 @@ int fl2000_release(struct inode * inode, struct file * file)
 
 	fl2000_render_stop(dev_ctx);
 	fl2000_dongle_stop(dev_ctx);
+	fl2000_flip_free(dev_ctx);
 	fl2000_surface_destroy_all(dev_ctx);
+	fl2000_fb_free_all(dev_ctx);
+
+	/*
+	 * with no surface left, the pooled shadow buffers would sit unused
+	 * until the next open.
+	 */
+	spin_lock_bh(&dev_ctx->render.surface_list_lock);
+	pool_unused = list_empty(&dev_ctx->render.surface_list);
+	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
+	if (pool_unused)
+		fl2000_surface_free_shadow_pool(dev_ctx);
 
 	spin_lock_irqsave(&dev_ctx->count_lock, flags);
 	open_count = --dev_ctx->open_count;
@@ -90,7 +103,8 @@ int fl2000_release(struct inode * inode, struct file * file)
 }
 
 /*
- * this function is triggered from vm_mmap() in fl2000_ioctl_test_alloc_surface.
+ * this function is triggered from vm_mmap() in fl2000_ioctl_test_alloc_surface
+ * and fl2000_fb_alloc, or from mmap() of a frame buffer.
  * finish the last step of mapping system ram.
  * treat the memory as device ram.
  */
@@ -99,9 +113,14 @@ int fl2000_mmap(struct file * file, struct vm_area_struct *vma)
 	struct dev_ctx * const dev_ctx = file->private_data;
 	unsigned long len = vma->vm_end - vma->vm_start;
 	unsigned long num_pages = (len + PAGE_SIZE - 1) >> PAGE_SHIFT;
-	unsigned int ret_val = 0;
+	int ret_val = 0;
 	unsigned int i;
 
+	ret_val = fl2000_fb_mmap(dev_ctx, vma);
+	if (ret_val != -ENOENT)
+		return ret_val;
+	ret_val = 0;
+
 	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
 		"vm_start(0x%lx), vm_end(0x%lx), num_pages(0x%lx)",
 		vma->vm_start, vma->vm_end, num_pages);
@@ -41,6 +41,14 @@
 #include <linux/wait.h>
 #include <linux/pagemap.h>
 #include <linux/scatterlist.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mmu_notifier.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-fence.h>
+#include <linux/sync_file.h>
+#include <linux/file.h>
 
 #include "fl2000_ioctl.h"
 #include "fl2000_linux.h"
@@ -65,6 +73,11 @@
 #include "fl2000_surface.h"
 
 #include "fl2000_hdmi.h"
+#include "fl2000_pixel.h"
+#include "fl2000_debugfs.h"
+#include "fl2000_fb.h"
+#include "fl2000_flip.h"
+#include "fl2000_dma_buf.h"
 
 #endif // _FL2000_INCLUDE_H_
 
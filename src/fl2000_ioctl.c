@@ -100,26 +100,44 @@ fl2000_ioctl_set_display_mode(struct dev_ctx * dev_ctx, unsigned long arg)
 	return ret;
 }
 
+/*
+ * IOCTL_FL2000_CREATE_SURFACE predates surface_info.flags, so only
+ * IOCTL_FL2000_CREATE_SURFACE_EX reads them.
+ */
 long
-fl2000_ioctl_create_surface(struct dev_ctx * dev_ctx, unsigned long arg)
+fl2000_ioctl_create_surface(
+	struct dev_ctx * dev_ctx,
+	unsigned long arg,
+	bool with_flags)
 {
 	struct surface_info info;
+	struct primary_surface* surface;
+	size_t const size = with_flags ?
+		sizeof(info) : offsetof(struct surface_info, flags);
 
-	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+	memset(&info, 0, sizeof(info));
+	if (copy_from_user(&info, (void *) arg, size)) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
 		return -EFAULT;
 	}
 
-	return fl2000_surface_create(dev_ctx, &info);
+	if (info.flags & ~SURFACE_FLAGS_VALID) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"unknown flags(0x%x)?", info.flags);
+		return -EINVAL;
+	}
+
+	surface = fl2000_surface_create(dev_ctx, &info, false);
+	return IS_ERR(surface) ? PTR_ERR(surface) : 0;
 }
 
 long
 fl2000_ioctl_destroy_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 {
-	struct list_head * const list_head = &dev_ctx->render.surface_list;
 	struct surface_info info;
-	struct primary_surface* s;
 	struct primary_surface* surface;
+	unsigned long flags;
+	bool flip_ring;
 
 	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
@@ -131,25 +149,20 @@ fl2000_ioctl_destroy_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		(unsigned int) info.handle,
 		(unsigned int) info.user_buffer,
 		(unsigned int) info.buffer_length);
-	surface = NULL;
+
+	/*
+	 * look up and unlink the surface in one go, so that two destroys of
+	 * the same handle cannot both get it.
+	 */
 	spin_lock_bh(&dev_ctx->render.surface_list_lock);
-	list_for_each_entry(s, list_head, list_entry) {
-		unsigned long flags;
+	surface = fl2000_surface_find_locked(dev_ctx, info.handle);
+	flip_ring = surface != NULL && surface->flip_ring;
+	if (surface != NULL && !flip_ring) {
+		spin_lock_irqsave(&dev_ctx->count_lock, flags);
+		dev_ctx->render.surface_list_count--;
+		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
 
-		dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
-			"surface(%p), handle(0x%x)\n",
-			s,
-			(unsigned int) s->handle);
-		if (s->handle == info.handle) {
-
-			spin_lock_irqsave(&dev_ctx->count_lock, flags);
-			dev_ctx->render.surface_list_count--;
-			spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
-
-			list_del(&s->list_entry);
-			surface = s;
-			break;
-		}
+		list_del(&surface->list_entry);
 	}
 	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
 
@@ -160,56 +173,45 @@ fl2000_ioctl_destroy_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		return -EINVAL;
 	}
 
+	/*
+	 * flip ring surfaces go with the flip ring.
+	 */
+	if (flip_ring) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"surface(%p) belongs to the flip ring?",
+			(void*) (unsigned long) info.handle);
+		return -EBUSY;
+	}
+
 	fl2000_surface_destroy(dev_ctx, surface);
 	return 0;
 }
 
-void
-pixel_swap(uint8_t * dst, uint8_t * src, uint32_t len)
-{
-	uint32_t *src_block;
-	uint32_t *dst_block;
-	uint32_t length;
-	unsigned int i;
-
-	src_block = (uint32_t *) src;
-	dst_block = (uint32_t *) dst;
-	length = (len + 7) & 0xFFFFFFF8; // len round up to multiple of 8
-	for (i = 0; i < (length >> 2); i += 2) {
-		dst_block[i] = src_block[i + 1];
-		dst_block[i + 1] = src_block[i];
-	}
-}
-
+/*
+ * common part of IOCTL_FL2000_NOTIFY_SURFACE_UPDATE,
+ * IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_RECTS and
+ * IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE. num_rects of 0 means the whole
+ * surface changed. fence, if any, is signaled once the frame is read out.
+ */
 long
-fl2000_ioctl_notify_surface_update(struct dev_ctx * dev_ctx, unsigned long arg)
+fl2000_ioctl_update_surface(
+	struct dev_ctx * dev_ctx,
+	struct surface_update_info * update_info,
+	struct surface_rect * rects,
+	uint32_t num_rects,
+	struct dma_fence * fence)
 {
-	struct surface_update_info info;
-	struct primary_surface* s;
+	struct surface_update_info info = *update_info;
 	struct primary_surface* surface;
 	int			ret = 0;
 
-	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
-		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
-		ret = -EFAULT;
-		goto exit;
-	}
-
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_PNP,
-		"handle(%p)/buffer_length(0x%x)",
+		"handle(%p)/buffer_length(0x%x)/num_rects(%u)",
 		(void*) (unsigned long) info.handle,
-		(unsigned int) info.buffer_length);
-
-	surface = NULL;
-	spin_lock_bh(&dev_ctx->render.surface_list_lock);
-	list_for_each_entry(s, &dev_ctx->render.surface_list, list_entry) {
-		if (s->handle == info.handle) {
-			surface = s;
-			break;
-		}
-	}
-	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
+		(unsigned int) info.buffer_length,
+		num_rects);
 
+	surface = fl2000_surface_find(dev_ctx, info.handle);
 	if (surface == NULL) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 			"no surface found for handle(%p)?",
@@ -246,11 +248,24 @@ fl2000_ioctl_notify_surface_update(struct dev_ctx * dev_ctx, unsigned long arg)
 		goto exit;
 	}
 
+	/*
+	 * the fence goes into a shared reservation object here; from then on
+	 * nothing may keep it from being signaled.
+	 */
+	ret = fl2000_dma_buf_begin_frame(dev_ctx, surface, fence);
+	if (ret < 0)
+		goto exit;
+
+	if (fence != NULL)
+		dma_fence_get(fence);
+
 	/*
 	 * copy pixels from user mode to kernel mode, if shadow buffer
 	 * is chosen.
 	 */
-	if (surface->render_buffer == surface->shadow_buffer) {
+	if (!(surface->flags & SURFACE_FLAG_ZERO_COPY)) {
+		fl2000_surface_add_damage(surface, rects, num_rects);
+
 		/*
 		 * pin down user buffer if surface_type is
 		 * SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE, and is not
@@ -258,66 +273,143 @@ fl2000_ioctl_notify_surface_update(struct dev_ctx * dev_ctx, unsigned long arg)
 		 */
 		if (!surface->pre_locked &&
 		    surface->type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE) {
-			ret = fl2000_surface_pin_down(dev_ctx, surface);
-			if (ret < 0) {
-				dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-					"user_buffer(%p) pin failure?",
-					(void*) (unsigned long) info.user_buffer);
-				goto unlock_surface;
-			}
-			ret = fl2000_surface_map(dev_ctx, surface);
-			if (ret < 0) {
-				dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-					"user_buffer(%p) map failure?",
-					(void*) (unsigned long) info.user_buffer);
-				goto unlock_surface;
-			}
-
-			pixel_swap(surface->shadow_buffer,
-				surface->system_buffer,
-				surface->buffer_length);
+			ret = fl2000_surface_pin_volatile(dev_ctx, surface);
+			if (ret < 0)
+				goto drop_frame;
+
+			/*
+			 * the user buffer is gone once we return, convert it
+			 * right here.
+			 */
+			surface->swap_pending = false;
+			fl2000_surface_update_shadow(dev_ctx, surface);
 
 			fl2000_primary_surface_update(
-				dev_ctx, surface);
-unlock_surface:
-			fl2000_surface_unmap(dev_ctx, surface);
-			fl2000_surface_unpin(dev_ctx, surface);
+				dev_ctx, surface, fence);
+			fl2000_surface_unpin_volatile(dev_ctx, surface);
 		}
 		else {
 			/*
 			 * surface is not SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE
-			 * we can safely access system_buffer.
+			 * or is locked down, the render path can safely access
+			 * system_buffer.
 			 */
-			pixel_swap(surface->shadow_buffer,
-				surface->system_buffer,
-				surface->buffer_length);
-
+			surface->swap_pending = true;
 			fl2000_primary_surface_update(
-				dev_ctx, surface);
+				dev_ctx, surface, fence);
 		}
 	}
-	else if (surface->render_buffer == surface->system_buffer) {
-		fl2000_primary_surface_update(dev_ctx, surface);
-	}
 	else {
-		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-			"software error :render_buffer(%p)/"
-			"mapped_buffer(%p)/shadow_buffer(%p)/type(%x)",
-			surface->render_buffer,
-			surface->mapped_buffer,
-			surface->shadow_buffer,
-			surface->type);
+		fl2000_primary_surface_update(dev_ctx, surface, fence);
 	}
+	goto exit;
 
+drop_frame:
+	fl2000_render_signal_fence(fence, -ECANCELED);
 exit:
 	return ret;
 }
 
+long
+fl2000_ioctl_notify_surface_update(struct dev_ctx * dev_ctx, unsigned long arg)
+{
+	struct surface_update_info info;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	return fl2000_ioctl_update_surface(dev_ctx, &info, NULL, 0, NULL);
+}
+
+long
+fl2000_ioctl_notify_surface_update_rects(
+	struct dev_ctx * dev_ctx,
+	unsigned long arg)
+{
+	struct surface_update_rects_info info;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	if (info.num_rects > MAX_SURFACE_UPDATE_RECTS) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"num_rects(%u) over %u?",
+			info.num_rects, MAX_SURFACE_UPDATE_RECTS);
+		return -EINVAL;
+	}
+
+	return fl2000_ioctl_update_surface(dev_ctx, &info.update_info,
+		info.update_rects, info.num_rects, NULL);
+}
+
+long
+fl2000_ioctl_notify_surface_update_fence(
+	struct dev_ctx * dev_ctx,
+	unsigned long arg)
+{
+#ifdef FL2000_FENCE
+	struct surface_update_fence_info info;
+	struct dma_fence * fence;
+	struct sync_file * sync_file;
+	long ret;
+	int fd;
+
+	if (copy_from_user(&info, (void *) arg, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_from_user fails?");
+		return -EFAULT;
+	}
+
+	fence = fl2000_render_create_fence(dev_ctx);
+	if (fence == NULL)
+		return -ENOMEM;
+
+	sync_file = sync_file_create(fence);
+	if (sync_file == NULL) {
+		dma_fence_put(fence);
+		return -ENOMEM;
+	}
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		ret = fd;
+		goto put_fence;
+	}
+
+	ret = fl2000_ioctl_update_surface(dev_ctx, &info.update_info,
+		NULL, 0, fence);
+	if (ret < 0)
+		goto put_fd;
+
+	info.fence_fd = fd;
+	if (copy_to_user((void *) arg, &info, sizeof(info))) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "copy_to_user fails?");
+		ret = -EFAULT;
+		goto put_fd;
+	}
+
+	fd_install(fd, sync_file->file);
+	dma_fence_put(fence);
+	return 0;
+
+put_fd:
+	put_unused_fd(fd);
+put_fence:
+	fput(sync_file->file);
+	dma_fence_put(fence);
+	return ret;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 long
 fl2000_ioctl_lock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 {
 	struct surface_update_info info;
-	struct primary_surface* s;
 	struct primary_surface* surface;
 	int			ret = 0;
 
@@ -332,16 +424,7 @@ fl2000_ioctl_lock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		(void*) (unsigned long) info.handle,
 		(unsigned int) info.buffer_length);
 
-	surface = NULL;
-	spin_lock_bh(&dev_ctx->render.surface_list_lock);
-	list_for_each_entry(s, &dev_ctx->render.surface_list, list_entry) {
-		if (s->handle == info.handle) {
-			surface = s;
-			break;
-		}
-	}
-	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
-
+	surface = fl2000_surface_find(dev_ctx, info.handle);
 	if (surface == NULL) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 			"no surface found for handle(%p)?",
@@ -359,6 +442,18 @@ fl2000_ioctl_lock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		goto exit;
 	}
 
+	/*
+	 * the user_buffer of a dma-buf surface is an fd, there is nothing to
+	 * pin.
+	 */
+	if (surface->type == SURFACE_TYPE_DMA_BUF) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma-buf surface(%p) cannot be locked?",
+			(void*) (unsigned long) info.handle);
+		ret = -EINVAL;
+		goto exit;
+	}
+
 	/*
 	 * pin down user buffer if the user_buffer is vmalloc style.
 	 */
@@ -368,6 +463,7 @@ fl2000_ioctl_lock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 	}
 
 	if (!surface->pre_locked) {
+		fl2000_surface_release_pin_cache(dev_ctx, surface);
 		ret = fl2000_surface_pin_down(dev_ctx, surface);
 		if (ret < 0) {
 			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
@@ -399,7 +495,6 @@ long
 fl2000_ioctl_unlock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 {
 	struct surface_update_info info;
-	struct primary_surface* s;
 	struct primary_surface* surface;
 	int			ret = 0;
 
@@ -414,16 +509,7 @@ fl2000_ioctl_unlock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		(void*) (unsigned long) info.handle,
 		(unsigned int) info.buffer_length);
 
-	surface = NULL;
-	spin_lock_bh(&dev_ctx->render.surface_list_lock);
-	list_for_each_entry(s, &dev_ctx->render.surface_list, list_entry) {
-		if (s->handle == info.handle) {
-			surface = s;
-			break;
-		}
-	}
-	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
-
+	surface = fl2000_surface_find(dev_ctx, info.handle);
 	if (surface == NULL) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 			"no surface found for handle(%p)?",
@@ -441,15 +527,25 @@ fl2000_ioctl_unlock_surface(struct dev_ctx * dev_ctx, unsigned long arg)
 		goto exit;
 	}
 
+	if (surface->type == SURFACE_TYPE_DMA_BUF) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma-buf surface(%p) cannot be unlocked?",
+			(void*) (unsigned long) info.handle);
+		ret = -EINVAL;
+		goto exit;
+	}
+
 	if (surface->type == SURFACE_TYPE_VIRTUAL_CONTIGUOUS ||
 	    surface->type == SURFACE_TYPE_PHYSICAL_CONTIGUOUS) {
 		goto exit;
 	}
 
 	/*
-	 * unlock user buffer
+	 * unlock user buffer, once the render work item is done with it.
 	 */
 	if (surface->pre_locked) {
+		flush_work(&dev_ctx->render.render_work);
+		surface->swap_pending = false;
 		fl2000_surface_unmap(dev_ctx, surface);
 		fl2000_surface_unpin(dev_ctx, surface);
 		surface->pre_locked = false;
@@ -594,7 +690,11 @@ long fl2000_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 
 	case IOCTL_FL2000_CREATE_SURFACE:
-		ret_val = fl2000_ioctl_create_surface(dev_ctx, arg);
+		ret_val = fl2000_ioctl_create_surface(dev_ctx, arg, false);
+		break;
+
+	case IOCTL_FL2000_CREATE_SURFACE_EX:
+		ret_val = fl2000_ioctl_create_surface(dev_ctx, arg, true);
 		break;
 
 	case IOCTL_FL2000_DESTROY_SURFACE:
@@ -605,6 +705,11 @@ long fl2000_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret_val = fl2000_ioctl_notify_surface_update(dev_ctx, arg);
 		break;
 
+	case IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_RECTS:
+		ret_val = fl2000_ioctl_notify_surface_update_rects(
+			dev_ctx, arg);
+		break;
+
 	case IOCTL_FL2000_LOCK_SURFACE:
 		ret_val = fl2000_ioctl_lock_surface(dev_ctx, arg);
 		break;
@@ -621,6 +726,35 @@ long fl2000_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		ret_val = fl2000_ioctl_test_release_surface(file, arg);
 		break;
 
+	case IOCTL_FL2000_ALLOC_FRAME_BUFFER:
+		ret_val = fl2000_fb_alloc(file, arg);
+		break;
+
+	case IOCTL_FL2000_FREE_FRAME_BUFFER:
+		ret_val = fl2000_fb_free(dev_ctx, arg);
+		break;
+
+	case IOCTL_FL2000_CREATE_FLIP_RING:
+		ret_val = fl2000_flip_create_ring(file, arg);
+		break;
+
+	case IOCTL_FL2000_DESTROY_FLIP_RING:
+		ret_val = fl2000_flip_destroy_ring(dev_ctx);
+		break;
+
+	case IOCTL_FL2000_FLIP:
+		ret_val = fl2000_flip(dev_ctx, arg);
+		break;
+
+	case IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE:
+		ret_val = fl2000_ioctl_notify_surface_update_fence(
+			dev_ctx, arg);
+		break;
+
+	case IOCTL_FL2000_EXPORT_FRAME_BUFFER:
+		ret_val = fl2000_dma_buf_export(dev_ctx, arg);
+		break;
+
 	case IOCTL_FL2000_NOTIFY_POINTER_POSITION_UPDATE:
 	case IOCTL_FL2000_NOTIFY_POINTER_SHAPE_UPDATE:
 	default:
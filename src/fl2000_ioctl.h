@@ -240,6 +240,10 @@ struct monitor_info {
  *  is RGB 24bpp, where the B occurs on the byte[0], and G occurs on byte[1],
  *  and R occurs on byte[2].
  *
+ *  When use_compression is set, or the FL2000 runs on a USB 2.0 link, every
+ *  frame is gravity compressed before it goes onto the bus, and 16bpp output
+ *  is forced to RGB 555.
+ *
  * parameters
  *    InputBuffer:	    pointer to display_mode
  *    InputBufferSize:	    sizeof(display_mode)
@@ -303,6 +307,32 @@ struct display_mode {
  *  on contiguous physical memory, and the buffer is not mapped to user space.
  *  In this case, the user app could set type to SURFACE_TYPE_PHYSICAL_CONTIGUOUS.
  *
+ *  4. dma-buf
+ *  The surface buffer is produced by another driver (e.g. a V4L2 capture
+ *  device, or udmabuf) and shared as a dma-buf. The user app sets type to
+ *  SURFACE_TYPE_DMA_BUF, passes the dma-buf fd in user_buffer, and must set
+ *  SURFACE_FLAG_ZERO_COPY. The kernel driver attaches the dma-buf and maps it
+ *  for the host controller once, so nothing is copied on the way to USB.
+ *  The driver cannot pack or compress such a surface; while the display mode
+ *  needs it, IOCTL_FL2000_NOTIFY_SURFACE_UPDATE fails with EINVAL.
+ *
+ *  Zero-copy streaming
+ *  By default the kernel driver re-orders the pixels into its shadow buffer and
+ *  copies them into its own transfer buffers on every update. If the user app
+ *  produces the pixels in FL2000 wire order (the two 32-bit words of every
+ *  8-byte group swapped), it could set SURFACE_FLAG_ZERO_COPY in flags, and
+ *  create the surface with IOCTL_FL2000_CREATE_SURFACE_EX. The
+ *  kernel driver then DMAs straight from the pinned user pages using the
+ *  scatter-gather capability of the host controller, without touching a byte.
+ *  The flag is only honored for SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT,
+ *  SURFACE_TYPE_VIRTUAL_CONTIGUOUS, SURFACE_TYPE_PHYSICAL_CONTIGUOUS and
+ *  SURFACE_TYPE_DMA_BUF with COLOR_FORMAT_RGB_24, and the user app must not
+ *  modify the buffer while it is being scanned out.
+ *  Wire order works on the frame in groups of 8 bytes, from the first byte of
+ *  the buffer: the group b0 b1 b2 b3 b4 b5 b6 b7 is stored as
+ *  b4 b5 b6 b7 b0 b1 b2 b3. Read as little endian 64-bit words, each word is
+ *  rotated by 32 bits.
+ *
  * parameters
  *    InputBuffer:	    pointer to surface_info
  *    InputBufferSize:	    sizeof(surface_info)
@@ -316,6 +346,7 @@ struct display_mode {
 #define SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT      1
 #define SURFACE_TYPE_VIRTUAL_CONTIGUOUS                 2
 #define SURFACE_TYPE_PHYSICAL_CONTIGUOUS                3
+#define SURFACE_TYPE_DMA_BUF                            4
 
 struct surface_info {
 	uint64_t	handle;
@@ -326,10 +357,34 @@ struct surface_info {
 	uint32_t	pitch;
 	uint32_t	color_format;
 	uint32_t	type;
+	uint32_t	flags;
 };
 
+#define SURFACE_FLAG_ZERO_COPY				(1 << 0)
+#define SURFACE_FLAGS_VALID				(SURFACE_FLAG_ZERO_COPY)
+
 #define IOCTL_FL2000_CREATE_SURFACE		    (FL2000_IOCTL_BASE + 3)
 
+/*
+ * Name:  IOCTL_FL2000_CREATE_SURFACE_EX
+ *
+ * details
+ *  Same as IOCTL_FL2000_CREATE_SURFACE, with surface_info.flags. Apps built
+ *  before flags existed leave that field uninitialized, so
+ *  IOCTL_FL2000_CREATE_SURFACE ignores it. Flags other than
+ *  SURFACE_FLAGS_VALID are rejected.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to surface_info
+ *    InputBufferSize:	    sizeof(surface_info)
+ *    OutputBuffer:	    NULL
+ *    OutputBufferSize:	    0
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+#define IOCTL_FL2000_CREATE_SURFACE_EX		    (FL2000_IOCTL_BASE + 20)
+
 /*
  * Name:  IOCTL_FL2000_DESTROY_SURFACE
  *
@@ -366,6 +421,9 @@ struct surface_info {
  *  The kernel driver locks down the user buffer, and copy the pixels to its
  *  shadow buffer before unlocking the user buffer. Since the page lock-down
  *  and unlock operation is costly, it is not suggested to use this mode.
+ *  On kernels with MMU notifiers, the kernel driver keeps the pages locked
+ *  down and mapped between updates instead, and only locks them down again
+ *  once the buffer is unmapped or remapped.
  *
  *  2. The surface is created with SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT:
  *  The kernel driver pre-lock down the user buffer, and do not copy the pixels
@@ -383,6 +441,11 @@ struct surface_info {
  *  The kernel driver does not lock down the user buffer, since it is persistent
  *  by its nature.
  *
+ *  The IOCTL returns as soon as the frame is queued. Pixel conversion and USB
+ *  submission are done by a per-device render worker, so for all surface types
+ *  other than SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE the user buffer might
+ *  still be read after the IOCTL returns.
+ *
  *  Once the buffer is displayed, the kernel driver would rescan the same buffer
  *  until a new buffer update event arrives. The kernel driver continues to scan
  *  out the same buffer until next IOCTL_FL2000_NOTIFY_SURFACE_UPDATE arrives.
@@ -403,6 +466,50 @@ struct surface_update_info {
 };
 #define IOCTL_FL2000_NOTIFY_SURFACE_UPDATE	    (FL2000_IOCTL_BASE + 5)
 
+/*
+ * Name:  IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_RECTS
+ *
+ * details
+ *  Same as IOCTL_FL2000_NOTIFY_SURFACE_UPDATE, with the rectangles of the
+ *  surface that changed since the previous update. The kernel driver only
+ *  converts the rows touched by those rectangles into its shadow buffer, and
+ *  keeps the rest of the previous frame. Pixels changed outside the
+ *  rectangles might not be displayed.
+ *
+ *  Up to MAX_SURFACE_UPDATE_RECTS rectangles are passed in update_rects.
+ *  Rectangles are clipped to the surface. With num_rects set to 0, the whole
+ *  surface is taken as changed.
+ *
+ *  Surfaces created with SURFACE_FLAG_ZERO_COPY, or streamed straight from
+ *  the user buffer, are always sent whole; for those the rectangles are
+ *  ignored.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to surface_update_rects_info
+ *    InputBufferSize:	    sizeof(surface_update_rects_info)
+ *    OutputBuffer:	    NULL
+ *    OutputBufferSize:	    0
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+#define MAX_SURFACE_UPDATE_RECTS	16
+
+struct surface_rect {
+	uint32_t	x;
+	uint32_t	y;
+	uint32_t	width;
+	uint32_t	height;
+};
+
+struct surface_update_rects_info {
+	struct surface_update_info	update_info;
+	uint32_t			num_rects;
+	uint32_t			reserved;
+	struct surface_rect		update_rects[MAX_SURFACE_UPDATE_RECTS];
+};
+#define IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_RECTS    (FL2000_IOCTL_BASE + 12)
+
 /*
  * Name:  IOCTL_FL2000_LOCK_SURFACE/IOCTL_FL2000_UNLOCK_SURFACE
  *
@@ -422,6 +529,9 @@ struct surface_update_info {
  *
  *  The kernel driver does not prohibit user app to touch the content of a buffer.
  *
+ *  A SURFACE_TYPE_DMA_BUF surface has no user pages to lock, and both calls
+ *  fail with EINVAL on it.
+ *
  * parameters
  *    InputBuffer:	    pointer to surface_update_info
  *    InputBufferSize:	    sizeof(surface_update_info)
@@ -500,6 +610,190 @@ struct test_alloc {
 	uint64_t	usr_addr;		// output
 	uint64_t	phy_addr;		// output
 };
+
+/*
+ * Name:  IOCTL_FL2000_ALLOC_FRAME_BUFFER/IOCTL_FL2000_FREE_FRAME_BUFFER
+ *
+ * details
+ *  The user app asks the kernel driver for a frame buffer, which is mapped
+ *  into the calling process at usr_addr. The buffer is made of physically
+ *  contiguous 2MB chunks where the memory allows, so a surface created on it
+ *  needs only a few scatter-gather segments, reported in num_segments. The
+ *  buffer can also be mapped again with mmap() on the device file, at
+ *  mmap_offset.
+ *
+ *  Up to MAX_FRAME_BUFFERS buffers can be allocated per device. They are
+ *  freed by IOCTL_FL2000_FREE_FRAME_BUFFER with the usr_addr returned on
+ *  allocation, or when the device file is closed.
+ *
+ *  A surface on such a buffer is typically created with
+ *  SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT and SURFACE_FLAG_ZERO_COPY.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to frame_buffer_info
+ *    InputBufferSize:	    sizeof(frame_buffer_info)
+ *    OutputBuffer:	    pointer to frame_buffer_info
+ *    OutputBufferSize:	    sizeof(frame_buffer_info)
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+#define MAX_FRAME_BUFFERS	16
+
+struct frame_buffer_info {
+	uint64_t	buffer_size;		// input, page aligned on output
+	uint64_t	usr_addr;		// output, input to free
+	uint64_t	mmap_offset;		// output
+	uint32_t	num_segments;		// output
+	uint32_t	reserved;
+};
+
+#define IOCTL_FL2000_ALLOC_FRAME_BUFFER		    (FL2000_IOCTL_BASE + 13)
+#define IOCTL_FL2000_FREE_FRAME_BUFFER		    (FL2000_IOCTL_BASE + 14)
+
+/*
+ * Name:  IOCTL_FL2000_CREATE_FLIP_RING/IOCTL_FL2000_DESTROY_FLIP_RING
+ *
+ * details
+ *  The user app asks the kernel driver for a ring of num_buffers frame
+ *  buffers of width/height/pitch/color_format, for page flipping. The buffers
+ *  are allocated, mapped and pinned down once, in one frame buffer mapped
+ *  into the calling process at usr_addr; buffer i starts at
+ *  usr_addr + i * buffer_stride. The same memory can be mapped again with
+ *  mmap() on the device file, at mmap_offset.
+ *
+ *  Each buffer is a SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT surface whose
+ *  handle is its user address. flags takes SURFACE_FLAG_ZERO_COPY. Only
+ *  COLOR_FORMAT_RGB_24 is supported.
+ *
+ *  One ring exists per device. It is destroyed by
+ *  IOCTL_FL2000_DESTROY_FLIP_RING, or when the device file is closed.
+ *  IOCTL_FL2000_DESTROY_SURFACE on one of its buffers fails with EBUSY.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to flip_ring_info
+ *    InputBufferSize:	    sizeof(flip_ring_info)
+ *    OutputBuffer:	    pointer to flip_ring_info
+ *    OutputBufferSize:	    sizeof(flip_ring_info)
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+#define MAX_FLIP_BUFFERS	4
+
+struct flip_ring_info {
+	uint32_t	width;			// input
+	uint32_t	height;			// input
+	uint32_t	pitch;			// input
+	uint32_t	color_format;		// input
+	uint32_t	num_buffers;		// input
+	uint32_t	flags;			// input
+	uint64_t	buffer_stride;		// output
+	uint64_t	usr_addr;		// output
+	uint64_t	mmap_offset;		// output
+};
+
+#define IOCTL_FL2000_CREATE_FLIP_RING		    (FL2000_IOCTL_BASE + 15)
+#define IOCTL_FL2000_DESTROY_FLIP_RING		    (FL2000_IOCTL_BASE + 16)
+
+/*
+ * Name:  IOCTL_FL2000_FLIP
+ *
+ * details
+ *  The user app shows buffer index of the flip ring. Nothing is copied or
+ *  pinned; the buffer is queued to the render path as it is.
+ *
+ *  On return, bit i of free_mask is set if buffer i is neither shown, nor
+ *  queued, nor being streamed, so the user app can render into it. The
+ *  buffer just flipped to is never free.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to flip_info
+ *    InputBufferSize:	    sizeof(flip_info)
+ *    OutputBuffer:	    pointer to flip_info
+ *    OutputBufferSize:	    sizeof(flip_info)
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+struct flip_info {
+	uint32_t	index;			// input
+	uint32_t	free_mask;		// output
+};
+
+#define IOCTL_FL2000_FLIP			    (FL2000_IOCTL_BASE + 17)
+
+/*
+ * Name:  IOCTL_FL2000_EXPORT_FRAME_BUFFER
+ *
+ * details
+ *  The user app exports the frame buffer at usr_addr, allocated by
+ *  IOCTL_FL2000_ALLOC_FRAME_BUFFER or IOCTL_FL2000_CREATE_FLIP_RING, as a
+ *  dma-buf. The fd can be passed to other devices or processes, which then
+ *  read and write the buffer without a copy. The dma-buf keeps the memory
+ *  alive after the frame buffer is freed, until its last user is gone.
+ *  Exporting the same frame buffer again returns a new fd of the same dma-buf.
+ *
+ *  Writers synchronize through the fences in the reservation object of the
+ *  dma-buf. A surface on an exported frame buffer waits for its write fences
+ *  before each frame is queued by IOCTL_FL2000_NOTIFY_SURFACE_UPDATE or
+ *  IOCTL_FL2000_FLIP. With IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE, the frame
+ *  fence is also added as a read fence, so the next writer waits until the
+ *  frame is read out. A SURFACE_TYPE_DMA_BUF surface likewise waits for the
+ *  write fences of the dma-buf it was created on.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to frame_buffer_export
+ *    InputBufferSize:	    sizeof(frame_buffer_export)
+ *    OutputBuffer:	    pointer to frame_buffer_export
+ *    OutputBufferSize:	    sizeof(frame_buffer_export)
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+struct frame_buffer_export {
+	uint64_t	usr_addr;		// input
+	int32_t		fd;			// output
+	uint32_t	reserved;
+};
+
+#define IOCTL_FL2000_EXPORT_FRAME_BUFFER	    (FL2000_IOCTL_BASE + 18)
+
+/*
+ * Name:  IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE
+ *
+ * details
+ *  Same as IOCTL_FL2000_NOTIFY_SURFACE_UPDATE, and returns a sync_file fd in
+ *  fence_fd. The fence signals once the last urb of this frame has
+ *  completed. It only tells that the frame went out; it does not free the
+ *  surface for writing. Until another surface is notified, the driver keeps
+ *  sending redundant frames of the surface, and they read it again.
+ *
+ *  To render ahead, a producer draws into a second surface and notifies it.
+ *  Once the fence of that frame has signaled without error, the frames
+ *  before it have gone out, and the first surface is no longer read.
+ *
+ *  A frame that is replaced by a later one before it is streamed, or that
+ *  is dropped, signals its fence with an error status.
+ *
+ *  The fd can be waited on with poll(), and must be closed by the user app.
+ *
+ * parameters
+ *    InputBuffer:	    pointer to surface_update_fence_info
+ *    InputBufferSize:	    sizeof(surface_update_fence_info)
+ *    OutputBuffer:	    pointer to surface_update_fence_info
+ *    OutputBufferSize:	    sizeof(surface_update_fence_info)
+ *
+ * return value
+ *  0 if succeeded. -1 on error.
+ */
+struct surface_update_fence_info {
+	struct surface_update_info	update_info;	// input
+	int32_t				fence_fd;	// output
+	uint32_t			reserved;
+};
+
+#define IOCTL_FL2000_NOTIFY_SURFACE_UPDATE_FENCE    (FL2000_IOCTL_BASE + 19)
 _EXTERN_C_END
 
 #endif /*  _FL2000_IOCTL_H_ */
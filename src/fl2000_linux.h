@@ -31,6 +31,20 @@
 
 #define DELAY_MS(msecs)				msleep(msecs)
 
+/*
+ * vm_flags is read-only since 6.3, and is changed through vm_flags_set().
+ */
+static inline void fl2000_vm_flags_set(
+	struct vm_area_struct * vma,
+	unsigned long flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+	vm_flags_set(vma, flags);
+#else
+	vma->vm_flags |= flags;
+#endif
+}
+
 #define ASSERT(cond)							\
 do {									\
     if ( !( cond ) ) 							\
@@ -13,6 +13,36 @@
 uint32_t currentTraceLevel = TRACE_LEVEL_INFO;
 uint32_t currentTraceFlags = DEFAULT_DBG_FLAGS;
 
+bool render_mailbox = false;
+module_param(render_mailbox, bool, 0644);
+MODULE_PARM_DESC(render_mailbox,
+	"latest frame wins, a new update replaces the frame not yet started");
+
+bool render_dither = false;
+module_param(render_dither, bool, 0644);
+MODULE_PARM_DESC(render_dither,
+	"ordered dithering when 24bpp surfaces are streamed as 16bpp");
+
+unsigned int render_urb_count = 16;
+module_param(render_urb_count, uint, 0644);
+MODULE_PARM_DESC(render_urb_count,
+	"number of streaming urbs per device, taken when the device is plugged in");
+
+unsigned int render_urb_size = 64 * 1024;
+module_param(render_urb_size, uint, 0644);
+MODULE_PARM_DESC(render_urb_size,
+	"bytes per streaming urb, taken when the device is plugged in");
+
+unsigned int render_compression_share = 90;
+module_param(render_compression_share, uint, 0644);
+MODULE_PARM_DESC(render_compression_share,
+	"percent of the measured link throughput a compressed frame may use");
+
+unsigned int render_compression_stripes = 0;
+module_param(render_compression_stripes, uint, 0644);
+MODULE_PARM_DESC(render_compression_stripes,
+	"stripes compressed in parallel per frame, 0 for one per online cpu");
+
 static int
 fl2000_device_probe(
 	struct usb_interface* usb_interface,
@@ -257,7 +287,11 @@ fl2000_module_init(void)
 {
 	int result;
 
+	fl2000_pixel_init();
+	fl2000_debugfs_init();
 	result = usb_register(&fl2000_driver);
+	if (result)
+		fl2000_debugfs_exit();
 	return result;
 }
 
@@ -265,6 +299,7 @@ void __exit
 fl2000_module_exit(void)
 {
 	usb_deregister(&fl2000_driver);
+	fl2000_debugfs_exit();
 }
 
 module_init(fl2000_module_init);
@@ -273,6 +308,11 @@ module_exit(fl2000_module_exit);
 MODULE_AUTHOR("Fresco Logic");
 MODULE_DESCRIPTION("USB VGA device driver - Version 0.0.0.1");
 MODULE_LICENSE("GPL");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+MODULE_IMPORT_NS("DMA_BUF");
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
 
 // eof: fl2000_module.c
 //
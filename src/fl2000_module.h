@@ -12,6 +12,12 @@
 #define _FL2000_MOUDLE_H_
 
 extern struct usb_driver fl2000_driver;
+extern bool render_mailbox;
+extern bool render_dither;
+extern unsigned int render_urb_count;
+extern unsigned int render_urb_size;
+extern unsigned int render_compression_share;
+extern unsigned int render_compression_stripes;
 
 void fl2000_module_free(struct kref *kref);
 int fl2000_open(struct inode * inode, struct file * file);
@@ -0,0 +1,785 @@
+// fl2000_pixel.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Pixel Conversion Support
+//
+
+#include "fl2000_include.h"
+
+#if defined(CONFIG_X86)
+#include <asm/fpu/api.h>
+#elif defined(CONFIG_ARM64) && defined(CONFIG_KERNEL_MODE_NEON)
+#include <asm/neon.h>
+#include <asm/simd.h>
+#endif
+
+/*
+ * the FPU is held for at most this many bytes at a time, so that we don't
+ * keep preemption off over a whole frame.
+ */
+#define PIXEL_SIMD_CHUNK	(64*1024)
+
+typedef void (*pixel_swap_fn)(uint8_t * dst, uint8_t * src, uint32_t len);
+typedef void (*pixel_pack_fn)(
+	uint8_t * dst,
+	const uint8_t * src,
+	uint32_t num_pixels,
+	uint32_t flags);
+
+static pixel_swap_fn	pixel_swap_simd;
+static pixel_pack_fn	pixel_pack_simd;
+static const char *	pixel_swap_name = "scalar";
+
+/*
+ * 4x4 Bayer threshold matrix, 0..15
+ */
+static const uint8_t pixel_bayer_4x4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * the FL2000 takes the two 32-bit words of each 8-byte group in swapped
+ * order. len is a multiple of 8.
+ */
+static void
+pixel_swap_scalar(uint8_t * dst, uint8_t * src, uint32_t len)
+{
+	uint32_t *src_block;
+	uint32_t *dst_block;
+	unsigned int i;
+
+	src_block = (uint32_t *) src;
+	dst_block = (uint32_t *) dst;
+	for (i = 0; i < (len >> 2); i += 2) {
+		dst_block[i] = src_block[i + 1];
+		dst_block[i + 1] = src_block[i];
+	}
+}
+
+#define PIXEL_HASH_PRIME_1	0x9E3779B185EBCA87ULL
+#define PIXEL_HASH_PRIME_2	0xC2B2AE3D27D4EB4FULL
+#define PIXEL_HASH_PRIME_3	0x165667B19E3779F9ULL
+#define PIXEL_HASH_PRIME_4	0x85EBCA77C2B2AE63ULL
+#define PIXEL_HASH_PRIME_5	0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+pixel_load64(const uint8_t * src)
+{
+	uint64_t word;
+
+	memcpy(&word, src, sizeof(word));
+	return word;
+}
+
+static inline uint64_t
+pixel_hash_round(uint64_t acc, uint64_t word)
+{
+	acc += word * PIXEL_HASH_PRIME_2;
+	acc = rol64(acc, 31);
+	return acc * PIXEL_HASH_PRIME_1;
+}
+
+/*
+ * one B, G, R pixel to 565 or 555. With dithering, the threshold is scaled
+ * to the bits each channel loses before truncation.
+ */
+static inline uint16_t
+pixel_pack_one(const uint8_t * p, uint32_t flags, uint32_t threshold)
+{
+	uint32_t b = p[0];
+	uint32_t g = p[1];
+	uint32_t r = p[2];
+
+	if (flags & PIXEL_PACK_DITHER) {
+		b = min_t(uint32_t, b + (threshold >> 1), 255);
+		r = min_t(uint32_t, r + (threshold >> 1), 255);
+		if (flags & PIXEL_PACK_555)
+			g = min_t(uint32_t, g + (threshold >> 1), 255);
+		else
+			g = min_t(uint32_t, g + (threshold >> 2), 255);
+	}
+
+	if (flags & PIXEL_PACK_555)
+		return (uint16_t) (((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3));
+	return (uint16_t) (((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+/*
+ * pixel_pack_16 8 pixels at a time, and the dithering the SIMD kernels leave
+ * out. A tail of less than 8 pixels reads only its own num_pixels * 3 source
+ * bytes, and writes only its num_pixels * 2 destination bytes.
+ */
+static void
+pixel_pack_scalar(
+	uint8_t * dst,
+	uint8_t * src,
+	uint32_t first_pixel,
+	uint32_t num_pixels,
+	uint32_t width,
+	uint32_t flags)
+{
+	uint16_t packed[8];
+	uint8_t	raw[24];
+	uint8_t	unswapped[24];
+	uint8_t * in;
+	uint32_t threshold = 0;
+	uint32_t x = first_pixel % width;
+	uint32_t y = first_pixel / width;
+	uint32_t n;
+	uint32_t i;
+	uint32_t j;
+
+	for (i = 0; i < num_pixels; i += 8) {
+		n = min_t(uint32_t, num_pixels - i, 8);
+		in = src;
+		if (n < 8) {
+			memset(raw, 0, sizeof(raw));
+			memcpy(raw, src, n * 3);
+			in = raw;
+		}
+		if (flags & PIXEL_PACK_SWAPPED_SRC) {
+			pixel_swap_scalar(unswapped, in, sizeof(unswapped));
+			in = unswapped;
+		}
+
+		memset(packed, 0, sizeof(packed));
+		for (j = 0; j < n; j++) {
+			if (flags & PIXEL_PACK_DITHER)
+				threshold = pixel_bayer_4x4[y & 3][x & 3];
+			packed[j ^ 2] = pixel_pack_one(in + j * 3, flags,
+				threshold);
+			if (++x == width) {
+				x = 0;
+				y++;
+			}
+		}
+		memcpy(dst, packed, n * 2);
+		src += 24;
+		dst += 16;
+	}
+}
+
+#if defined(CONFIG_X86)
+/*
+ * pshufd 0xB1 swaps the 32-bit words within each 64-bit lane.
+ * len is a multiple of 64.
+ */
+static void
+pixel_swap_sse2(uint8_t * dst, uint8_t * src, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 64) {
+		asm volatile(
+			"movdqu   0(%0), %%xmm0\n\t"
+			"movdqu  16(%0), %%xmm1\n\t"
+			"movdqu  32(%0), %%xmm2\n\t"
+			"movdqu  48(%0), %%xmm3\n\t"
+			"pshufd  $0xb1, %%xmm0, %%xmm0\n\t"
+			"pshufd  $0xb1, %%xmm1, %%xmm1\n\t"
+			"pshufd  $0xb1, %%xmm2, %%xmm2\n\t"
+			"pshufd  $0xb1, %%xmm3, %%xmm3\n\t"
+			"movdqu  %%xmm0,  0(%1)\n\t"
+			"movdqu  %%xmm1, 16(%1)\n\t"
+			"movdqu  %%xmm2, 32(%1)\n\t"
+			"movdqu  %%xmm3, 48(%1)\n\t"
+			:
+			: "r" (src + i), "r" (dst + i)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	}
+}
+
+/*
+ * same as above, 128 bytes per iteration. len is a multiple of 128. The
+ * xmm clobbers cover the whole ymm registers.
+ */
+static void
+pixel_swap_avx2(uint8_t * dst, uint8_t * src, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 128) {
+		asm volatile(
+			"vmovdqu   0(%0), %%ymm0\n\t"
+			"vmovdqu  32(%0), %%ymm1\n\t"
+			"vmovdqu  64(%0), %%ymm2\n\t"
+			"vmovdqu  96(%0), %%ymm3\n\t"
+			"vpshufd  $0xb1, %%ymm0, %%ymm0\n\t"
+			"vpshufd  $0xb1, %%ymm1, %%ymm1\n\t"
+			"vpshufd  $0xb1, %%ymm2, %%ymm2\n\t"
+			"vpshufd  $0xb1, %%ymm3, %%ymm3\n\t"
+			"vmovdqu  %%ymm0,  0(%1)\n\t"
+			"vmovdqu  %%ymm1, 32(%1)\n\t"
+			"vmovdqu  %%ymm2, 64(%1)\n\t"
+			"vmovdqu  %%ymm3, 96(%1)\n\t"
+			:
+			: "r" (src + i), "r" (dst + i)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	}
+}
+
+/*
+ * pixel_pack_16 without dithering. Each pixel is gathered into a 32-bit lane,
+ * its channels shifted and masked into place, and the lanes are narrowed to
+ * 16 bits. The shift counts and masks differ between 565 and 555.
+ */
+struct pixel_pack_x86 {
+	uint32_t	mask_r[8];
+	uint32_t	mask_g[8];
+	uint32_t	mask_b[8];
+	uint64_t	shift_r[2];
+	uint64_t	shift_g[2];
+} __attribute__((aligned(32)));
+
+static const struct pixel_pack_x86 pixel_pack_x86_565 = {
+	.mask_r = { [0 ... 7] = 0xF800 },
+	.mask_g = { [0 ... 7] = 0x07E0 },
+	.mask_b = { [0 ... 7] = 0x001F },
+	.shift_r = { 8 },
+	.shift_g = { 5 },
+};
+
+static const struct pixel_pack_x86 pixel_pack_x86_555 = {
+	.mask_r = { [0 ... 7] = 0x7C00 },
+	.mask_g = { [0 ... 7] = 0x03E0 },
+	.mask_b = { [0 ... 7] = 0x001F },
+	.shift_r = { 9 },
+	.shift_g = { 6 },
+};
+
+/*
+ * xmm0 holds source bytes 0..15 and xmm1 bytes 8..23, so no byte past the 8
+ * pixels is read.
+ */
+#define PIXEL_PACK_SSE2_LOAD					\
+	"movdqu   0(%0), %%xmm0\n\t"				\
+	"movdqu   8(%0), %%xmm1\n\t"
+
+#define PIXEL_PACK_SSE2_UNSWAP					\
+	"pshufd  $0xb1, %%xmm0, %%xmm0\n\t"			\
+	"pshufd  $0xb1, %%xmm1, %%xmm1\n\t"
+
+/*
+ * the four pixels at bytes 0, 3, 6 and 9 of reg into its 32-bit lanes.
+ */
+#define PIXEL_PACK_SSE2_GATHER(reg)				\
+	"movdqa  %%" reg ", %%xmm2\n\t"				\
+	"psrldq  $3, %%xmm2\n\t"					\
+	"movdqa  %%" reg ", %%xmm3\n\t"				\
+	"psrldq  $6, %%xmm3\n\t"					\
+	"movdqa  %%" reg ", %%xmm4\n\t"				\
+	"psrldq  $9, %%xmm4\n\t"					\
+	"punpckldq  %%xmm2, %%" reg "\n\t"			\
+	"punpckldq  %%xmm4, %%xmm3\n\t"				\
+	"punpcklqdq %%xmm3, %%" reg "\n\t"
+
+/*
+ * the B, G, R lanes of reg to sign extended 16bpp values, for packssdw.
+ */
+#define PIXEL_PACK_SSE2_CONVERT(reg)				\
+	"movdqa  %%" reg ", %%xmm2\n\t"				\
+	"psrld   96(%2), %%xmm2\n\t"				\
+	"pand     0(%2), %%xmm2\n\t"				\
+	"movdqa  %%" reg ", %%xmm3\n\t"				\
+	"psrld  112(%2), %%xmm3\n\t"				\
+	"pand    32(%2), %%xmm3\n\t"				\
+	"psrld   $3, %%" reg "\n\t"				\
+	"pand    64(%2), %%" reg "\n\t"				\
+	"por     %%xmm2, %%" reg "\n\t"				\
+	"por     %%xmm3, %%" reg "\n\t"				\
+	"pslld   $16, %%" reg "\n\t"				\
+	"psrad   $16, %%" reg "\n\t"
+
+/*
+ * then narrow to 8 16-bit pixels, and swap the 32-bit words of each 64-bit
+ * lane into wire order.
+ */
+#define PIXEL_PACK_SSE2_STORE					\
+	"psrldq  $4, %%xmm1\n\t"					\
+	PIXEL_PACK_SSE2_GATHER("xmm0")				\
+	PIXEL_PACK_SSE2_GATHER("xmm1")				\
+	PIXEL_PACK_SSE2_CONVERT("xmm0")				\
+	PIXEL_PACK_SSE2_CONVERT("xmm1")				\
+	"packssdw %%xmm1, %%xmm0\n\t"				\
+	"pshufd  $0xb1, %%xmm0, %%xmm0\n\t"			\
+	"movdqu  %%xmm0, 0(%1)\n\t"
+
+/*
+ * 8 pixels, 24 source bytes, per iteration. num_pixels is a multiple of 8.
+ */
+static void
+pixel_pack_sse2(
+	uint8_t * dst,
+	const uint8_t * src,
+	uint32_t num_pixels,
+	uint32_t flags)
+{
+	const struct pixel_pack_x86 * const c = (flags & PIXEL_PACK_555) ?
+		&pixel_pack_x86_555 : &pixel_pack_x86_565;
+	uint32_t i;
+
+	for (i = 0; i < num_pixels; i += 8) {
+		if (flags & PIXEL_PACK_SWAPPED_SRC)
+			asm volatile(
+				PIXEL_PACK_SSE2_LOAD
+				PIXEL_PACK_SSE2_UNSWAP
+				PIXEL_PACK_SSE2_STORE
+				:
+				: "r" (src), "r" (dst), "r" (c)
+				: "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+				  "xmm4");
+		else
+			asm volatile(
+				PIXEL_PACK_SSE2_LOAD
+				PIXEL_PACK_SSE2_STORE
+				:
+				: "r" (src), "r" (dst), "r" (c)
+				: "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+				  "xmm4");
+		src += 24;
+		dst += 16;
+	}
+}
+
+/*
+ * same as above for two groups of 8 pixels, one in each 128-bit lane: ymm0
+ * holds bytes 0..15 and 24..39, ymm1 bytes 8..23 and 32..47.
+ */
+#define PIXEL_PACK_AVX2_LOAD					\
+	"vmovdqu      0(%0), %%xmm0\n\t"				\
+	"vinserti128  $1, 24(%0), %%ymm0, %%ymm0\n\t"		\
+	"vmovdqu      8(%0), %%xmm1\n\t"				\
+	"vinserti128  $1, 32(%0), %%ymm1, %%ymm1\n\t"
+
+#define PIXEL_PACK_AVX2_UNSWAP					\
+	"vpshufd  $0xb1, %%ymm0, %%ymm0\n\t"			\
+	"vpshufd  $0xb1, %%ymm1, %%ymm1\n\t"
+
+#define PIXEL_PACK_AVX2_GATHER(reg)				\
+	"vpsrldq  $3, %%" reg ", %%ymm2\n\t"			\
+	"vpsrldq  $6, %%" reg ", %%ymm3\n\t"			\
+	"vpsrldq  $9, %%" reg ", %%ymm4\n\t"			\
+	"vpunpckldq  %%ymm2, %%" reg ", %%" reg "\n\t"		\
+	"vpunpckldq  %%ymm4, %%ymm3, %%ymm3\n\t"			\
+	"vpunpcklqdq %%ymm3, %%" reg ", %%" reg "\n\t"
+
+#define PIXEL_PACK_AVX2_CONVERT(reg)				\
+	"vpsrld   96(%2), %%" reg ", %%ymm2\n\t"			\
+	"vpand     0(%2), %%ymm2, %%ymm2\n\t"			\
+	"vpsrld  112(%2), %%" reg ", %%ymm3\n\t"			\
+	"vpand    32(%2), %%ymm3, %%ymm3\n\t"			\
+	"vpsrld   $3, %%" reg ", %%" reg "\n\t"			\
+	"vpand    64(%2), %%" reg ", %%" reg "\n\t"		\
+	"vpor     %%ymm2, %%" reg ", %%" reg "\n\t"		\
+	"vpor     %%ymm3, %%" reg ", %%" reg "\n\t"		\
+	"vpslld   $16, %%" reg ", %%" reg "\n\t"			\
+	"vpsrad   $16, %%" reg ", %%" reg "\n\t"
+
+#define PIXEL_PACK_AVX2_STORE					\
+	"vpsrldq  $4, %%ymm1, %%ymm1\n\t"				\
+	PIXEL_PACK_AVX2_GATHER("ymm0")				\
+	PIXEL_PACK_AVX2_GATHER("ymm1")				\
+	PIXEL_PACK_AVX2_CONVERT("ymm0")				\
+	PIXEL_PACK_AVX2_CONVERT("ymm1")				\
+	"vpackssdw %%ymm1, %%ymm0, %%ymm0\n\t"			\
+	"vpshufd  $0xb1, %%ymm0, %%ymm0\n\t"			\
+	"vmovdqu  %%ymm0, 0(%1)\n\t"
+
+/*
+ * 16 pixels, 48 source bytes, per iteration. num_pixels is a multiple of
+ * 16.
+ */
+static void
+pixel_pack_avx2(
+	uint8_t * dst,
+	const uint8_t * src,
+	uint32_t num_pixels,
+	uint32_t flags)
+{
+	const struct pixel_pack_x86 * const c = (flags & PIXEL_PACK_555) ?
+		&pixel_pack_x86_555 : &pixel_pack_x86_565;
+	uint32_t i;
+
+	for (i = 0; i < num_pixels; i += 16) {
+		if (flags & PIXEL_PACK_SWAPPED_SRC)
+			asm volatile(
+				PIXEL_PACK_AVX2_LOAD
+				PIXEL_PACK_AVX2_UNSWAP
+				PIXEL_PACK_AVX2_STORE
+				:
+				: "r" (src), "r" (dst), "r" (c)
+				: "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+				  "xmm4");
+		else
+			asm volatile(
+				PIXEL_PACK_AVX2_LOAD
+				PIXEL_PACK_AVX2_STORE
+				:
+				: "r" (src), "r" (dst), "r" (c)
+				: "memory", "xmm0", "xmm1", "xmm2", "xmm3",
+				  "xmm4");
+		src += 48;
+		dst += 32;
+	}
+}
+
+static uint32_t pixel_simd_block = 64;
+static uint32_t pixel_pack_block = 8;
+
+static bool pixel_simd_usable(void)
+{
+	return irq_fpu_usable();
+}
+
+static void pixel_simd_begin(void)
+{
+	kernel_fpu_begin();
+}
+
+static void pixel_simd_end(void)
+{
+	kernel_fpu_end();
+}
+
+static void
+pixel_simd_probe(void)
+{
+	if (boot_cpu_has(X86_FEATURE_AVX2) && boot_cpu_has(X86_FEATURE_AVX)) {
+		pixel_swap_simd = pixel_swap_avx2;
+		pixel_pack_simd = pixel_pack_avx2;
+		pixel_simd_block = 128;
+		pixel_pack_block = 16;
+		pixel_swap_name = "avx2";
+	}
+	else if (boot_cpu_has(X86_FEATURE_XMM2)) {
+		pixel_swap_simd = pixel_swap_sse2;
+		pixel_pack_simd = pixel_pack_sse2;
+		pixel_simd_block = 64;
+		pixel_pack_block = 8;
+		pixel_swap_name = "sse2";
+	}
+}
+
+#elif defined(CONFIG_ARM64) && defined(CONFIG_KERNEL_MODE_NEON)
+/*
+ * rev64 on 32-bit elements swaps the words within each 64-bit lane.
+ * len is a multiple of 64.
+ */
+static void
+pixel_swap_neon(uint8_t * dst, uint8_t * src, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 64) {
+		asm volatile(
+			"ld1	{v0.4s-v3.4s}, [%0]\n\t"
+			"rev64	v0.4s, v0.4s\n\t"
+			"rev64	v1.4s, v1.4s\n\t"
+			"rev64	v2.4s, v2.4s\n\t"
+			"rev64	v3.4s, v3.4s\n\t"
+			"st1	{v0.4s-v3.4s}, [%1]\n\t"
+			:
+			: "r" (src + i), "r" (dst + i)
+			: "memory", "v0", "v1", "v2", "v3");
+	}
+}
+
+/*
+ * pixel_pack_16 without dithering. ld3 splits 8 pixels into their B, G and R
+ * bytes; each channel is moved to the top of a 16-bit lane, and shifted in
+ * with sri.
+ */
+#define PIXEL_PACK_NEON_565(b, g, r)				\
+	"shll	v4.8h, " r ".8b, #8\n\t"				\
+	"shll	v5.8h, " g ".8b, #8\n\t"				\
+	"shll	v6.8h, " b ".8b, #8\n\t"				\
+	"sri	v4.8h, v5.8h, #5\n\t"				\
+	"sri	v4.8h, v6.8h, #11\n\t"
+
+#define PIXEL_PACK_NEON_555(b, g, r)				\
+	"ushll	v4.8h, " r ".8b, #7\n\t"				\
+	"shll	v5.8h, " g ".8b, #8\n\t"				\
+	"shll	v6.8h, " b ".8b, #8\n\t"				\
+	"sri	v4.8h, v5.8h, #6\n\t"				\
+	"sri	v4.8h, v6.8h, #11\n\t"
+
+/*
+ * a source in wire order is loaded as is, its words swapped back, and the
+ * channels picked out with tbl.
+ */
+#define PIXEL_PACK_NEON_UNSWAP					\
+	"ld1	{v0.16b}, [%0]\n\t"				\
+	"ldr	d1, [%0, #16]\n\t"					\
+	"rev64	v0.4s, v0.4s\n\t"					\
+	"rev64	v1.4s, v1.4s\n\t"					\
+	"ld1	{v16.8b-v18.8b}, [%2]\n\t"			\
+	"tbl	v20.8b, {v0.16b, v1.16b}, v16.8b\n\t"		\
+	"tbl	v21.8b, {v0.16b, v1.16b}, v17.8b\n\t"		\
+	"tbl	v22.8b, {v0.16b, v1.16b}, v18.8b\n\t"
+
+#define PIXEL_PACK_NEON_STORE					\
+	"rev64	v4.4s, v4.4s\n\t"					\
+	"st1	{v4.8h}, [%1]\n\t"
+
+static const uint8_t pixel_pack_neon_tbl[24] = {
+	0, 3, 6, 9, 12, 15, 18, 21,
+	1, 4, 7, 10, 13, 16, 19, 22,
+	2, 5, 8, 11, 14, 17, 20, 23,
+};
+
+/*
+ * 8 pixels, 24 source bytes, per iteration. num_pixels is a multiple of 8.
+ */
+static void
+pixel_pack_neon(
+	uint8_t * dst,
+	const uint8_t * src,
+	uint32_t num_pixels,
+	uint32_t flags)
+{
+	const uint8_t * const tbl = pixel_pack_neon_tbl;
+	uint32_t i;
+
+	for (i = 0; i < num_pixels; i += 8) {
+		switch (flags & (PIXEL_PACK_555 | PIXEL_PACK_SWAPPED_SRC)) {
+		case 0:
+			asm volatile(
+				"ld3	{v0.8b-v2.8b}, [%0]\n\t"
+				PIXEL_PACK_NEON_565("v0", "v1", "v2")
+				PIXEL_PACK_NEON_STORE
+				:
+				: "r" (src), "r" (dst), "r" (tbl)
+				: "memory", "v0", "v1", "v2", "v4", "v5",
+				  "v6");
+			break;
+
+		case PIXEL_PACK_555:
+			asm volatile(
+				"ld3	{v0.8b-v2.8b}, [%0]\n\t"
+				PIXEL_PACK_NEON_555("v0", "v1", "v2")
+				PIXEL_PACK_NEON_STORE
+				:
+				: "r" (src), "r" (dst), "r" (tbl)
+				: "memory", "v0", "v1", "v2", "v4", "v5",
+				  "v6");
+			break;
+
+		case PIXEL_PACK_SWAPPED_SRC:
+			asm volatile(
+				PIXEL_PACK_NEON_UNSWAP
+				PIXEL_PACK_NEON_565("v20", "v21", "v22")
+				PIXEL_PACK_NEON_STORE
+				:
+				: "r" (src), "r" (dst), "r" (tbl)
+				: "memory", "v0", "v1", "v4", "v5", "v6",
+				  "v16", "v17", "v18", "v20", "v21", "v22");
+			break;
+
+		default:
+			asm volatile(
+				PIXEL_PACK_NEON_UNSWAP
+				PIXEL_PACK_NEON_555("v20", "v21", "v22")
+				PIXEL_PACK_NEON_STORE
+				:
+				: "r" (src), "r" (dst), "r" (tbl)
+				: "memory", "v0", "v1", "v4", "v5", "v6",
+				  "v16", "v17", "v18", "v20", "v21", "v22");
+			break;
+		}
+		src += 24;
+		dst += 16;
+	}
+}
+
+static uint32_t pixel_simd_block = 64;
+static uint32_t pixel_pack_block = 8;
+
+static bool pixel_simd_usable(void)
+{
+	return may_use_simd();
+}
+
+static void pixel_simd_begin(void)
+{
+	kernel_neon_begin();
+}
+
+static void pixel_simd_end(void)
+{
+	kernel_neon_end();
+}
+
+static void
+pixel_simd_probe(void)
+{
+	pixel_swap_simd = pixel_swap_neon;
+	pixel_pack_simd = pixel_pack_neon;
+	pixel_swap_name = "neon";
+}
+
+#else
+static uint32_t pixel_simd_block = 8;
+static uint32_t pixel_pack_block = 8;
+
+static bool pixel_simd_usable(void)
+{
+	return false;
+}
+
+static void pixel_simd_begin(void)
+{
+}
+
+static void pixel_simd_end(void)
+{
+}
+
+static void
+pixel_simd_probe(void)
+{
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * pick the pixel kernels for this CPU. Called once at module load.
+ */
+void __init
+fl2000_pixel_init(void)
+{
+	pixel_simd_probe();
+	dbg_msg(TRACE_LEVEL_INFO, DBG_INIT, "pixel_swap uses %s", pixel_swap_name);
+}
+
+void
+pixel_swap(uint8_t * dst, uint8_t * src, uint32_t len)
+{
+	uint32_t length;
+	uint32_t chunk;
+
+	length = (len + 7) & 0xFFFFFFF8; // len round up to multiple of 8
+
+	if (pixel_swap_simd != NULL && pixel_simd_usable()) {
+		while (length >= pixel_simd_block) {
+			chunk = min_t(uint32_t, length, PIXEL_SIMD_CHUNK);
+			chunk &= ~(pixel_simd_block - 1);
+
+			pixel_simd_begin();
+			pixel_swap_simd(dst, src, chunk);
+			pixel_simd_end();
+
+			dst += chunk;
+			src += chunk;
+			length -= chunk;
+		}
+	}
+
+	pixel_swap_scalar(dst, src, length);
+}
+
+/*
+ * convert 24bpp pixels to 16bpp, written in wire order: the two 32-bit words
+ * of each 8-byte group are swapped, as pixel_swap does. first_pixel must be a
+ * multiple of 8. Exactly num_pixels * 3 source bytes are read and
+ * num_pixels * 2 destination bytes written. first_pixel and width place the
+ * dithering pattern on the screen; dithering is only done by the scalar
+ * code.
+ */
+void
+pixel_pack_16(
+	uint8_t * dst,
+	uint8_t * src,
+	uint32_t first_pixel,
+	uint32_t num_pixels,
+	uint32_t width,
+	uint32_t flags)
+{
+	uint32_t chunk;
+
+	if (pixel_pack_simd != NULL && !(flags & PIXEL_PACK_DITHER) &&
+	    pixel_simd_usable()) {
+		while (num_pixels >= pixel_pack_block) {
+			chunk = min_t(uint32_t, num_pixels,
+				PIXEL_SIMD_CHUNK / 3);
+			chunk &= ~(pixel_pack_block - 1);
+
+			pixel_simd_begin();
+			pixel_pack_simd(dst, src, chunk, flags);
+			pixel_simd_end();
+
+			dst += chunk * 2;
+			src += chunk * 3;
+			first_pixel += chunk;
+			num_pixels -= chunk;
+		}
+	}
+
+	pixel_pack_scalar(dst, src, first_pixel, num_pixels, width, flags);
+}
+
+/*
+ * 64-bit content hash, in the style of xxh64: four lanes of 8-byte words
+ * over 32-byte stripes, then the tail and a final avalanche. It only has to
+ * tell changed pixels from unchanged ones, it is not a stable format.
+ */
+uint64_t
+pixel_hash(const uint8_t * src, uint32_t len)
+{
+	uint64_t v1 = PIXEL_HASH_PRIME_1 + PIXEL_HASH_PRIME_2;
+	uint64_t v2 = PIXEL_HASH_PRIME_2;
+	uint64_t v3 = 0;
+	uint64_t v4 = -PIXEL_HASH_PRIME_1;
+	uint64_t hash;
+	uint64_t word;
+	uint32_t const total = len;
+
+	while (len >= 32) {
+		v1 = pixel_hash_round(v1, pixel_load64(src));
+		v2 = pixel_hash_round(v2, pixel_load64(src + 8));
+		v3 = pixel_hash_round(v3, pixel_load64(src + 16));
+		v4 = pixel_hash_round(v4, pixel_load64(src + 24));
+		src += 32;
+		len -= 32;
+	}
+	hash = rol64(v1, 1) + rol64(v2, 7) + rol64(v3, 12) + rol64(v4, 18);
+	hash += total;
+
+	while (len >= 8) {
+		hash ^= pixel_hash_round(0, pixel_load64(src));
+		hash = rol64(hash, 27) * PIXEL_HASH_PRIME_1 + PIXEL_HASH_PRIME_4;
+		src += 8;
+		len -= 8;
+	}
+	while (len > 0) {
+		word = *src++;
+		hash ^= word * PIXEL_HASH_PRIME_5;
+		hash = rol64(hash, 11) * PIXEL_HASH_PRIME_1;
+		len--;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PIXEL_HASH_PRIME_2;
+	hash ^= hash >> 29;
+	hash *= PIXEL_HASH_PRIME_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+// eof: fl2000_pixel.c
+//
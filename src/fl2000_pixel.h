@@ -0,0 +1,35 @@
+// fl2000_pixel.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_PIXEL_H_
+#define _FL2000_PIXEL_H_
+
+/*
+ * pixel_pack_16 flags
+ */
+#define PIXEL_PACK_555			(1 << 0)	/* else 565 */
+#define PIXEL_PACK_DITHER		(1 << 1)	/* 4x4 ordered dithering */
+#define PIXEL_PACK_SWAPPED_SRC		(1 << 2)	/* src is in wire order */
+
+void fl2000_pixel_init(void);
+void pixel_swap(uint8_t * dst, uint8_t * src, uint32_t len);
+void pixel_pack_16(
+	uint8_t * dst,
+	uint8_t * src,
+	uint32_t first_pixel,
+	uint32_t num_pixels,
+	uint32_t width,
+	uint32_t flags);
+uint64_t pixel_hash(const uint8_t * src, uint32_t len);
+
+#endif // _FL2000_PIXEL_H_
+
+// eof: fl2000_pixel.h
+//
@@ -11,90 +11,102 @@
 #include "fl2000_include.h"
 
 #define BULK_SIZE		512
-#define MAX_TRANSFER		(58*1024)
-#define GET_URB_TIMEOUT		HZ
-#define WRITES_IN_FLIGHT	4
+#define URB_SIZE_ALIGN		1024	/* super speed bulk max packet size */
+#define MIN_URB_COUNT		2
+#define MAX_URB_COUNT		64
+#define MAX_URB_SIZE		(4*1024*1024)
+#define FREE_URB_TIMEOUT_MS	1000
+#define COMPRESSION_SLACK	64	/* worst case run end and padding */
+
+static void fl2k_stream_work(struct work_struct *work);
 
 void fl2k_urb_completion(struct urb *urb)
 {
 	struct urb_node *unode = urb->context;
 	struct dev_ctx *fl2k = unode->fl2k;
+	struct render_ctx *render_ctx = unode->render_ctx;
+	int status = urb->status;
 	unsigned long flags;
 
 	/* sync/async unlink faults aren't errors */
-	if (urb->status) {
-		if (!(urb->status == -ENOENT ||
-		    urb->status == -ECONNRESET ||
-		    urb->status == -ESHUTDOWN)) {
+	if (status) {
+		if (!(status == -ENOENT ||
+		    status == -ECONNRESET ||
+		    status == -ESHUTDOWN)) {
 			dev_err(&fl2k->usb_dev->dev, "%s - nonzero write bulk status received: %d\n",
-				__func__, urb->status);
+				__func__, status);
 			atomic_set(&fl2k->lost_pixels, 1);
 		}
 	}
 
 	urb->transfer_buffer_length = fl2k->urbs.size; /* reset to actual */
+	unode->render_ctx = NULL;
 
 	spin_lock_irqsave(&fl2k->urbs.lock, flags);
 	list_add_tail(&unode->entry, &fl2k->urbs.list);
 	fl2k->urbs.available++;
 	spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
 
-#if 0
+	if (render_ctx != NULL)
+		fl2000_render_put_pending(render_ctx, status);
+
 	/*
-	 * When using fb_defio, we deadlock if up() is called
-	 * while another is waiting. So queue to another process.
+	 * refill the urb with the next chunk right away, the bus never waits
+	 * for the render work item. The copy runs in the stream work item, not
+	 * here with interrupts off.
 	 */
-	if (fb_defio)
-		schedule_delayed_work(&unode->release_urb_work, 0);
-	else
-#endif
-		up(&fl2k->urbs.limit_sem);
-}
-
-void fl2k_release_urb_work(struct work_struct *work)
-{
-	struct urb_node *unode = container_of(work, struct urb_node,
-					      release_urb_work.work);
-
-	up(&unode->fl2k->urbs.limit_sem);
+	queue_work(system_highpri_wq, &fl2k->urbs.stream_work);
 }
 
 static void fl2k_free_urb_list(struct dev_ctx *fl2k)
 {
-	int count = fl2k->urbs.count;
-	struct list_head *node;
 	struct urb_node *unode;
 	struct urb *urb;
-	int ret;
+	uint32_t delay_ms = 0;
 	unsigned long flags;
 
 	dev_info(&fl2k->usb_dev->dev, "Waiting for completes and freeing all render urbs\n");
 
 	/* keep waiting and freeing, until we've got 'em all */
-	while (count--) {
-
-		/* Getting interrupted means a leak, but ok at shutdown*/
-		ret = down_interruptible(&fl2k->urbs.limit_sem);
-		if (ret)
-			break;
-
+	while (fl2k->urbs.count) {
 		spin_lock_irqsave(&fl2k->urbs.lock, flags);
-
-		node = fl2k->urbs.list.next; /* have reserved one with sem */
-		list_del_init(node);
-
+		unode = list_first_entry_or_null(&fl2k->urbs.list,
+			struct urb_node, entry);
+		if (unode != NULL) {
+			list_del_init(&unode->entry);
+			fl2k->urbs.available--;
+		}
 		spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
 
-		unode = list_entry(node, struct urb_node, entry);
+		if (unode == NULL) {
+			/* Giving up means a leak, but ok at shutdown */
+			if (delay_ms >= FREE_URB_TIMEOUT_MS) {
+				dev_err(&fl2k->usb_dev->dev, "leaking %d busy urbs\n",
+					fl2k->urbs.count);
+				break;
+			}
+			delay_ms += 10;
+			DELAY_MS(10);
+			continue;
+		}
+
 		urb = unode->urb;
 
+		/*
+		 * the completion handler may still be running for it.
+		 */
+		usb_kill_urb(urb);
+
 		/* Free each separately allocated piece */
 		usb_free_coherent(urb->dev, fl2k->urbs.size,
 				  urb->transfer_buffer, urb->transfer_dma);
 		usb_free_urb(urb);
-		kfree(node);
+		kfree(unode);
+		fl2k->urbs.count--;
 	}
 	fl2k->urbs.count = 0;
+
+	cancel_work_sync(&fl2k->urbs.stream_work);
 }
 
 
@@ -111,6 +123,8 @@ int fl2k_alloc_urb_list(struct dev_ctx *fl2k, int count, size_t size)
 
 	fl2k->urbs.size = size;
 	INIT_LIST_HEAD(&fl2k->urbs.list);
+	INIT_LIST_HEAD(&fl2k->urbs.stream_list);
+	INIT_WORK(&fl2k->urbs.stream_work, fl2k_stream_work);
 
 	dev_info(&fl2k->usb_dev->dev, "ep fl2k_alloc_urb_list() pipe %d ep %p",
 		 1, ep);
@@ -121,9 +135,6 @@ int fl2k_alloc_urb_list(struct dev_ctx *fl2k, int count, size_t size)
 			break;
 		unode->fl2k = fl2k;
 
-		INIT_DELAYED_WORK(&unode->release_urb_work,
-			  fl2k_release_urb_work);
-
 		urb = usb_alloc_urb(0, GFP_KERNEL);
 		if (!urb) {
 			kfree(unode);
@@ -131,7 +142,7 @@ int fl2k_alloc_urb_list(struct dev_ctx *fl2k, int count, size_t size)
 		}
 		unode->urb = urb;	/* ULLI check udl driver here */
 
-		buf = usb_alloc_coherent(fl2k->usb_dev, MAX_TRANSFER, GFP_KERNEL,
+		buf = usb_alloc_coherent(fl2k->usb_dev, size, GFP_KERNEL,
 					 &urb->transfer_dma);
 		if (!buf) {
 			kfree(unode);
@@ -151,7 +162,6 @@ int fl2k_alloc_urb_list(struct dev_ctx *fl2k, int count, size_t size)
 		i++;
 	}
 
-	sema_init(&fl2k->urbs.limit_sem, i);
 	fl2k->urbs.count = i;
 	fl2k->urbs.available = i;
 
@@ -160,248 +170,295 @@ int fl2k_alloc_urb_list(struct dev_ctx *fl2k, int count, size_t size)
 	return i;
 }
 
-struct urb *fl2k_get_urb(struct dev_ctx *fl2k)
+/*
+ * account for urbs about to be submitted for the render_ctx. done is set
+ * before the last urb is submitted, so that its completion sees it.
+ */
+static void fl2k_get_pending(
+	struct render_ctx * render_ctx,
+	uint32_t count,
+	bool done)
 {
-	int ret = 0;
-	struct list_head *entry;
-	struct urb_node *unode;
-	struct urb *urb = NULL;
+	struct dev_ctx * const dev_ctx = render_ctx->dev_ctx;
 	unsigned long flags;
 
-	/* Wait for an in-flight buffer to complete and get re-queued */
-	ret = down_timeout(&fl2k->urbs.limit_sem, GET_URB_TIMEOUT);
-	if (ret) {
-		atomic_set(&fl2k->lost_pixels, 1);
-		dev_info(&fl2k->usb_dev->dev, "wait for urb interrupted: %x available: %d\n",
-		       ret, fl2k->urbs.available);
-		goto error;
-	}
-
-	spin_lock_irqsave(&fl2k->urbs.lock, flags);
-
-	BUG_ON(list_empty(&fl2k->urbs.list)); /* reserved one with limit_sem */
-	entry = fl2k->urbs.list.next;
-	list_del_init(entry);
-	fl2k->urbs.available--;
-
-	spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
-
-	unode = list_entry(entry, struct urb_node, entry);
-	urb = unode->urb;
-
-error:
-	return urb;
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	render_ctx->pending_count += count;
+	if (done)
+		render_ctx->transfer_done = true;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
 }
 
-int fl2k_submit_urb(struct dev_ctx *fl2k, struct urb *urb, size_t len)
+/*
+ * zero-copy frames are streamed straight from the user pages by their own
+ * urbs, followed by a null size urb.
+ */
+static void fl2k_submit_sg(struct dev_ctx *fl2k, struct render_ctx *render_ctx)
 {
 	int ret;
 
-	BUG_ON(len > fl2k->urbs.size);
-
-	urb->transfer_buffer_length = len; /* set to actual payload len */
-	ret = usb_submit_urb(urb, GFP_ATOMIC);
+	fl2k_get_pending(render_ctx, 2, true);
+	ret = usb_submit_urb(render_ctx->main_urb, GFP_KERNEL);
 	if (ret) {
-		fl2k_urb_completion(urb); /* because no one else will */
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"[ERR] usb_submit-urb(%p) failed with %d!",
+			render_ctx->main_urb, ret);
 		atomic_set(&fl2k->lost_pixels, 1);
-		dev_err(&fl2k->usb_dev->dev, "usb_submit_urb error %d ep %p\n",
-			ret, urb->ep);
+		fl2000_render_put_pending(render_ctx, ret);
+		fl2000_render_put_pending(render_ctx, ret);
+		return;
 	}
-	return ret;
-}
-
 
-/////////////////////////////////////////////////////////////////////////////////
-// P R I V A T E
-/////////////////////////////////////////////////////////////////////////////////
-//
+	ret = usb_submit_urb(render_ctx->zero_length_urb, GFP_KERNEL);
+	if (ret) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"[ERR] zero_length_urb submit fails with %d.", ret);
+		fl2000_render_put_pending(render_ctx, ret);
+	}
+}
 
 /*
- * push render_ctx to the bus, with dev_ctx->render.busy_list_lock held
+ * feed free urbs with the next chunks of the frames on stream_list, oldest
+ * frame first. Queued by the render work item and by urb completion. A work
+ * item never runs concurrently with itself, so the chunks are submitted in
+ * bus order while urbs.lock is only held to claim an urb and a chunk; the
+ * copy, swap or pack into the urb runs with interrupts on. When no urb is
+ * free, the next completion queues us again.
  */
-int
-fl2000_render_with_busy_list_lock(
-	struct dev_ctx * dev_ctx,
-	struct render_ctx * render_ctx
-	)
+static void fl2k_stream_work(struct work_struct *work)
 {
-	struct list_head* const	free_list_head = &dev_ctx->render.free_list;
-	int ret_val = 0;
+	struct dev_ctx *fl2k = container_of(work, struct dev_ctx,
+		urbs.stream_work);
+	struct render_ctx *render_ctx;
+	struct primary_surface *surface;
+	struct urb_node *unode;
+	struct urb *urb;
+	uint8_t *src;
+	uint32_t offset;
+	uint32_t len;
+	bool last;
+	int ret;
 	unsigned long flags;
 
-	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, ">>>>");
-
-	if (!dev_ctx->monitor_plugged_in) {
-		dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
-			"WARNING Monitor is not attached.");
-		/*
-		 * put the render_ctx into free_list_head
-		 */
-		spin_lock_bh(&dev_ctx->render.free_list_lock);
-		list_add_tail(&render_ctx->list_entry, free_list_head);
-		spin_unlock_bh(&dev_ctx->render.free_list_lock);
+	do {
+		spin_lock_irqsave(&fl2k->urbs.lock, flags);
+		render_ctx = list_first_entry_or_null(&fl2k->urbs.stream_list,
+			struct render_ctx, stream_entry);
+		if (render_ctx == NULL) {
+			spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
+			break;
+		}
+		if (render_ctx->transfer_mode == RENDER_TRANSFER_SG) {
+			list_del_init(&render_ctx->stream_entry);
+			spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
+			fl2k_submit_sg(fl2k, render_ctx);
+			continue;
+		}
 
-		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		dev_ctx->render.free_list_count++;
-		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
-		goto exit;
-	}
+		if (list_empty(&fl2k->urbs.list)) {
+			spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
+			break;
+		}
 
-	/*
-	 * put this render_ctx into busy_list
-	 */
-	list_add_tail(&render_ctx->list_entry, &dev_ctx->render.busy_list);
-	spin_lock_irqsave(&dev_ctx->count_lock, flags);
-	dev_ctx->render.busy_list_count++;
-	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		unode = list_first_entry(&fl2k->urbs.list, struct urb_node, entry);
+		list_del_init(&unode->entry);
+		fl2k->urbs.available--;
+		urb = unode->urb;
 
-	fl2000_bulk_prepare_urb(dev_ctx, render_ctx);
-	spin_lock_irqsave(&dev_ctx->count_lock, flags);
-	render_ctx->pending_count++;
-	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
-	ret_val = usb_submit_urb(render_ctx->main_urb, GFP_ATOMIC);
-	if (ret_val != 0) {
-		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-			"[ERR] usb_submit-urb(%p) failed with %d!",
-			render_ctx->main_urb,
-			ret_val);
+		/* ULLI : send null size USB at the end */
+		offset = render_ctx->transfer_offset;
+		len = render_ctx->transfer_buffer_length - offset;
+		if (len > fl2k->urbs.size)
+			len = fl2k->urbs.size;
+		last = (len == 0);
+		render_ctx->transfer_offset += len;
+		if (last)
+			list_del_init(&render_ctx->stream_entry);
+
+		unode->render_ctx = render_ctx;
+		fl2k_get_pending(render_ctx, 1, last);
+		spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
 
-		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		render_ctx->pending_count--;
-		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		src = render_ctx->transfer_buffer;
+		switch (render_ctx->transfer_mode) {
+		case RENDER_TRANSFER_SWAP:
+			pixel_swap(urb->transfer_buffer, src + offset, len);
+			break;
 
-		/*
-		 * remove this render_ctx from busy_list
-		 */
-		list_del(&render_ctx->list_entry);
+		case RENDER_TRANSFER_PACK_16:
+			/*
+			 * transfer_offset counts 16bpp bytes, the source is
+			 * 24bpp.
+			 */
+			surface = render_ctx->primary_surface;
+			pixel_pack_16(urb->transfer_buffer,
+				src + offset / 2 * 3,
+				offset / 2,
+				len / 2,
+				surface->width,
+				render_ctx->pack_flags);
+			break;
 
-		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		dev_ctx->render.busy_list_count--;
-		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		default:
+			memcpy(urb->transfer_buffer, src + offset, len);
+			break;
+		}
 
-		/*
-		 * put the render_ctx into free_list_head
-		 */
-		spin_lock_bh(&dev_ctx->render.free_list_lock);
-		list_add_tail(&render_ctx->list_entry, free_list_head);
-		spin_unlock_bh(&dev_ctx->render.free_list_lock);
+		urb->transfer_buffer_length = len; /* set to actual payload len */
+		ret = usb_submit_urb(urb, GFP_KERNEL);
+		if (ret) {
+			atomic_set(&fl2k->lost_pixels, 1);
+			dev_err(&fl2k->usb_dev->dev, "usb_submit_urb error %d ep %p\n",
+				ret, urb->ep);
 
-		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		dev_ctx->render.free_list_count++;
-		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+			spin_lock_irqsave(&fl2k->urbs.lock, flags);
+			unode->render_ctx = NULL;
+			urb->transfer_buffer_length = fl2k->urbs.size;
+			list_add_tail(&unode->entry, &fl2k->urbs.list);
+			fl2k->urbs.available++;
 
-		if (-ENODEV == ret_val || -ENOENT == ret_val) {
 			/*
-			 * mark the fl2000 device gone
+			 * drop the rest of this frame.
 			 */
-			dev_ctx->dev_gone = 1;
+			if (!last) {
+				list_del_init(&render_ctx->stream_entry);
+				fl2k_get_pending(render_ctx, 0, true);
+			}
+			spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
+			fl2000_render_put_pending(render_ctx, ret);
 		}
-	    goto exit;
-	}
+	} while (true);
+}
 
-	spin_lock_irqsave(&dev_ctx->count_lock, flags);
-	render_ctx->pending_count++;
-	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
-	ret_val = usb_submit_urb(
-		render_ctx->zero_length_urb, GFP_ATOMIC);
-	if (ret_val != 0) {
-		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-			"[ERR] zero_length_urb submit fails with %d.",
-			ret_val);
+/*
+ * queue a frame behind the ones already streaming.
+ */
+static void fl2k_stream_frame(struct dev_ctx *fl2k, struct render_ctx *render_ctx)
+{
+	unsigned long flags;
 
-		/*
-		 * the main_urb is already schedule, we wait until
-		 * the completion to move the render_ctx to free_list
-		 */
-		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		render_ctx->pending_count--;
-		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
-		if (-ENODEV == ret_val || -ENOENT == ret_val) {
-			/*
-			 * mark the fl2000 device gone
-			 */
-			dev_ctx->dev_gone = 1;
-		}
-		goto exit;
-	}
+	spin_lock_irqsave(&fl2k->urbs.lock, flags);
+	list_add_tail(&render_ctx->stream_entry, &fl2k->urbs.stream_list);
+	spin_unlock_irqrestore(&fl2k->urbs.lock, flags);
 
-exit:
-    dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, "<<<<");
-    return ret_val;
+	queue_work(system_highpri_wq, &fl2k->urbs.stream_work);
 }
-int fl2k_render_hline(struct dev_ctx *fl2k, const char *src,
-		      u32 length)
-{
-	struct urb *urb;
-	char *buf;
 
-	urb = fl2k_get_urb(fl2k);
-	if (!urb)
-		return -1; /* lost_pixels is set */
 
-	buf = urb->transfer_buffer;
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
 
-	memcpy(buf, src, length);
-	return fl2k_submit_urb(fl2k, urb, length);
+#ifdef FL2000_FENCE
+static const char *
+fl2000_fence_get_driver_name(struct dma_fence * fence)
+{
+	return "fl2000";
 }
 
-int fl2k_handle_damage(struct dev_ctx *fl2k,
-		       struct render_ctx *node)
+static const char *
+fl2000_fence_get_timeline_name(struct dma_fence * fence)
 {
-	int ret;
-	struct primary_surface *surface = node->primary_surface;
-	int width = surface->width;
-	int height = surface->height;
-	u32 length;
-	uint8_t *buf = surface->render_buffer;
-	struct urb *urb;
-	unsigned long start_jiffies;
-	unsigned long end_jiffies;
-	int msec;
+	return "fl2000_frame";
+}
 
-	start_jiffies = jiffies;
+static const struct dma_fence_ops fl2000_fence_ops = {
+	.get_driver_name	= fl2000_fence_get_driver_name,
+	.get_timeline_name	= fl2000_fence_get_timeline_name,
+};
+#endif // FL2000_FENCE
 
-#if 0	/* ULLI : this causes problems with logging via serial */
-	dev_info(&fl2k->usb_dev->dev, "fl2k handle damage for %d lines", height);
-#endif
-	if (in_irq())
-		dev_info(&fl2k->usb_dev->dev, "ERROR fl2k_handle_damage in IRQ");
+/*
+ * render_mailbox mode: leave the frame of surface, with its fence, for the
+ * render work item. A frame still waiting there is replaced, and its fence
+ * signaled as dropped. Returns true if a frame was replaced.
+ */
+static bool
+fl2000_render_mailbox_put(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface,
+	struct dma_fence * 	fence)
+{
+	struct primary_surface*	replaced;
+	struct dma_fence *	replaced_fence;
+
+	spin_lock_bh(&dev_ctx->render.mailbox_lock);
+	replaced = dev_ctx->render.mailbox_surface;
+	replaced_fence = dev_ctx->render.mailbox_fence;
+	WRITE_ONCE(dev_ctx->render.mailbox_surface, surface);
+	dev_ctx->render.mailbox_fence = fence;
+	spin_unlock_bh(&dev_ctx->render.mailbox_lock);
+
+	fl2000_render_signal_fence(replaced_fence, -ECANCELED);
+	return replaced != NULL;
+}
+
+/*
+ * take the frame out of the mailbox. The fence reference goes to the caller.
+ */
+static struct primary_surface*
+fl2000_render_mailbox_take(
+	struct dev_ctx * 	dev_ctx,
+	struct dma_fence ** 	fence)
+{
+	struct primary_surface*	surface;
 
-	length = width * height * 3;
+	spin_lock_bh(&dev_ctx->render.mailbox_lock);
+	surface = dev_ctx->render.mailbox_surface;
+	*fence = dev_ctx->render.mailbox_fence;
+	WRITE_ONCE(dev_ctx->render.mailbox_surface, NULL);
+	dev_ctx->render.mailbox_fence = NULL;
+	spin_unlock_bh(&dev_ctx->render.mailbox_lock);
 
-	while (length >= MAX_TRANSFER) {
-		ret = fl2k_render_hline(fl2k, buf, MAX_TRANSFER);
-		if (ret < 0) {
-			dev_err(&fl2k->usb_dev->dev, "fl2k fl2k_handle_damage(), no URB");
-			return ret;
-		}
-		length -= MAX_TRANSFER;
-		buf += MAX_TRANSFER;
-	}
+	return surface;
+}
 
-	if (length > 0) {
-		ret = fl2k_render_hline(fl2k, buf, length);
-		if (ret < 0) {
-			dev_err(&fl2k->usb_dev->dev, "fl2k fl2k_handle_damage(), no URB");
-			return ret;
-		}
+/*
+ * return a frame taken out of the mailbox, unless a newer one has arrived
+ * meanwhile; then the frame is dropped and false returned.
+ */
+static bool
+fl2000_render_mailbox_put_back(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface,
+	struct dma_fence * 	fence)
+{
+	bool put_back = false;
+
+	spin_lock_bh(&dev_ctx->render.mailbox_lock);
+	if (dev_ctx->render.mailbox_surface == NULL) {
+		WRITE_ONCE(dev_ctx->render.mailbox_surface, surface);
+		dev_ctx->render.mailbox_fence = fence;
+		put_back = true;
 	}
+	spin_unlock_bh(&dev_ctx->render.mailbox_lock);
 
-	/* ULLI : send null size USB at the end */
-	urb = fl2k_get_urb(fl2k);
-	if (!urb)
-		return -1; /* lost_pixels is set */
+	if (!put_back)
+		fl2000_render_signal_fence(fence, -ECANCELED);
+	return put_back;
+}
 
-	fl2k_submit_urb(fl2k, urb, 0);
+/*
+ * drop the frame waiting in the mailbox, if it is of surface, or of any
+ * surface if surface is NULL.
+ */
+static void
+fl2000_render_mailbox_drop(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface)
+{
+	struct dma_fence * fence = NULL;
 
-	end_jiffies = jiffies;
-	msec =  jiffies_to_msecs(end_jiffies - start_jiffies);
+	spin_lock_bh(&dev_ctx->render.mailbox_lock);
+	if (surface == NULL || dev_ctx->render.mailbox_surface == surface) {
+		fence = dev_ctx->render.mailbox_fence;
+		WRITE_ONCE(dev_ctx->render.mailbox_surface, NULL);
+		dev_ctx->render.mailbox_fence = NULL;
+	}
+	spin_unlock_bh(&dev_ctx->render.mailbox_lock);
 
-#if 0	/* : ULLI this causes problems with logging via serial */
-	dev_info(&fl2k->usb_dev->dev, "fl2k handle damage for %d lines msec : %d",
-		 height, msec);
-#endif
-	return 0;
+	fl2000_render_signal_fence(fence, -ECANCELED);
 }
 
 int
@@ -419,8 +476,13 @@ fl2000_render_ctx_create(
 		render_ctx = &dev_ctx->render.render_ctx[i];
 
 		INIT_LIST_HEAD(&render_ctx->list_entry);
+		INIT_LIST_HEAD(&render_ctx->stream_entry);
 		render_ctx->dev_ctx = dev_ctx;
 		render_ctx->pending_count = 0;
+		tasklet_init(
+			&render_ctx->tasklet,
+			fl2000_render_completion_tasklet,
+			(unsigned long) render_ctx);
 
 		render_ctx->main_urb = usb_alloc_urb(0, GFP_ATOMIC);
 		if (!render_ctx->main_urb) {
@@ -467,6 +529,12 @@ fl2000_render_ctx_destroy(
 		if (render_ctx == NULL)
 			break;
 
+		tasklet_kill(&render_ctx->tasklet);
+
+		vfree(render_ctx->comp_buffer);
+		render_ctx->comp_buffer = NULL;
+		render_ctx->comp_buffer_size = 0;
+
 		if (render_ctx->main_urb) {
 		    usb_free_urb( render_ctx->main_urb);
 		    render_ctx->main_urb = NULL;
@@ -494,6 +562,9 @@ int
 fl2000_render_create(struct dev_ctx * dev_ctx)
 {
 	int ret_val;
+	uint32_t urb_count;
+	uint32_t urb_size;
+	uint32_t i;
 
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, ">>>>");
 
@@ -516,14 +587,58 @@ fl2000_render_create(struct dev_ctx * dev_ctx)
 		goto exit;
 	}
 
-	if (!fl2k_alloc_urb_list(dev_ctx, WRITES_IN_FLIGHT, MAX_TRANSFER)) {
+	/*
+	 * the urb pool of each device is sized by the module parameters at
+	 * the time it is plugged in.
+	 */
+	urb_count = clamp_t(uint32_t, render_urb_count,
+		MIN_URB_COUNT, MAX_URB_COUNT);
+	urb_size = clamp_t(uint32_t, ALIGN(render_urb_size, URB_SIZE_ALIGN),
+		URB_SIZE_ALIGN, MAX_URB_SIZE);
+	if (!fl2k_alloc_urb_list(dev_ctx, urb_count, urb_size)) {
 		dev_err(&dev_ctx->usb_dev->dev, "udl_alloc_urb_list failed\n");
+		ret_val = -ENOMEM;
 		goto exit;
 	}
 
 	INIT_LIST_HEAD(&dev_ctx->render.surface_list);
 	spin_lock_init(&dev_ctx->render.surface_list_lock);
 	dev_ctx->render.surface_list_count = 0;
+	spin_lock_init(&dev_ctx->render.shadow_pool_lock);
+
+	spin_lock_init(&dev_ctx->render.fence_lock);
+	spin_lock_init(&dev_ctx->render.mailbox_lock);
+#ifdef FL2000_FENCE
+	dev_ctx->render.fence_context = dma_fence_context_alloc(1);
+#endif
+	dev_ctx->render.fence_seqno = 0;
+
+	/*
+	 * single threaded, so that frames are pushed to the bus in order.
+	 */
+	INIT_WORK(&dev_ctx->render.render_work, fl2000_render_work);
+	dev_ctx->render.render_wq = create_singlethread_workqueue("fl2000_render_wq");
+	if (dev_ctx->render.render_wq == NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"[ERR] create render_wq failed?");
+		ret_val = -ENOMEM;
+		goto exit;
+	}
+
+	/*
+	 * compression stripes run on any cpu.
+	 */
+	for (i = 0; i < MAX_COMPRESSION_STRIPES; i++)
+		INIT_WORK(&dev_ctx->render.comp_stripe[i].work,
+			fl2000_comp_stripe_work);
+	dev_ctx->render.comp_wq = alloc_workqueue("fl2000_comp_wq",
+		WQ_UNBOUND, 0);
+	if (dev_ctx->render.comp_wq == NULL) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"[ERR] create comp_wq failed?");
+		ret_val = -ENOMEM;
+		goto exit;
+	}
 
 exit:
 	if (ret_val < 0) {
@@ -541,32 +656,89 @@ fl2000_render_destroy(struct dev_ctx * dev_ctx)
 {
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, ">>>>");
 
+	if (dev_ctx->render.render_wq) {
+		destroy_workqueue(dev_ctx->render.render_wq);
+		dev_ctx->render.render_wq = NULL;
+	}
+
+	if (dev_ctx->render.comp_wq) {
+		destroy_workqueue(dev_ctx->render.comp_wq);
+		dev_ctx->render.comp_wq = NULL;
+	}
+
 	fl2000_render_ctx_destroy(dev_ctx);
 
+	vfree(dev_ctx->render.comp_scratch);
+	dev_ctx->render.comp_scratch = NULL;
+	dev_ctx->render.comp_scratch_size = 0;
+
 	if (dev_ctx->urbs.count)
 		fl2k_free_urb_list(dev_ctx);
 
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, "<<<<");
 }
 
+/*
+ * estimate the link throughput from a completed frame. The frame had the bus
+ * to itself from the later of its submit time and the previous completion.
+ * Kept as a running average with 1/8 weight on the new sample.
+ */
+static void
+fl2000_render_measure_link(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx)
+{
+	ktime_t const now = ktime_get();
+	ktime_t start = render_ctx->submit_time;
+	uint64_t bytes_per_sec;
+	int64_t elapsed_ns;
+
+	if (ktime_before(start, dev_ctx->render.link_last_done))
+		start = dev_ctx->render.link_last_done;
+	dev_ctx->render.link_last_done = now;
+
+	elapsed_ns = ktime_to_ns(ktime_sub(now, start));
+	if (elapsed_ns <= 0 || render_ctx->transfer_buffer_length == 0)
+		return;
+
+	bytes_per_sec = div64_u64(
+		(uint64_t) render_ctx->transfer_buffer_length * NSEC_PER_SEC,
+		elapsed_ns);
+	if (dev_ctx->render.link_bytes_per_sec == 0)
+		dev_ctx->render.link_bytes_per_sec = bytes_per_sec;
+	else
+		dev_ctx->render.link_bytes_per_sec =
+			dev_ctx->render.link_bytes_per_sec -
+			(dev_ctx->render.link_bytes_per_sec >> 3) +
+			(bytes_per_sec >> 3);
+}
+
 void fl2000_render_completion(struct render_ctx * render_ctx)
 {
 	struct dev_ctx * const dev_ctx = render_ctx->dev_ctx;
-	int const urb_status = render_ctx->main_urb->status;
+	int const urb_status = render_ctx->transfer_status;
+	struct dma_fence * const fence = render_ctx->fence;
 	unsigned long flags;
 
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, ">>>>");
 
+	render_ctx->fence = NULL;
+
 	/*
-	 * remove this render_ctx from busy_list
+	 * remove this render_ctx from busy_list. The comp_cache reference is
+	 * dropped first: once the render_ctx is off busy_list,
+	 * fl2000_render_release_surface() may free the surface.
 	 */
 	spin_lock_bh(&dev_ctx->render.busy_list_lock);
-	list_del(&render_ctx->list_entry);
-	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
-
 	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	if (render_ctx->comp_cached) {
+		render_ctx->primary_surface->comp_cache_users--;
+		render_ctx->comp_cached = false;
+	}
 	dev_ctx->render.busy_list_count--;
 	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+	list_del(&render_ctx->list_entry);
+	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
 
 	/*
 	 * put the render_ctx into free_list_head
@@ -579,6 +751,11 @@ void fl2000_render_completion(struct render_ctx * render_ctx)
 	dev_ctx->render.free_list_count++;
 	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
 
+	/*
+	 * the last urb of the frame is back, the surface is no longer read.
+	 */
+	fl2000_render_signal_fence(fence, urb_status < 0 ? urb_status : 0);
+
 	if (urb_status < 0) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 			"urb->status(%d) error", urb_status);
@@ -590,6 +767,7 @@ void fl2000_render_completion(struct render_ctx * render_ctx)
 		    }
 		goto exit;
 	}
+	fl2000_render_measure_link(dev_ctx, render_ctx);
 	fl2000_schedule_next_render(dev_ctx);
 exit:
 	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER, "<<<<");
@@ -601,14 +779,41 @@ void fl2000_render_completion_tasklet(unsigned long data)
 	fl2000_render_completion(render_ctx);
 }
 
+/*
+ * one urb of the render_ctx is back. The frame is complete once all its urbs
+ * are submitted and none is pending any more. We are typically called from
+ * hard_irq context, so the completion is done by the tasklet.
+ */
+void fl2000_render_put_pending(struct render_ctx * render_ctx, int status)
+{
+	struct dev_ctx * const dev_ctx = render_ctx->dev_ctx;
+	uint32_t pending_count;
+	bool transfer_done;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	if (status < 0 && render_ctx->transfer_status == 0)
+		render_ctx->transfer_status = status;
+	pending_count = --render_ctx->pending_count;
+	transfer_done = render_ctx->transfer_done;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	if (pending_count == 0 && transfer_done)
+		tasklet_schedule(&render_ctx->tasklet);
+}
+
 /*
  * schedule a frame buffer for update.
- * the input frame_buffer should be pinned down or resident in kernel sapce
+ * the input frame_buffer should be pinned down or resident in kernel sapce.
+ * the frame is only queued here, the render work item does the pixel
+ * conversion and the submission. fence, if any, goes with this frame; the
+ * reference is ours from here on.
  */
 void
 fl2000_primary_surface_update(
 	struct dev_ctx * 	dev_ctx,
-	struct primary_surface* surface)
+	struct primary_surface* surface,
+	struct dma_fence * 	fence)
 {
 	struct list_head* const	free_list_head = &dev_ctx->render.free_list;
 	struct list_head* const	ready_list_head = &dev_ctx->render.ready_list;
@@ -625,6 +830,21 @@ fl2000_primary_surface_update(
 
 	if (dev_ctx->render.green_light == 0) {
 		dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER, "green_light off");
+		fl2000_render_signal_fence(fence, -ECANCELED);
+		goto exit;
+	}
+
+	/*
+	 * latest frame wins: replace the frame not yet picked up by the render
+	 * work item, instead of queueing behind it.
+	 */
+	if (render_mailbox) {
+		if (fl2000_render_mailbox_put(dev_ctx, surface, fence)) {
+			spin_lock_irqsave(&dev_ctx->count_lock, flags);
+			dev_ctx->render.dropped_frame_count++;
+			spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		}
+		fl2000_schedule_next_render(dev_ctx);
 		goto exit;
 	}
 
@@ -640,7 +860,7 @@ retry:
 		list_del(&render_ctx->list_entry);
 
 		spin_lock_irqsave(&dev_ctx->count_lock, flags);
-		dev_ctx->render.free_list_count--;
+		free_count = --dev_ctx->render.free_list_count;
 		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
 	}
 	spin_unlock_bh(&dev_ctx->render.free_list_lock);
@@ -649,6 +869,7 @@ retry:
 		if (retry_count > 3) {
 			dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
 				"no render_ctx?");
+			fl2000_render_signal_fence(fence, -ECANCELED);
 			return;
 		}
 		retry_count++;
@@ -660,6 +881,7 @@ retry:
 	 * by now we have a render_ctx, initialize it and schedule it
 	 */
 	render_ctx->primary_surface = surface;
+	render_ctx->fence = fence;
 
 	spin_lock_bh(&dev_ctx->render.ready_list_lock);
 	list_add_tail(&render_ctx->list_entry, ready_list_head);
@@ -670,7 +892,7 @@ retry:
 
 	spin_unlock_bh(&dev_ctx->render.ready_list_lock);
 
-	dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_RENDER,
 		"render_ctx(%p) scheduled, free_count(%u)/ready_count(%u)",
 		render_ctx, free_count, ready_count);
 
@@ -684,24 +906,526 @@ exit:
 }
 
 /*
- * schedule all render_ctx on ready_list. We schedule redundant frames if no
- * new frames are available.
+ * pixel_pack_16 flags for the current display mode.
+ */
+uint32_t
+fl2000_render_pack_flags(struct dev_ctx * dev_ctx)
+{
+	uint32_t flags = 0;
+
+	if (dev_ctx->vr_params.color_mode_16bit == VR_16_BIT_COLOR_MODE_555)
+		flags |= PIXEL_PACK_555;
+	if (render_dither)
+		flags |= PIXEL_PACK_DITHER;
+	return flags;
+}
+
+/*
+ * true if the surface is packed to 16bpp on the way to the FL2000.
+ */
+static bool
+fl2000_render_pack_16(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface*	surface)
+{
+	return surface->color_format == COLOR_FORMAT_RGB_24 &&
+		dev_ctx->vr_params.output_image_type == OUTPUT_IMAGE_TYPE_RGB_16;
+}
+
+/*
+ * true if the current display mode has the cpu read the pixels of the
+ * surface, to pack or to compress them.
+ */
+bool
+fl2000_render_needs_cpu(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface*	surface)
+{
+	return fl2000_render_pack_16(dev_ctx, surface) ||
+		dev_ctx->vr_params.use_compression;
+}
+
+/*
+ * kick the render work item. Called from ioctl context as well as from the
+ * render completion tasklet.
  */
 void
 fl2000_schedule_next_render(struct dev_ctx * dev_ctx)
+{
+	if (dev_ctx->render.render_wq == NULL)
+		return;
+
+	queue_work(dev_ctx->render.render_wq, &dev_ctx->render.render_work);
+}
+
+/*
+ * put the render_ctx back to free_list
+ */
+static void
+fl2000_render_put_ctx(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx)
+{
+	unsigned long flags;
+
+	/*
+	 * the frame is dropped.
+	 */
+	fl2000_render_signal_fence(render_ctx->fence, -ECANCELED);
+	render_ctx->fence = NULL;
+
+	spin_lock_bh(&dev_ctx->render.free_list_lock);
+	list_add_tail(&render_ctx->list_entry, &dev_ctx->render.free_list);
+	spin_unlock_bh(&dev_ctx->render.free_list_lock);
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	dev_ctx->render.free_list_count++;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+}
+
+/*
+ * drop the frame of a render_ctx that cannot go out. The surface stops being
+ * the redundant frame source until the next NOTIFY, or the render work item
+ * would keep taking the same frame and dropping it again.
+ */
+static void
+fl2000_render_drop_frame(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx)
+{
+	struct primary_surface* const surface = render_ctx->primary_surface;
+
+	spin_lock_bh(&dev_ctx->render.busy_list_lock);
+	if (dev_ctx->render.last_updated_surface == surface)
+		dev_ctx->render.last_updated_surface = NULL;
+	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
+
+	fl2000_render_put_ctx(dev_ctx, render_ctx);
+}
+
+/*
+ * get a render_ctx from free_list, NULL if all of them are in use.
+ */
+static struct render_ctx *
+fl2000_render_get_ctx(struct dev_ctx * dev_ctx)
 {
 	struct list_head* const	free_list_head = &dev_ctx->render.free_list;
+	struct render_ctx *	render_ctx = NULL;
+	unsigned long 		flags;
+
+	spin_lock_bh(&dev_ctx->render.free_list_lock);
+	if (!list_empty(free_list_head)) {
+		render_ctx = list_first_entry(
+			free_list_head, struct render_ctx, list_entry);
+		list_del(&render_ctx->list_entry);
+
+		spin_lock_irqsave(&dev_ctx->count_lock, flags);
+		dev_ctx->render.free_list_count--;
+		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+	}
+	spin_unlock_bh(&dev_ctx->render.free_list_lock);
+
+	return render_ctx;
+}
+
+/*
+ * true if the frame comes from shadow_buffer, but the shadow was filled for
+ * another display mode.
+ */
+static bool
+fl2000_render_shadow_stale(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface*	surface)
+{
+	if (surface->flags & SURFACE_FLAG_ZERO_COPY)
+		return false;
+	if (surface->type != SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE &&
+	    surface->system_buffer != NULL)
+		return false;
+	if (surface->swap_pending && surface->system_buffer != NULL)
+		return false;
+	return surface->shadow_format !=
+		fl2000_surface_shadow_format(dev_ctx, surface);
+}
+
+/*
+ * make sure buffer holds at least needed bytes.
+ */
+static int
+fl2000_render_reserve(uint8_t ** buffer, uint32_t * size, uint32_t needed)
+{
+	if (*size >= needed)
+		return 0;
+
+	vfree(*buffer);
+	*buffer = vmalloc(needed);
+	if (*buffer == NULL) {
+		*size = 0;
+		return -ENOMEM;
+	}
+	*size = needed;
+	return 0;
+}
+
+/*
+ * stream the compressed frame cached on the surface, if it is still the
+ * frame the surface holds. Redundant frames cost no compression that way.
+ * The cached frame fit its budget when it was made, so the mask is not
+ * looked at.
+ */
+static bool
+fl2000_render_comp_cache_get(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx,
+	bool			pack_555)
+{
+	struct primary_surface* const surface = render_ctx->primary_surface;
+	unsigned long	flags;
+	bool		hit;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	hit = surface->comp_cache_valid &&
+		surface->comp_cache_frame_num == surface->frame_num &&
+		surface->comp_cache_pack_555 == pack_555;
+	if (hit) {
+		surface->comp_cache_users++;
+		render_ctx->comp_cached = true;
+		dev_ctx->render.comp_cache_hits++;
+	}
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	if (!hit)
+		return false;
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION,
+		"frame(%u) sent again from comp_cache, %u bytes",
+		surface->frame_num,
+		surface->comp_cache_length);
+
+	render_ctx->transfer_mode = RENDER_TRANSFER_SWAP;
+	render_ctx->transfer_buffer = surface->comp_cache;
+	render_ctx->transfer_buffer_length = surface->comp_cache_length;
+	return true;
+}
+
+/*
+ * keep the frame just compressed into the comp_buffer of the render_ctx as the
+ * comp_cache of the surface. The two buffers trade places, so nothing is
+ * copied; this is only possible while no render_ctx streams the old cache.
+ */
+static void
+fl2000_render_comp_cache_put(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx,
+	uint32_t		frame_num,
+	uint32_t		compressed_length,
+	bool			pack_555)
+{
+	struct primary_surface* const surface = render_ctx->primary_surface;
+	uint8_t *	buffer;
+	uint32_t	size;
+	unsigned long	flags;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	if (surface->comp_cache_users != 0) {
+		surface->comp_cache_valid = false;
+		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		return;
+	}
+
+	buffer = surface->comp_cache;
+	size = surface->comp_cache_size;
+	surface->comp_cache = render_ctx->comp_buffer;
+	surface->comp_cache_size = render_ctx->comp_buffer_size;
+	render_ctx->comp_buffer = buffer;
+	render_ctx->comp_buffer_size = size;
+
+	surface->comp_cache_length = compressed_length;
+	surface->comp_cache_frame_num = frame_num;
+	surface->comp_cache_pack_555 = pack_555;
+	surface->comp_cache_valid = true;
+	surface->comp_cache_users++;
+	render_ctx->comp_cached = true;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	render_ctx->transfer_buffer = surface->comp_cache;
+}
+
+/*
+ * gravity compress the frame into the comp_buffer of the render_ctx, which is
+ * then streamed in place of the frame. The compression mask follows the size
+ * of what we get.
+ */
+static int
+fl2000_render_compress(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx)
+{
+	struct primary_surface* const surface = render_ctx->primary_surface;
+	uint32_t const num_pixels = surface->width * surface->height;
+	uint32_t const frame_num = surface->frame_num;
+	uint8_t *	source;
+	size_t		compressed_length;
+	bool const	pack_555 = dev_ctx->vr_params.output_image_type ==
+				OUTPUT_IMAGE_TYPE_RGB_16 &&
+				surface->color_format == COLOR_FORMAT_RGB_24;
+	uint32_t	retry_count = 0;
+	ktime_t		start_time;
+	s64		compress_us;
+	unsigned long	flags;
+	int		ret_val;
+
+	if (fl2000_render_comp_cache_get(dev_ctx, render_ctx, pack_555))
+		return 0;
+
+	/*
+	 * the compressor takes the pixels in the order the user app wrote
+	 * them.
+	 */
+	if (surface->flags & SURFACE_FLAG_ZERO_COPY) {
+		ret_val = fl2000_render_reserve(
+			&dev_ctx->render.comp_scratch,
+			&dev_ctx->render.comp_scratch_size,
+			surface->buffer_length + COMPRESSION_SLACK);
+		if (ret_val < 0)
+			return ret_val;
+		pixel_swap(dev_ctx->render.comp_scratch,
+			surface->system_buffer,
+			surface->buffer_length);
+		source = dev_ctx->render.comp_scratch;
+	} else if (surface->type != SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE &&
+		   surface->system_buffer != NULL) {
+		source = surface->system_buffer;
+	} else {
+		source = surface->shadow_buffer;
+	}
+
+	ret_val = fl2000_render_reserve(
+		&render_ctx->comp_buffer,
+		&render_ctx->comp_buffer_size,
+		num_pixels * PIXEL_BYTE_3 + COMPRESSION_SLACK);
+	if (ret_val < 0)
+		return ret_val;
+
+	/*
+	 * a frame over the budget is compressed again with a lower mask, until
+	 * it fits or the mask cannot go any lower.
+	 */
+	start_time = ktime_get();
+	for (;;) {
+		compressed_length = fl2000_compression_gravity_striped(
+			dev_ctx,
+			surface->buffer_length,
+			source,
+			render_ctx->comp_buffer,
+			surface->width,
+			surface->height,
+			pack_555);
+
+		if (!fl2000_comp_control(dev_ctx, compressed_length,
+		    retry_count))
+			break;
+		retry_count++;
+	}
+	compress_us = ktime_us_delta(ktime_get(), start_time);
+
+	/*
+	 * the stream goes through pixel_swap, which works on 8-byte groups.
+	 * pad with single data, as fl2000_comp_padding_alignment does.
+	 */
+	while (compressed_length & 7)
+		render_ctx->comp_buffer[compressed_length++] = 0x80;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	dev_ctx->render.compressed_frame_count++;
+	dev_ctx->render.last_compressed_bytes = compressed_length;
+	dev_ctx->render.last_uncompressed_bytes = surface->buffer_length;
+	dev_ctx->render.compressed_bytes += compressed_length;
+	dev_ctx->render.last_comp_retries = retry_count;
+	dev_ctx->render.comp_retries += retry_count;
+	dev_ctx->render.last_comp_us = (uint32_t) compress_us;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION,
+		"frame(%u) compressed to %u bytes, budget(%u), mask_index(%u), "
+		"retries(%u), %u stripes in %u us",
+		frame_num,
+		(unsigned int) compressed_length,
+		dev_ctx->render.comp_budget,
+		dev_ctx->vr_params.compression_mask_index,
+		retry_count,
+		dev_ctx->render.last_comp_stripes,
+		(unsigned int) compress_us);
+
+	render_ctx->transfer_mode = RENDER_TRANSFER_SWAP;
+	render_ctx->transfer_buffer = render_ctx->comp_buffer;
+	render_ctx->transfer_buffer_length = compressed_length;
+	fl2000_render_comp_cache_put(dev_ctx, render_ctx, frame_num,
+		compressed_length, pack_555);
+	return 0;
+}
+
+/*
+ * take a render_ctx for a redundant frame, if the bus is running short of
+ * frames.
+ */
+static struct render_ctx *
+fl2000_render_get_redundant_ctx(struct dev_ctx * dev_ctx)
+{
+	struct primary_surface*	surface = dev_ctx->render.last_updated_surface;
+	struct render_ctx *	render_ctx;
+
+	if (dev_ctx->render.busy_list_count >= NUM_RENDER_ON_BUS ||
+	    !dev_ctx->render.green_light ||
+	    !dev_ctx->monitor_plugged_in ||
+	    surface == NULL ||
+	    fl2000_render_shadow_stale(dev_ctx, surface))
+		return NULL;
+
+	render_ctx = fl2000_render_get_ctx(dev_ctx);
+	if (render_ctx != NULL)
+		render_ctx->primary_surface = surface;
+	return render_ctx;
+}
+
+/*
+ * set up one render_ctx and queue it for streaming. The render_ctx stays on
+ * busy_list until the last urb of the frame completes.
+ */
+static void
+fl2000_render_one(
+	struct dev_ctx * 	dev_ctx,
+	struct render_ctx *	render_ctx)
+{
+	struct primary_surface* const surface = render_ctx->primary_surface;
+	bool pack_16;
+	bool mapped;
+	unsigned long flags;
+
+	if (!dev_ctx->monitor_plugged_in) {
+		dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
+			"WARNING Monitor is not attached.");
+		fl2000_render_put_ctx(dev_ctx, render_ctx);
+		return;
+	}
+
+	mapped = surface->type != SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE &&
+		surface->system_buffer != NULL;
+
+	/*
+	 * volatile surfaces are gone once the NOTIFY returns; the shadow
+	 * buffer keeps the frame for redundant frames.
+	 */
+	if (!(surface->flags & SURFACE_FLAG_ZERO_COPY) && !mapped) {
+		if (surface->swap_pending && surface->system_buffer != NULL) {
+			surface->swap_pending = false;
+			fl2000_surface_update_shadow(dev_ctx, surface);
+		}
+
+		/*
+		 * the display mode changed since the shadow was filled.
+		 */
+		if (fl2000_render_shadow_stale(dev_ctx, surface)) {
+			dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
+				"stale shadow_buffer, frame dropped");
+			fl2000_render_put_ctx(dev_ctx, render_ctx);
+			return;
+		}
+	}
+
+	/*
+	 * 24bpp surfaces are packed to 16bpp on the way, if the FL2000
+	 * streams 16bpp.
+	 */
+	pack_16 = fl2000_render_pack_16(dev_ctx, surface);
+	render_ctx->pack_flags = fl2000_render_pack_flags(dev_ctx);
+
+	/*
+	 * the cpu cannot read a dma-buf surface, so it can only go out as it
+	 * is. The NOTIFY refuses such frames; this catches a display mode
+	 * changed since.
+	 */
+	if (surface->dma_buf != NULL &&
+	    fl2000_render_needs_cpu(dev_ctx, surface)) {
+		dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER,
+			"dma-buf surface needs conversion, frame dropped");
+		fl2000_render_drop_frame(dev_ctx, render_ctx);
+		return;
+	}
+
+	if (dev_ctx->vr_params.use_compression) {
+		if (fl2000_render_compress(dev_ctx, render_ctx) < 0) {
+			dbg_msg(TRACE_LEVEL_ERROR, DBG_RENDER,
+				"no compression buffer, frame dropped");
+			fl2000_render_drop_frame(dev_ctx, render_ctx);
+			return;
+		}
+	} else if (surface->flags & SURFACE_FLAG_ZERO_COPY) {
+		if (pack_16) {
+			render_ctx->transfer_mode = RENDER_TRANSFER_PACK_16;
+			render_ctx->transfer_buffer = surface->system_buffer;
+			render_ctx->transfer_buffer_length =
+				surface->width * surface->height * 2;
+			render_ctx->pack_flags |= PIXEL_PACK_SWAPPED_SRC;
+		} else {
+			render_ctx->transfer_mode = RENDER_TRANSFER_SG;
+			fl2000_bulk_prepare_urb(dev_ctx, render_ctx);
+		}
+	} else if (mapped) {
+		/*
+		 * the user pages stay mapped as long as the surface lives, so
+		 * the pixels are swapped straight into the urbs, chunk by
+		 * chunk, and the shadow buffer is not touched.
+		 */
+		surface->swap_pending = false;
+		render_ctx->transfer_buffer = surface->system_buffer;
+		if (pack_16) {
+			render_ctx->transfer_mode = RENDER_TRANSFER_PACK_16;
+			render_ctx->transfer_buffer_length =
+				surface->width * surface->height * 2;
+		} else {
+			render_ctx->transfer_mode = RENDER_TRANSFER_SWAP;
+			render_ctx->transfer_buffer_length =
+				surface->buffer_length;
+		}
+	} else {
+		render_ctx->transfer_mode = RENDER_TRANSFER_COPY;
+		render_ctx->transfer_buffer = surface->shadow_buffer;
+		render_ctx->transfer_buffer_length = surface->shadow_length;
+	}
+	render_ctx->transfer_offset = 0;
+	render_ctx->transfer_done = false;
+	render_ctx->transfer_status = 0;
+	render_ctx->pending_count = 0;
+	render_ctx->submit_time = ktime_get();
+
+	spin_lock_bh(&dev_ctx->render.busy_list_lock);
+	list_add_tail(&render_ctx->list_entry, &dev_ctx->render.busy_list);
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	dev_ctx->render.busy_list_count++;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
+
+	fl2k_stream_frame(dev_ctx, render_ctx);
+}
+
+/*
+ * render work item. Takes out all render_ctx on ready_list and pushes them to
+ * the bus. We schedule redundant frames if no new frames are available.
+ */
+void
+fl2000_render_work(struct work_struct * work_item)
+{
+	struct dev_ctx * const dev_ctx =
+		container_of(work_item, struct dev_ctx, render.render_work);
 	struct list_head* const	ready_list_head = &dev_ctx->render.ready_list;
 	struct list_head	staging_list;
 	struct render_ctx *	render_ctx = NULL;
+	struct primary_surface*	surface;
+	struct dma_fence *	fence;
 	uint32_t		ready_count = 0;
+	uint32_t		redundant_count = 0;
 	unsigned long 		flags;
-	int			ret_val;
-
-	if (dev_ctx->render.green_light == 0) {
-		dbg_msg(TRACE_LEVEL_WARNING, DBG_RENDER, "green_light off");
-		goto exit;
-	}
 
 	/*
 	 * step 1: take out all render_ctx on ready list, and put them to
@@ -722,58 +1446,185 @@ fl2000_schedule_next_render(struct dev_ctx * dev_ctx)
 	spin_unlock_bh(&dev_ctx->render.ready_list_lock);
 
 	/*
-	 * step 2, schedule all render_ctx, with busy_list_lock held.
-	 * this is critical path where we schedule redundant frames.
+	 * in mailbox mode, take the latest frame. If all render_ctx are on the
+	 * bus, leave it in the mailbox unless a newer one has replaced it;
+	 * the next render completion brings us back here.
 	 */
-	spin_lock_bh(&dev_ctx->render.busy_list_lock);
-reschedule:
-	while (!list_empty(&staging_list)) {
-		render_ctx = list_first_entry(
-			&staging_list, struct render_ctx, list_entry);
-		list_del(&render_ctx->list_entry);
-		ret_val = fl2k_handle_damage(dev_ctx, render_ctx);
-		if (ret_val < 0) {
-			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
-				"usb_submit_urb failed %d, "
-				"turn off green_light\n", ret_val);
-			dev_ctx->render.green_light = false;
-			break;
+	surface = fl2000_render_mailbox_take(dev_ctx, &fence);
+	if (surface != NULL) {
+		render_ctx = fl2000_render_get_ctx(dev_ctx);
+		if (render_ctx != NULL) {
+			render_ctx->primary_surface = surface;
+			render_ctx->fence = fence;
+			list_add_tail(&render_ctx->list_entry, &staging_list);
+		} else if (!fl2000_render_mailbox_put_back(
+				dev_ctx, surface, fence)) {
+			spin_lock_irqsave(&dev_ctx->count_lock, flags);
+			dev_ctx->render.dropped_frame_count++;
+			spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
 		}
 	}
 
 	/*
-	 * schedule redundant frames.
+	 * step 2, schedule all render_ctx, followed by redundant frames.
+	 * nothing here waits for the bus; the urb completions do the
+	 * streaming. A redundant frame that does not reach the bus leaves
+	 * busy_list_count where it was, so no more than NUM_OF_RENDER_CTX of
+	 * them are tried in one pass; the next completion or NOTIFY brings us
+	 * back.
 	 */
-	if (dev_ctx->render.busy_list_count < NUM_RENDER_ON_BUS &&
-	    dev_ctx->render.green_light) {
-		struct primary_surface* surface;
-
-		spin_lock_bh(&dev_ctx->render.free_list_lock);
-		if (!list_empty(free_list_head)) {
+	do {
+		while (!list_empty(&staging_list)) {
 			render_ctx = list_first_entry(
-				free_list_head, struct render_ctx, list_entry);
+				&staging_list, struct render_ctx, list_entry);
 			list_del(&render_ctx->list_entry);
 
-			spin_lock_irqsave(&dev_ctx->count_lock, flags);
-			dev_ctx->render.free_list_count--;
-			spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+			if (dev_ctx->render.green_light == 0) {
+				fl2000_render_put_ctx(dev_ctx, render_ctx);
+				continue;
+			}
+
+			fl2000_render_one(dev_ctx, render_ctx);
 		}
-		spin_unlock_bh(&dev_ctx->render.free_list_lock);
 
-		/*
-		 * preparing additional frame
-		 */
-		if (render_ctx != NULL) {
-			surface = dev_ctx->render.last_updated_surface;
-			render_ctx->primary_surface = surface;
+		if (redundant_count++ >= NUM_OF_RENDER_CTX)
+			break;
+
+		render_ctx = fl2000_render_get_redundant_ctx(dev_ctx);
+		if (render_ctx != NULL)
 			list_add_tail(&render_ctx->list_entry, &staging_list);
-			goto reschedule;
+	} while (render_ctx != NULL);
+}
+
+/*
+ * a fence on the render timeline, signaled by fl2000_render_signal_fence().
+ * NULL if fences are not supported, or no memory.
+ */
+struct dma_fence * fl2000_render_create_fence(struct dev_ctx * dev_ctx)
+{
+#ifdef FL2000_FENCE
+	struct dma_fence * fence;
+	uint64_t seqno;
+	unsigned long flags;
+
+	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	if (fence == NULL)
+		return NULL;
+
+	spin_lock_irqsave(&dev_ctx->render.fence_lock, flags);
+	seqno = ++dev_ctx->render.fence_seqno;
+	spin_unlock_irqrestore(&dev_ctx->render.fence_lock, flags);
+
+	dma_fence_init(fence, &fl2000_fence_ops, &dev_ctx->render.fence_lock,
+		dev_ctx->render.fence_context, seqno);
+	return fence;
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * signal the fence and drop our reference. error is 0 when the frame went
+ * out.
+ */
+void fl2000_render_signal_fence(struct dma_fence * fence, int error)
+{
+	if (fence == NULL)
+		return;
+#ifdef FL2000_FENCE
+	if (error)
+		dma_fence_set_error(fence, error);
+	dma_fence_signal(fence);
+	dma_fence_put(fence);
+#endif
+}
+
+/*
+ * forget the surface as the redundant frame source, and wait until no
+ * render_ctx refers to it any more.
+ */
+void fl2000_render_release_surface(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface)
+{
+	struct render_ctx *	render_ctx;
+	uint32_t		delay_ms = 0;
+	bool			in_use;
+
+	might_sleep();
+
+	spin_lock_bh(&dev_ctx->render.busy_list_lock);
+	if (dev_ctx->render.last_updated_surface == surface)
+		dev_ctx->render.last_updated_surface = NULL;
+	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
+	fl2000_render_mailbox_drop(dev_ctx, surface);
+
+	/*
+	 * the render work item might still be converting or copying it.
+	 */
+	if (dev_ctx->render.render_wq)
+		flush_work(&dev_ctx->render.render_work);
+
+	do {
+		in_use = false;
+		spin_lock_bh(&dev_ctx->render.busy_list_lock);
+		list_for_each_entry(render_ctx, &dev_ctx->render.busy_list,
+				    list_entry) {
+			if (render_ctx->primary_surface == surface) {
+				in_use = true;
+				break;
+			}
+		}
+		spin_unlock_bh(&dev_ctx->render.busy_list_lock);
+
+		if (in_use) {
+			delay_ms += 10;
+			DELAY_MS(10);
+		}
+	} while (in_use);
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_RENDER,
+		"surface(%p) released after %u ms", surface, delay_ms);
+}
+
+/*
+ * tell whether the surface is shown, queued, or on the bus. It is a snapshot;
+ * only the caller flipping the surfaces can keep it true.
+ */
+bool fl2000_render_surface_busy(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface)
+{
+	struct render_ctx *	render_ctx;
+	bool			busy = false;
+
+	if (READ_ONCE(dev_ctx->render.last_updated_surface) == surface ||
+	    READ_ONCE(dev_ctx->render.mailbox_surface) == surface)
+		return true;
+
+	spin_lock_bh(&dev_ctx->render.ready_list_lock);
+	list_for_each_entry(render_ctx, &dev_ctx->render.ready_list,
+			    list_entry) {
+		if (render_ctx->primary_surface == surface) {
+			busy = true;
+			break;
+		}
+	}
+	spin_unlock_bh(&dev_ctx->render.ready_list_lock);
+	if (busy)
+		return true;
+
+	spin_lock_bh(&dev_ctx->render.busy_list_lock);
+	list_for_each_entry(render_ctx, &dev_ctx->render.busy_list,
+			    list_entry) {
+		if (render_ctx->primary_surface == surface) {
+			busy = true;
+			break;
 		}
 	}
 	spin_unlock_bh(&dev_ctx->render.busy_list_lock);
 
-exit:
-	return;
+	return busy;
 }
 
 void fl2000_render_start(struct dev_ctx * dev_ctx)
@@ -789,7 +1640,28 @@ void fl2000_render_stop(struct dev_ctx * dev_ctx)
 	dev_ctx->render.green_light = 0;
 
 	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
-		"busy_list_count(%u)", dev_ctx->render.busy_list_count);
+		"busy_list_count(%u), dropped_frame_count(%u)",
+		dev_ctx->render.busy_list_count,
+		dev_ctx->render.dropped_frame_count);
+	if (dev_ctx->render.compressed_frame_count)
+		dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+			"compressed_frame_count(%u), last(%u bytes), "
+			"average(%u bytes), retries(%u)",
+			dev_ctx->render.compressed_frame_count,
+			dev_ctx->render.last_compressed_bytes,
+			(uint32_t) div_u64(dev_ctx->render.compressed_bytes,
+				dev_ctx->render.compressed_frame_count),
+			dev_ctx->render.comp_retries);
+
+	/*
+	 * with green_light off, the render work item returns everything on
+	 * ready_list to free_list.
+	 */
+	fl2000_render_mailbox_drop(dev_ctx, NULL);
+	if (dev_ctx->render.render_wq) {
+		fl2000_schedule_next_render(dev_ctx);
+		flush_work(&dev_ctx->render.render_work);
+	}
 
 	while (dev_ctx->render.busy_list_count != 0) {
 		delay_ms += 10;
@@ -19,12 +19,31 @@ void fl2000_render_stop(struct dev_ctx * dev_ctx);
 
 void fl2000_render_completion(struct render_ctx * render_ctx);
 void fl2000_render_completion_tasklet(unsigned long data);
+void fl2000_render_put_pending(struct render_ctx * render_ctx, int status);
 
 void fl2000_primary_surface_update(
 	struct dev_ctx * 	dev_ctx,
-	struct primary_surface* surface);
+	struct primary_surface* surface,
+	struct dma_fence * 	fence);
 
+uint32_t fl2000_render_pack_flags(struct dev_ctx * dev_ctx);
+bool fl2000_render_needs_cpu(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface*	surface);
 void fl2000_schedule_next_render(struct dev_ctx * dev_ctx);
+void fl2000_render_work(struct work_struct * work_item);
+
+void fl2000_render_release_surface(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface);
+
+struct dma_fence * fl2000_render_create_fence(struct dev_ctx * dev_ctx);
+
+void fl2000_render_signal_fence(struct dma_fence * fence, int error);
+
+bool fl2000_render_surface_busy(
+	struct dev_ctx * 	dev_ctx,
+	struct primary_surface* surface);
 
 #endif // _FL2000_RENDER_H_
 
@@ -67,6 +67,126 @@ long fl2000_get_user_pages(
 #endif
 }
 
+static void fl2000_mmap_read_lock(struct mm_struct * mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	mmap_read_lock(mm);
+#else
+	down_read(&mm->mmap_sem);
+#endif
+}
+
+static void fl2000_mmap_read_unlock(struct mm_struct * mm)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	mmap_read_unlock(mm);
+#else
+	up_read(&mm->mmap_sem);
+#endif
+}
+
+/*
+ * true if the pages of the surface stay pinned past the current ioctl:
+ * persistent surfaces as long as they live, volatile surfaces as long as the
+ * pin cache keeps them, which can be until the surface is destroyed.
+ */
+static bool fl2000_surface_pinned_long(struct primary_surface* surface)
+{
+	if (surface->type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT)
+		return true;
+#ifdef FL2000_PIN_CACHE
+	if (surface->type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE &&
+	    surface->pin_notifier_active)
+		return true;
+#endif
+	return false;
+}
+
+/*
+ * pin nr_pages user pages from start on, for fragmented surfaces. Since 5.6
+ * the lockless pin_user_pages_fast() is used, and pages that stay pinned past
+ * the ioctl are pinned FOLL_LONGTERM, so that they are first moved out of CMA
+ * and ZONE_MOVABLE and do not block migration there.
+ * Returns the number of pages pinned, which can be less than nr_pages.
+ */
+static long fl2000_pin_user_pages(
+	struct primary_surface* surface,
+	unsigned long start,
+	unsigned long nr_pages,
+	struct page **pages)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+	unsigned int gup_flags = 0;
+
+	if (fl2000_surface_pinned_long(surface))
+		gup_flags |= FOLL_LONGTERM;
+	return pin_user_pages_fast(start, nr_pages, gup_flags, pages);
+#else
+	long pages_pinned;
+
+	fl2000_mmap_read_lock(current->mm);
+	pages_pinned = fl2000_get_user_pages(start, nr_pages, pages, NULL);
+	fl2000_mmap_read_unlock(current->mm);
+	return pages_pinned;
+#endif
+}
+
+/*
+ * pin a virtual contiguous surface without mmap_sem, if its user mapping is
+ * backed by ordinary pages. FOLL_LONGTERM may migrate pages off CMA, so the
+ * pin is only kept if the pages are still physically contiguous. Returns
+ * false, with nothing pinned, if the caller must take the get_user_pages()
+ * path: before 5.6, or for driver mappings with VM_IO or VM_PFNMAP, which
+ * pin_user_pages_fast() refuses.
+ */
+static bool fl2000_pin_contiguous_pages(
+	unsigned long start,
+	unsigned long nr_pages,
+	struct page **pages)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+	long pages_pinned;
+	unsigned long i;
+
+	pages_pinned = pin_user_pages_fast(start, nr_pages, FOLL_LONGTERM,
+		pages);
+	if (pages_pinned <= 0)
+		return false;
+
+	for (i = 1; i < pages_pinned; i++) {
+		if (page_to_pfn(pages[i]) != page_to_pfn(pages[0]) + i)
+			break;
+	}
+	if (pages_pinned != nr_pages || i != pages_pinned) {
+		unpin_user_pages(pages, pages_pinned);
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * release pages taken by fl2000_pin_user_pages(), or by get_user_pages().
+ */
+static void fl2000_unpin_user_pages(
+	struct primary_surface* surface,
+	struct page **pages,
+	unsigned long nr_pages)
+{
+	unsigned long i;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+	if (surface->pages_foll_pin) {
+		unpin_user_pages(pages, nr_pages);
+		return;
+	}
+#endif
+	for (i = 0; i < nr_pages; i++)
+		put_page(pages[i]);
+}
+
 int fl2000_surface_pin_down(
 	struct dev_ctx * dev_ctx,
 	struct primary_surface* surface)
@@ -98,6 +218,7 @@ int fl2000_surface_pin_down(
 	surface->pages = pages;
 	surface->nr_pages = nr_pages;
 	surface->pages_pinned = 0;
+	surface->pages_foll_pin = false;
 
 	/*
 	 * for normal user surface, we lock it down by get_user_pages.
@@ -108,14 +229,19 @@ int fl2000_surface_pin_down(
 	switch (surface->type) {
 	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE:
 	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT:
+		surface->pages_foll_pin =
+			LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0);
+
+		/*
+		 * a short pin continues where the previous one stopped.
+		 */
 		while (surface->pages_pinned != nr_pages) {
-			down_read(&current->mm->mmap_sem);
-			pages_pinned = fl2000_get_user_pages(
-				surface->user_buffer,
-				nr_pages,
-				pages,
-				NULL);
-			up_read(&current->mm->mmap_sem);
+			pages_pinned = fl2000_pin_user_pages(
+				surface,
+				start + ((unsigned long) surface->pages_pinned <<
+					PAGE_SHIFT),
+				nr_pages - surface->pages_pinned,
+				pages + surface->pages_pinned);
 			if (pages_pinned <= 0) {
 				dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 					"get_user_pages fails with %d\n", pages_pinned);
@@ -129,7 +255,13 @@ int fl2000_surface_pin_down(
 		break;
 
 	case SURFACE_TYPE_VIRTUAL_CONTIGUOUS:
-		down_read(&current->mm->mmap_sem);
+		if (fl2000_pin_contiguous_pages(start, nr_pages, pages)) {
+			surface->pages_foll_pin = true;
+			pages_pinned = nr_pages;
+			goto contiguous_pinned;
+		}
+
+		fl2000_mmap_read_lock(current->mm);
 		/*
 		 * work-around the user memory which is mapped from driver,
 		 * but with VM_IO, VM_PFNMAP flags. This API assumes the mmaped user addr
@@ -144,7 +276,7 @@ int fl2000_surface_pin_down(
 			pages,
 			NULL);
 		vma->vm_flags = old_flags;
-		up_read(&current->mm->mmap_sem);
+		fl2000_mmap_read_unlock(current->mm);
 		if (pages_pinned <= 0) {
 			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 				"get_user_pages fails with %d\n", pages_pinned);
@@ -152,11 +284,13 @@ int fl2000_surface_pin_down(
 			goto release_pages;
 		}
 
+contiguous_pinned:
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 			"%d pages pinned\n", pages_pinned);
 
 		surface->pages_pinned = pages_pinned;
 		first_page = surface->pages[0];
+		surface->first_page = first_page;
 		surface->physical_address = PFN_PHYS(page_to_pfn(first_page)) +
 		surface->start_offset;
 		break;
@@ -178,8 +312,7 @@ int fl2000_surface_pin_down(
 	goto exit;
 
 release_pages:
-	for (i = 0; i < surface->pages_pinned; i++)
-		put_page(pages[i]);
+	fl2000_unpin_user_pages(surface, pages, surface->pages_pinned);
 	kfree(pages);
 	surface->pages = NULL;
 	surface->nr_pages = 0;
@@ -195,13 +328,11 @@ void fl2000_surface_unpin(
 {
 	struct page ** pages = surface->pages;
 	unsigned int pages_pinned = surface->pages_pinned;
-	unsigned int i;
 
 	if (surface->pages == NULL)
 		return;
 
-	for (i = 0; i < pages_pinned; i++)
-		put_page(pages[i]);
+	fl2000_unpin_user_pages(surface, pages, pages_pinned);
 
 	surface->pages = NULL;
 	surface->nr_pages = 0;
@@ -273,11 +404,523 @@ void fl2000_surface_unmap(
 	surface->system_buffer = NULL;
 }
 
-int fl2000_surface_create(
+#ifdef FL2000_PIN_CACHE
+/*
+ * the mm is about to change the pages behind the surface. We may be in a
+ * context that cannot sleep, so the pages are only marked stale here, and
+ * dropped by the next update of the surface, or when it is destroyed. They
+ * were pinned FOLL_LONGTERM, so until then they hold no movable memory.
+ */
+static bool
+fl2000_surface_invalidate(
+	struct mmu_interval_notifier * mni,
+	const struct mmu_notifier_range * range,
+	unsigned long cur_seq)
+{
+	mmu_interval_set_seq(mni, cur_seq);
+	return true;
+}
+
+static const struct mmu_interval_notifier_ops fl2000_surface_notifier_ops = {
+	.invalidate = fl2000_surface_invalidate,
+};
+#endif
+
+/*
+ * pin and map a SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE surface for one
+ * update. The pages and the mapping of the previous update are used again,
+ * unless the mm changed the range in between.
+ */
+int fl2000_surface_pin_volatile(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	unsigned long flags;
+	int ret_val;
+#ifdef FL2000_PIN_CACHE
+	unsigned long seq = 0;
+
+	if (surface->pin_cached &&
+	    !mmu_interval_check_retry(&surface->pin_notifier,
+	    surface->pin_seq)) {
+		spin_lock_irqsave(&dev_ctx->count_lock, flags);
+		dev_ctx->render.pin_cache_hits++;
+		spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+		return 0;
+	}
+	fl2000_surface_release_pin_cache(dev_ctx, surface);
+
+	if (!surface->pin_notifier_active) {
+		ret_val = mmu_interval_notifier_insert(
+			&surface->pin_notifier,
+			current->mm,
+			surface->user_buffer,
+			surface->buffer_length,
+			&fl2000_surface_notifier_ops);
+		if (ret_val < 0)
+			dbg_msg(TRACE_LEVEL_WARNING, DBG_PNP,
+				"mmu_interval_notifier_insert failed %d, "
+				"pages are not cached", ret_val);
+		else
+			surface->pin_notifier_active = true;
+	}
+	if (surface->pin_notifier_active)
+		seq = mmu_interval_read_begin(&surface->pin_notifier);
+#endif
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	dev_ctx->render.pin_cache_misses++;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+
+	ret_val = fl2000_surface_pin_down(dev_ctx, surface);
+	if (ret_val < 0) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"user_buffer(%p) pin failure?",
+			(void*) (unsigned long) surface->user_buffer);
+		return ret_val;
+	}
+	ret_val = fl2000_surface_map(dev_ctx, surface);
+	if (ret_val < 0) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"user_buffer(%p) map failure?",
+			(void*) (unsigned long) surface->user_buffer);
+		fl2000_surface_unpin(dev_ctx, surface);
+		return ret_val;
+	}
+
+#ifdef FL2000_PIN_CACHE
+	if (surface->pin_notifier_active) {
+		surface->pin_seq = seq;
+		surface->pin_cached = true;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * done with the update of a volatile surface. The pages stay pinned if the
+ * mm can tell us when they go away.
+ */
+void fl2000_surface_unpin_volatile(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	if (surface->pin_cached)
+		return;
+
+	fl2000_surface_unmap(dev_ctx, surface);
+	fl2000_surface_unpin(dev_ctx, surface);
+}
+
+/*
+ * drop the pages kept pinned by fl2000_surface_unpin_volatile().
+ */
+void fl2000_surface_release_pin_cache(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	if (!surface->pin_cached)
+		return;
+
+	surface->pin_cached = false;
+	fl2000_surface_unmap(dev_ctx, surface);
+	fl2000_surface_unpin(dev_ctx, surface);
+}
+
+/*
+ * build the scatterlist the urb is DMAed from, for surfaces streamed straight
+ * from the user pages. Physically adjacent pages share one entry, so the
+ * table is only as long as the number of merged segments.
+ */
+static int
+fl2000_surface_build_sg(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	int ret_val;
+
+	switch (surface->type) {
+	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_PERSISTENT:
+		ret_val = sg_alloc_table_from_pages(
+			&surface->sg_table,
+			surface->pages,
+			surface->nr_pages,
+			surface->start_offset,
+			surface->buffer_length,
+			GFP_KERNEL);
+		break;
+
+	case SURFACE_TYPE_VIRTUAL_CONTIGUOUS:
+	case SURFACE_TYPE_PHYSICAL_CONTIGUOUS:
+		ret_val = sg_alloc_table(&surface->sg_table, 1, GFP_KERNEL);
+		if (ret_val == 0)
+			sg_set_page(surface->sg_table.sgl,
+				surface->first_page,
+				surface->buffer_length,
+				surface->start_offset);
+		break;
+
+	default:
+		ret_val = -EINVAL;
+		break;
+	}
+
+	if (ret_val < 0) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"no sg_table for surface(%x), %d?",
+			(unsigned int) surface->handle, ret_val);
+		return ret_val;
+	}
+
+	dbg_msg(TRACE_LEVEL_INFO, DBG_PNP,
+		"surface(%x): %u pages in %u sg entries",
+		(unsigned int) surface->handle,
+		surface->nr_pages,
+		surface->sg_table.orig_nents);
+	return 0;
+}
+
+/*
+ * bytes of kernel memory spent on the surface, besides shadow_buffer and the
+ * user pages themselves.
+ */
+size_t fl2000_surface_metadata_size(struct primary_surface* surface)
+{
+	size_t size = sizeof(*surface);
+
+	if (surface->pages)
+		size += surface->nr_pages * sizeof(struct page *);
+	size += surface->sg_table.orig_nents * sizeof(struct scatterlist);
+	if (surface->band_hash)
+		size += surface->num_bands * sizeof(uint64_t);
+	if (surface->band_dirty)
+		size += BITS_TO_LONGS(surface->num_bands) *
+			sizeof(unsigned long);
+	return size;
+}
+
+/*
+ * take a shadow_buffer of at least size bytes, from the pool if one fits,
+ * the smallest one that does.
+ */
+static uint8_t *
+fl2000_surface_get_shadow(
+	struct dev_ctx * dev_ctx,
+	uint32_t size,
+	uint32_t * alloc_size)
+{
+	struct render * const render = &dev_ctx->render;
+	uint8_t * buffer = NULL;
+	uint32_t best = SHADOW_POOL_SIZE;
+	uint32_t i;
+
+	spin_lock(&render->shadow_pool_lock);
+	for (i = 0; i < SHADOW_POOL_SIZE; i++) {
+		if (render->shadow_pool[i] == NULL ||
+		    render->shadow_pool_size[i] < size)
+			continue;
+		if (best == SHADOW_POOL_SIZE ||
+		    render->shadow_pool_size[i] < render->shadow_pool_size[best])
+			best = i;
+	}
+	if (best != SHADOW_POOL_SIZE) {
+		buffer = render->shadow_pool[best];
+		*alloc_size = render->shadow_pool_size[best];
+		render->shadow_pool[best] = NULL;
+		render->shadow_pool_size[best] = 0;
+		render->shadow_pool_hits++;
+	} else {
+		render->shadow_pool_misses++;
+	}
+	spin_unlock(&render->shadow_pool_lock);
+
+	if (buffer != NULL)
+		return buffer;
+
+	buffer = vmalloc(size);
+	if (buffer != NULL)
+		*alloc_size = size;
+	return buffer;
+}
+
+/*
+ * give a shadow_buffer back to the pool, or free it if the pool is full.
+ */
+static void
+fl2000_surface_put_shadow(
+	struct dev_ctx * dev_ctx,
+	uint8_t * buffer,
+	uint32_t size)
+{
+	struct render * const render = &dev_ctx->render;
+	uint32_t i;
+
+	spin_lock(&render->shadow_pool_lock);
+	for (i = 0; i < SHADOW_POOL_SIZE; i++) {
+		if (render->shadow_pool[i] == NULL) {
+			render->shadow_pool[i] = buffer;
+			render->shadow_pool_size[i] = size;
+			buffer = NULL;
+			break;
+		}
+	}
+	spin_unlock(&render->shadow_pool_lock);
+
+	vfree(buffer);
+}
+
+/*
+ * free the shadow_buffer pool, once all surfaces of the device are gone.
+ */
+void fl2000_surface_free_shadow_pool(struct dev_ctx * dev_ctx)
+{
+	struct render * const render = &dev_ctx->render;
+	uint8_t * buffers[SHADOW_POOL_SIZE];
+	uint32_t i;
+
+	spin_lock(&render->shadow_pool_lock);
+	for (i = 0; i < SHADOW_POOL_SIZE; i++) {
+		buffers[i] = render->shadow_pool[i];
+		render->shadow_pool[i] = NULL;
+		render->shadow_pool_size[i] = 0;
+	}
+	spin_unlock(&render->shadow_pool_lock);
+
+	for (i = 0; i < SHADOW_POOL_SIZE; i++)
+		vfree(buffers[i]);
+}
+
+/*
+ * what shadow_buffer has to hold for the current display mode.
+ */
+uint32_t fl2000_surface_shadow_format(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	if (dev_ctx->vr_params.use_compression)
+		return SHADOW_FORMAT_RAW;
+
+	if (dev_ctx->vr_params.output_image_type == OUTPUT_IMAGE_TYPE_RGB_16 &&
+	    surface->color_format == COLOR_FORMAT_RGB_24)
+		return SHADOW_FORMAT_PACKED_16;
+
+	return SHADOW_FORMAT_SWAPPED;
+}
+
+/*
+ * convert num_rows rows of the mapped user buffer, from first_row on, into
+ * shadow_buffer.
+ */
+static void
+fl2000_surface_convert_rows(
+	struct primary_surface* surface,
+	uint32_t format,
+	uint32_t pack_flags,
+	uint32_t first_row,
+	uint32_t num_rows)
+{
+	uint32_t const offset = first_row * surface->pitch;
+	uint32_t const length = num_rows * surface->pitch;
+	uint32_t const first_pixel = first_row * surface->width;
+
+	switch (format) {
+	case SHADOW_FORMAT_RAW:
+		memcpy(surface->shadow_buffer + offset,
+			surface->system_buffer + offset,
+			length);
+		break;
+
+	case SHADOW_FORMAT_PACKED_16:
+		pixel_pack_16(surface->shadow_buffer + first_pixel * 2,
+			surface->system_buffer + offset,
+			first_pixel,
+			num_rows * surface->width,
+			surface->width,
+			pack_flags);
+		break;
+
+	default:
+		pixel_swap(surface->shadow_buffer + offset,
+			surface->system_buffer + offset,
+			length);
+		break;
+	}
+}
+
+/*
+ * mark the bands of the surface touched by num_rects rectangles as damaged,
+ * or all of them if num_rects is 0. Rectangles are clipped to the surface.
+ */
+void fl2000_surface_add_damage(
+	struct primary_surface* surface,
+	struct surface_rect * rects,
+	uint32_t num_rects)
+{
+	uint32_t first_row;
+	uint32_t last_row;
+	uint32_t band;
+	uint32_t i;
+
+	if (surface->band_dirty == NULL)
+		return;
+
+	if (num_rects == 0) {
+		for (band = 0; band < surface->num_bands; band++)
+			set_bit(band, surface->band_dirty);
+		return;
+	}
+
+	for (i = 0; i < num_rects; i++) {
+		if (rects[i].width == 0 || rects[i].height == 0 ||
+		    rects[i].x >= surface->width ||
+		    rects[i].y >= surface->height)
+			continue;
+
+		first_row = rects[i].y;
+		last_row = first_row +
+			min(rects[i].height, surface->height - first_row) - 1;
+		for (band = first_row / SURFACE_BAND_ROWS;
+		     band <= last_row / SURFACE_BAND_ROWS; band++)
+			set_bit(band, surface->band_dirty);
+	}
+}
+
+/*
+ * convert the mapped user buffer into shadow_buffer, in the format the
+ * render path currently streams from. Bands of SURFACE_BAND_ROWS rows outside
+ * the damage, or whose content hash did not change since the last update,
+ * are already in shadow_buffer, and are skipped.
+ */
+void fl2000_surface_update_shadow(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface)
+{
+	uint32_t const format = fl2000_surface_shadow_format(dev_ctx, surface);
+	uint32_t const pack_flags = format == SHADOW_FORMAT_PACKED_16 ?
+		fl2000_render_pack_flags(dev_ctx) : 0;
+	bool const reuse = surface->band_hash_valid &&
+		surface->shadow_format == format &&
+		surface->shadow_pack_flags == pack_flags;
+	uint32_t converted = 0;
+	uint32_t skipped = 0;
+	uint32_t first_row;
+	uint32_t num_rows;
+	uint32_t length;
+	uint32_t band;
+	uint64_t hash;
+	bool dirty;
+	unsigned long flags;
+
+	/*
+	 * only surfaces that are converted get a shadow_buffer.
+	 */
+	if (surface->shadow_buffer == NULL) {
+		surface->shadow_buffer = fl2000_surface_get_shadow(dev_ctx,
+			surface->buffer_length, &surface->shadow_size);
+		if (surface->shadow_buffer == NULL) {
+			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+				"no shadow_buffer for surface(%x)?",
+				(unsigned int) surface->handle);
+			surface->shadow_format = SHADOW_FORMAT_NONE;
+			surface->band_hash_valid = false;
+			return;
+		}
+		surface->render_buffer = surface->shadow_buffer;
+	}
+
+	if (surface->band_hash == NULL) {
+		fl2000_surface_convert_rows(
+			surface, format, pack_flags, 0, surface->height);
+		converted = surface->buffer_length;
+	} else {
+		for (band = 0; band < surface->num_bands; band++) {
+			first_row = band * SURFACE_BAND_ROWS;
+			num_rows = min_t(uint32_t, SURFACE_BAND_ROWS,
+				surface->height - first_row);
+			length = num_rows * surface->pitch;
+
+			/*
+			 * bands outside the damage reported by the user app
+			 * are not even hashed.
+			 */
+			dirty = test_and_clear_bit(band, surface->band_dirty);
+			if (reuse && !dirty) {
+				skipped += length;
+				continue;
+			}
+
+			hash = pixel_hash(
+				surface->system_buffer +
+					first_row * surface->pitch,
+				length);
+			if (reuse && hash == surface->band_hash[band]) {
+				skipped += length;
+				continue;
+			}
+
+			surface->band_hash[band] = hash;
+			fl2000_surface_convert_rows(
+				surface, format, pack_flags, first_row, num_rows);
+			converted += length;
+		}
+	}
+	surface->band_hash_valid = surface->band_hash != NULL;
+
+	if (format == SHADOW_FORMAT_PACKED_16)
+		surface->shadow_length = surface->width * surface->height * 2;
+	else
+		surface->shadow_length = surface->buffer_length;
+	surface->shadow_format = format;
+	surface->shadow_pack_flags = pack_flags;
+
+	spin_lock_irqsave(&dev_ctx->count_lock, flags);
+	dev_ctx->render.band_bytes_converted += converted;
+	dev_ctx->render.band_bytes_skipped += skipped;
+	if (converted == 0)
+		dev_ctx->render.unchanged_frame_count++;
+	spin_unlock_irqrestore(&dev_ctx->count_lock, flags);
+}
+
+/*
+ * the surface created with handle, NULL if there is none. The caller holds
+ * surface_list_lock.
+ */
+struct primary_surface* fl2000_surface_find_locked(
 	struct dev_ctx * dev_ctx,
-	struct surface_info * info)
+	uint64_t handle)
 {
 	struct primary_surface* s;
+
+	list_for_each_entry(s, &dev_ctx->render.surface_list, list_entry) {
+		if (s->handle == handle)
+			return s;
+	}
+	return NULL;
+}
+
+struct primary_surface* fl2000_surface_find(
+	struct dev_ctx * dev_ctx,
+	uint64_t handle)
+{
+	struct primary_surface* surface;
+
+	spin_lock_bh(&dev_ctx->render.surface_list_lock);
+	surface = fl2000_surface_find_locked(dev_ctx, handle);
+	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
+
+	return surface;
+}
+
+/*
+ * create a surface and put it on surface_list. flip_ring is set before the
+ * surface can be found there, so it is never seen without it. Returns the
+ * surface, or an ERR_PTR.
+ */
+struct primary_surface* fl2000_surface_create(
+	struct dev_ctx * dev_ctx,
+	struct surface_info * info,
+	bool flip_ring)
+{
 	struct primary_surface* surface;
 	int ret = 0;
 	unsigned long flags;
@@ -324,18 +967,37 @@ int fl2000_surface_create(
 	}
 
 	/*
-	 * check if we have duplicated surface
+	 * zero-copy streaming DMAs straight from the user pages, so the pages
+	 * must stay pinned after the update, and the pixels must already be
+	 * in 24bpp wire order.
 	 */
-	surface = NULL;
-	spin_lock_bh(&dev_ctx->render.surface_list_lock);
-	list_for_each_entry(s, &dev_ctx->render.surface_list, list_entry) {
-		if (s->handle == info->handle) {
-			surface = s;
-			break;
+	if (info->flags & SURFACE_FLAG_ZERO_COPY) {
+		if (info->type == SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE ||
+		    info->color_format != COLOR_FORMAT_RGB_24) {
+			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+				"zero copy not supported on type(%u)/color_format(%u)?",
+				info->type, info->color_format);
+			ret = -EINVAL;
+			goto exit;
 		}
 	}
-	spin_unlock_bh(&dev_ctx->render.surface_list_lock);
 
+	/*
+	 * there is no cpu mapping of a dma-buf, so its pixels must already be
+	 * in wire order.
+	 */
+	if (info->type == SURFACE_TYPE_DMA_BUF &&
+	    !(info->flags & SURFACE_FLAG_ZERO_COPY)) {
+		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
+			"dma-buf surface without SURFACE_FLAG_ZERO_COPY?");
+		ret = -EINVAL;
+		goto exit;
+	}
+
+	/*
+	 * check if we have duplicated surface
+	 */
+	surface = fl2000_surface_find(dev_ctx, info->handle);
 	if (surface != NULL) {
 		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "duplicated surface(%x)?",
 			(unsigned int) surface->handle);
@@ -359,16 +1021,33 @@ int fl2000_surface_create(
 	surface->pitch		= info->pitch;
 	surface->color_format	= info->color_format;
 	surface->type		= info->type;
+	surface->flags		= info->flags;
 	surface->start_offset	= info->user_buffer & ~PAGE_MASK;
+	surface->flip_ring	= flip_ring;
 
 	/*
-	 * always create shadow buffer no matter no matter the type is.
+	 * change tracking of the shadow_buffer, by bands of SURFACE_BAND_ROWS
+	 * rows. Without it, every update converts the whole surface.
+	 * zero-copy surfaces never have a shadow_buffer.
 	 */
-	surface->shadow_buffer = vmalloc(surface->buffer_length);
-	if (surface->shadow_buffer == NULL) {
-		dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP, "vmalloc failed?");
-		kfree(surface);
-		goto exit;
+	if (!(surface->flags & SURFACE_FLAG_ZERO_COPY)) {
+		surface->num_bands =
+			DIV_ROUND_UP(surface->height, SURFACE_BAND_ROWS);
+		surface->band_hash = kcalloc(surface->num_bands,
+			sizeof(uint64_t), GFP_KERNEL);
+		surface->band_dirty = kcalloc(
+			BITS_TO_LONGS(surface->num_bands),
+			sizeof(unsigned long), GFP_KERNEL);
+	}
+	if (!(surface->flags & SURFACE_FLAG_ZERO_COPY) &&
+	    (surface->band_hash == NULL || surface->band_dirty == NULL)) {
+		dbg_msg(TRACE_LEVEL_WARNING, DBG_PNP,
+			"no band tracking for surface(%x)",
+			(unsigned int) surface->handle);
+		kfree(surface->band_hash);
+		kfree(surface->band_dirty);
+		surface->band_hash = NULL;
+		surface->band_dirty = NULL;
 	}
 
 	switch (info->type) {
@@ -380,8 +1059,7 @@ int fl2000_surface_create(
 				dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 					"fl2000_surface_pin_down(%x) failed?",
 					(unsigned int) surface->handle);
-				kfree(surface);
-				goto exit;
+				goto free_surface;
 			}
 
 			ret = fl2000_surface_map(dev_ctx, surface);
@@ -390,22 +1068,20 @@ int fl2000_surface_create(
 					"fl2000_surface_map(%x) failed?",
 					(unsigned int) surface->handle);
 				fl2000_surface_unpin(dev_ctx, surface);
-				kfree(surface);
-				goto exit;
+				goto free_surface;
 			}
 
 			/*
-			 * if pixel_reordering is active, we always use shadow buffer
-			 * where the shadow_buffer contains the re-ordered pixels
+			 * if pixel_reordering is active, the re-ordered pixels
+			 * go to shadow_buffer, once the surface is updated.
+			 * zero-copy surfaces are already re-ordered by the user app.
 			 */
-			surface->render_buffer = surface->shadow_buffer;
-		} else {
-			surface->render_buffer = surface->shadow_buffer;
+			if (surface->flags & SURFACE_FLAG_ZERO_COPY)
+				surface->render_buffer = surface->system_buffer;
 		}
 		break;
 
 	case SURFACE_TYPE_VIRTUAL_FRAGMENTED_VOLATILE:
-		surface->render_buffer = surface->shadow_buffer;
 		break;
 
 	case SURFACE_TYPE_VIRTUAL_CONTIGUOUS:
@@ -415,8 +1091,7 @@ int fl2000_surface_create(
 			dbg_msg(TRACE_LEVEL_ERROR, DBG_PNP,
 				"fl2000_surface_pin_down(%x) failed?",
 				(unsigned int) surface->handle);
-			kfree(surface);
-			goto exit;
+			goto free_surface;
 		}
 
 		ret = fl2000_surface_map(dev_ctx, surface);
@@ -425,17 +1100,34 @@ int fl2000_surface_create(
 				"fl2000_surface_map(%x) failed?",
 				(unsigned int) surface->handle);
 			fl2000_surface_unpin(dev_ctx, surface);
-			kfree(surface);
-			goto exit;
+			goto free_surface;
 		}
 
-		surface->render_buffer = surface->shadow_buffer;
+		if (surface->flags & SURFACE_FLAG_ZERO_COPY)
+			surface->render_buffer = surface->system_buffer;
+		break;
+
+	case SURFACE_TYPE_DMA_BUF:
+		ret = fl2000_dma_buf_import(dev_ctx, surface);
+		if (ret < 0) {
+			goto free_surface;
+		}
 		break;
 
 	default:
 		break;
 	}
 
+	if ((surface->flags & SURFACE_FLAG_ZERO_COPY) &&
+	    surface->type != SURFACE_TYPE_DMA_BUF) {
+		ret = fl2000_surface_build_sg(dev_ctx, surface);
+		if (ret < 0) {
+			fl2000_surface_unmap(dev_ctx, surface);
+			fl2000_surface_unpin(dev_ctx, surface);
+			goto free_surface;
+		}
+	}
+
 	spin_lock_bh(&dev_ctx->render.surface_list_lock);
 	list_add_tail(&surface->list_entry, &dev_ctx->render.surface_list);
 
@@ -462,9 +1154,14 @@ int fl2000_surface_create(
 		surface->system_buffer,
 		surface->shadow_buffer,
 		dev_ctx->render.surface_list_count);
+	goto exit;
 
+free_surface:
+	kfree(surface->band_hash);
+	kfree(surface->band_dirty);
+	kfree(surface);
 exit:
-	return ret;
+	return ret < 0 ? ERR_PTR(ret) : surface;
 }
 
 void fl2000_surface_destroy(
@@ -485,12 +1182,27 @@ void fl2000_surface_destroy(
 		surface->render_buffer,
 		dev_ctx->render.surface_list_count);
 
+	/*
+	 * zero-copy surfaces might still be on the bus.
+	 */
+	fl2000_render_release_surface(dev_ctx, surface);
+	fl2000_surface_release_pin_cache(dev_ctx, surface);
 	fl2000_surface_unmap(dev_ctx, surface);
 	fl2000_surface_unpin(dev_ctx, surface);
+	fl2000_dma_buf_release(dev_ctx, surface);
+#ifdef FL2000_PIN_CACHE
+	if (surface->pin_notifier_active)
+		mmu_interval_notifier_remove(&surface->pin_notifier);
+#endif
 	if (surface->shadow_buffer) {
-		vfree(surface->shadow_buffer);
+		fl2000_surface_put_shadow(dev_ctx,
+			surface->shadow_buffer, surface->shadow_size);
 		surface->shadow_buffer = NULL;
 	}
+	kfree(surface->band_hash);
+	kfree(surface->band_dirty);
+	vfree(surface->comp_cache);
+	sg_free_table(&surface->sg_table);
 
 	kfree(surface);
 }
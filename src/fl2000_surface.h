@@ -26,13 +26,51 @@ void fl2000_surface_unmap(
 	struct dev_ctx * dev_ctx,
 	struct primary_surface* surface);
 
-int fl2000_surface_create(
+int fl2000_surface_pin_volatile(
 	struct dev_ctx * dev_ctx,
-	struct surface_info * info);
+	struct primary_surface* surface);
+
+void fl2000_surface_unpin_volatile(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+void fl2000_surface_release_pin_cache(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+size_t fl2000_surface_metadata_size(struct primary_surface* surface);
+
+uint32_t fl2000_surface_shadow_format(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+void fl2000_surface_add_damage(
+	struct primary_surface* surface,
+	struct surface_rect * rects,
+	uint32_t num_rects);
+
+void fl2000_surface_update_shadow(
+	struct dev_ctx * dev_ctx,
+	struct primary_surface* surface);
+
+struct primary_surface* fl2000_surface_find_locked(
+	struct dev_ctx * dev_ctx,
+	uint64_t handle);
+
+struct primary_surface* fl2000_surface_find(
+	struct dev_ctx * dev_ctx,
+	uint64_t handle);
+
+struct primary_surface* fl2000_surface_create(
+	struct dev_ctx * dev_ctx,
+	struct surface_info * info,
+	bool flip_ring);
 
 void fl2000_surface_destroy(
 	struct dev_ctx * dev_ctx,
 	struct primary_surface* surface);
 
 void fl2000_surface_destroy_all(struct dev_ctx * dev_ctx);
+
+void fl2000_surface_free_shadow_pool(struct dev_ctx * dev_ctx);
 #endif
\ No newline at end of file
@@ -0,0 +1,639 @@
+// fl2000_ref_reference.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Reference gravity compression, for equivalence tests.
+//
+// This is the per pixel gravity loop the driver had before the run detection
+// was specialized per pixel size, renamed fl2000_ref_*. Only the two count
+// writer bugs found by the fuzz target are fixed here too, as in the driver:
+// fl2000_ref_save_repeated_count2 returns its target pointer, and the chunk
+// loops run while any count is left.
+//
+
+#include "fl2000_shim.h"
+
+#undef dbg_msg
+#define dbg_msg(level, flags, msg, ...)
+
+static __inline
+uint32_t fl2000_ref_get_pixel(
+	uint8_t * source,
+	uint32_t byte_per_pixel
+	)
+{
+	uint32_t pixelData = 0;
+
+	switch (byte_per_pixel) {
+	case PIXEL_BYTE_1:
+		pixelData = source[0] ;
+		break;
+	case PIXEL_BYTE_2:
+		pixelData = (source[1] << 8) | source[0] ;
+		break;
+	case PIXEL_BYTE_3:
+		pixelData = (source[2] << 16) | (source[1] << 8) | source[0];
+		break;
+	default:
+		break;
+	}
+	return (pixelData);
+}
+
+static __inline
+void fl2000_ref_save_repeated_data(
+	uint8_t * target,
+	uint8_t * source,
+	uint32_t bytes_per_pixel
+	)
+{
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
+
+	switch (bytes_per_pixel) {
+	case PIXEL_BYTE_1:
+		target[0] =  (source[ 0 ] >> 1);
+		target[0] |= 0x80;
+		break;
+
+	case PIXEL_BYTE_2:
+		// No need to shift because it's RGB 555 format.
+		//
+		target[0] =  source[0];
+		target[1] =  source[1];
+		target[1] |= 0x80;
+		break;
+
+	case PIXEL_BYTE_3:
+		target[0] = source[0];
+		target[1] = source[1];
+		target[2] = (source[ 2 ] >> 1);
+		target[2] |= 0x80;
+		break;
+
+	default:
+		break;
+	}
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+}
+
+static __inline void
+fl2000_ref_save_repeated_count(
+	uint8_t** target_ptr,
+	uint8_t* repeat_data,
+	uint32_t bytes_per_pixel,
+	uint32_t repeat_count)
+{
+	uint32_t repeat_chunk_size;
+	uint8_t* target = *target_ptr;
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
+
+	switch (bytes_per_pixel) {
+	case PIXEL_BYTE_1:
+		do {
+			if (repeat_count > 0x7F)
+				repeat_chunk_size = 0x7F;
+			else
+				repeat_chunk_size = repeat_count;
+
+			target[0] = (uint8_t) repeat_chunk_size;
+			target += PIXEL_BYTE_1;
+
+			repeat_count -= repeat_chunk_size;
+
+			if (repeat_count > 0) {
+				target[0] = (repeat_data[0] >> 1);
+				target[0] |= 0x80;
+				target += PIXEL_BYTE_1;
+				repeat_count -= 1;
+			}
+		} while (repeat_count > 0);
+		break;
+
+	case PIXEL_BYTE_2:
+		do {
+			if ( repeat_count > 0x7FFF )
+				repeat_chunk_size = 0x7FFF;
+			else
+				repeat_chunk_size = repeat_count;
+
+			target[0] = (uint8_t)(repeat_chunk_size);
+			target[1] = (uint8_t)((repeat_chunk_size & 0x7FFF) >> 8);
+			target += PIXEL_BYTE_2;
+
+			repeat_count -= repeat_chunk_size;
+
+			if (repeat_count > 0) {
+				// No need to shift because it's RGB 555 format.
+				//
+				target[0] = repeat_data[0];
+				target[1] = repeat_data[1];
+				target[1] |= 0x80;
+				target += PIXEL_BYTE_2;
+				repeat_count -= 1;
+			}
+		} while ( repeat_count > 0 );
+		break;
+
+	case PIXEL_BYTE_3:
+		do {
+			if (repeat_count > 0x7FFFFF)
+				repeat_chunk_size = 0x7FFFFF;
+			else
+				repeat_chunk_size = repeat_count;
+
+			target[0] = ((uint8_t)(repeat_chunk_size >> 0 )) & 0xFF;
+			target[1] = ((uint8_t)(repeat_chunk_size >> 8 )) & 0xFF;
+			target[2] = ((uint8_t)(repeat_chunk_size >> 16)) & 0xFF;
+			target += PIXEL_BYTE_3;
+
+			repeat_count -= repeat_chunk_size;
+
+			if (repeat_count > 0) {
+				target[0] = repeat_data[0];
+				target[1] = repeat_data[1];
+				target[2] = repeat_data[2] >> 1;
+				target[2] |= 0x80;
+				target += PIXEL_BYTE_3;
+				repeat_count -= 1;
+			}
+		} while (repeat_count > 0);
+		break;
+
+	default:
+		break;
+	}
+
+	*target_ptr = target;
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+}
+
+
+size_t fl2000_ref_gravity_low(
+	struct dev_ctx * dev_ctx,
+	struct render_ctx * render_ctx,		// NOT USED
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t num_of_pixels,
+	uint32_t bytes_per_pixel,
+	bool NoCompressionToFirst1K)
+{
+	uint32_t i;
+	uint32_t looselyColorMaskRGB;
+	int32_t repeatCount;
+	uint32_t markPixel;
+	uint32_t currentPixel;
+	uint32_t previousPixel;
+	uint8_t * repeatDataPointer;
+	uint8_t * targetOriginalPointer;
+	uint8_t * sourceOriginalPointer;
+	uint32_t isochSourcePacketIndex;
+	uint8_t *  isochNextBoundry;
+	bool isochCompression;
+	uint32_t currentPixelWithMask;
+	uint32_t markPixelWithMask;
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
+
+	targetOriginalPointer = target;
+	sourceOriginalPointer = source;
+	repeatDataPointer = source;
+
+	markPixel = 0;
+	previousPixel = 0;
+	repeatCount = 0;
+
+	isochSourcePacketIndex = 0;
+	isochNextBoundry = source;
+	isochCompression = false;
+
+	looselyColorMaskRGB = fl2000_comp_get_current_mask_value(dev_ctx);
+
+	// Check if the start pixel exceeds the boundary of compression by
+	// Precise-Isoch compress mode.
+	// Mark the first isochNextBoundry.
+	if (isochCompression) {
+		// TODO:
+		//
+	}
+	else {
+		/*
+		 * Bulk transfer doesn't need to consider packet boundry, and
+		 * set the value to the end of transfer.
+		 */
+		isochNextBoundry = source + data_buffer_length;
+	}
+
+
+	for (i = 0; i < num_of_pixels; i++) {
+		currentPixel = fl2000_ref_get_pixel(source, bytes_per_pixel);
+
+		currentPixelWithMask = (currentPixel | looselyColorMaskRGB);
+		markPixelWithMask = (markPixel | looselyColorMaskRGB);
+
+		if (repeatCount > 0) {
+			/* It's loosely comparsion, if current pixel after the
+			 * mask that looks like repeatDataPointer pixel, then we
+			 * treat it as the same group of current compression
+			 * run.
+			 */
+			if (currentPixelWithMask == markPixelWithMask) {
+				bool notExactlyTheSameAsMarkPixel;
+				bool exactlyTheSameAsPreviousPixel;
+
+				if ( markPixel != currentPixel )
+					notExactlyTheSameAsMarkPixel = true;
+				else
+					notExactlyTheSameAsMarkPixel = false;
+
+				previousPixel = fl2000_ref_get_pixel(
+					source - bytes_per_pixel,
+					bytes_per_pixel);
+
+				if  (previousPixel == currentPixel)
+					exactlyTheSameAsPreviousPixel = true;
+				else
+					exactlyTheSameAsPreviousPixel = false;
+
+				// This algorithem check two condtions to
+				// prevent worse color trailing issue.
+				// If we match these two conditions, we have to
+				// start a new compression run.
+				//
+				// 1. Current pixel is *not the same* as
+				//    repeatDataPointer pixel.
+				// 2. Current pixel is *the same* as previous
+				//    pixel.
+				//
+				if (notExactlyTheSameAsMarkPixel &&
+				    exactlyTheSameAsPreviousPixel) {
+					// Start over a new compression run.
+					//
+					if (repeatCount > 1) {
+						// A real compression run.
+						// And we send device the number
+						// of additional copies - not the
+						// length
+						//
+						repeatCount--;
+						fl2000_ref_save_repeated_count(
+							&target,
+							repeatDataPointer,
+							bytes_per_pixel,
+							repeatCount);
+					}
+					repeatCount = 0;
+				}
+				else if (source >= isochNextBoundry) {
+					if (repeatCount > 1) {
+						repeatCount--;
+						fl2000_ref_save_repeated_count(
+							&target,
+							repeatDataPointer,
+							bytes_per_pixel,
+							repeatCount);
+					}
+					repeatCount = 0;
+				}
+				else {
+					// After the mask, this pixel is same as
+					// previous one.
+					//
+					repeatCount++;
+					source += bytes_per_pixel;
+				}
+			}
+			else {
+				// Start over a new compression run.
+				//
+				if (repeatCount > 1) {
+				// A real compression run.
+				// And we send device the number of additional copies - not the length
+				//
+				repeatCount--;
+				fl2000_ref_save_repeated_count(
+					&target,
+					repeatDataPointer,
+					bytes_per_pixel,
+					repeatCount);
+				}
+				repeatCount = 0;
+			}
+		}
+
+		if ( repeatCount == 0 ) {
+			fl2000_ref_save_repeated_data(
+				target, source, bytes_per_pixel);
+			markPixel = fl2000_ref_get_pixel(
+				source, bytes_per_pixel);
+			repeatDataPointer = source;
+
+			target += bytes_per_pixel;
+			source += bytes_per_pixel;
+
+			if (isochCompression) {
+				ASSERT(false);
+			}
+
+			repeatCount++;
+		}
+	}
+
+	// When we exit, we could be in the middle of a run. If so we need to do
+	// a special termination.
+	//
+	if (repeatCount > 1)  {
+		// A real compression run.
+		// And we send device the number of additional copies - not the length
+		//
+		repeatCount--;
+
+		if (repeatCount > 1) {
+			fl2000_ref_save_repeated_count(
+				&target,
+				repeatDataPointer,
+				bytes_per_pixel,
+				repeatCount - 1 );
+		}
+
+		// Hardware bug: The end of compressed data must be single pixel.
+		//
+		fl2000_ref_save_repeated_data(
+			target, repeatDataPointer, bytes_per_pixel);
+		target += bytes_per_pixel;
+	}
+
+	if (dev_ctx->vr_params.use_compression)
+		data_buffer_length = target - targetOriginalPointer;
+
+	if (isochCompression) {
+		ASSERT(false);
+	}
+	else {
+		// Make sure compressed data buffer length is aligned.
+		//
+		fl2000_comp_padding_alignment(
+			dev_ctx,
+			target,
+			&data_buffer_length);
+		// target is invalid here.
+		//
+	}
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+
+	return (data_buffer_length);
+}
+
+static __inline
+void fl2000_ref_save_repeated_data2(
+	uint8_t * target,
+	uint8_t * source)
+{
+	uint8_t r, g, b;
+
+	// Optimized function to process pixel fromat transform and compression
+	// together.
+	//
+	r = source[2] >> 3;
+	g = source[1] >> 3;
+	b = source[0] >> 3;
+
+	target[1] = 0x80 | (r << 2) | (g >> 3);
+	target[0] = ((g & 0x07) << 5 ) | b;
+}
+
+static __inline void
+fl2000_ref_save_repeated_count2(
+	uint8_t ** target_ptr,
+	uint8_t *  repeat_data,
+	uint32_t   bytes_per_pixel,
+	uint32_t   repeat_count)
+{
+	uint32_t repeat_chunk_size;
+	uint8_t r, g, b;
+	uint8_t * target = *target_ptr;
+
+	do  {
+		if (repeat_count > 0x7FFF)
+			repeat_chunk_size = 0x7FFF;
+		else
+			repeat_chunk_size = repeat_count;
+
+		target[0] = (uint8_t)(repeat_chunk_size);
+		target[1] = (uint8_t)((repeat_chunk_size & 0x7FFF) >> 8);
+		target += PIXEL_BYTE_2;
+		repeat_count -= repeat_chunk_size;
+
+		if (repeat_count > 0) {
+			r = repeat_data[2] >> 3;
+			g = repeat_data[1] >> 3;
+			b = repeat_data[0] >> 3;
+
+			target[1] = 0x80 | (r << 2) | (g >> 3);
+			target[0] = ((g & 0x07) << 5) | b;
+			target += PIXEL_BYTE_2;
+
+			repeat_count -= 1;
+		}
+	} while ( repeat_count > 0 );
+
+	*target_ptr = target;
+}
+
+size_t
+fl2000_ref_gravity_low2(
+	struct dev_ctx * dev_ctx,
+	struct render_ctx * render_ctx,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint32_t SourcePixelBytes,
+	uint8_t * target,
+	uint32_t TargetPixelBytes,
+	uint32_t num_of_pixels,
+	bool NoCompressionToFirst1K)
+{
+	uint32_t i;
+	uint32_t looselyColorMaskRGB;
+	uint32_t repeatCount;
+	uint32_t markPixel;
+	uint32_t currentPixel;
+	uint32_t previousPixel;
+	uint8_t * repeatDataPointer;
+	uint8_t * targetOriginalPointer;
+	uint8_t * sourceOriginalPointer;
+	uint32_t currentPixelWithMask;
+	uint32_t markPixelWithMask;
+	uint8_t * sourceBoundary;
+
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, ">>>>");
+
+	ASSERT(SourcePixelBytes == PIXEL_BYTE_3 &&
+	       TargetPixelBytes == PIXEL_BYTE_2);
+
+	targetOriginalPointer = target;
+	sourceOriginalPointer = source;
+	repeatDataPointer = source;
+
+	markPixel = 0;
+	previousPixel = 0;
+	repeatCount = 0;
+
+	looselyColorMaskRGB = fl2000_comp_get_current_mask_value(dev_ctx);
+
+	// source only care about RGB555.
+	//
+	looselyColorMaskRGB |= 0x00070707;
+
+	sourceBoundary = source + data_buffer_length;
+
+	for ( i = 0; i < num_of_pixels; i++ ) {
+		currentPixel = fl2000_ref_get_pixel(source, SourcePixelBytes);
+		currentPixelWithMask = (currentPixel | looselyColorMaskRGB);
+		markPixelWithMask = (markPixel | looselyColorMaskRGB);
+		if (repeatCount > 0) {
+			// It's loosely comparsion, if current pixel after the
+			// mask that looks like repeatDataPointer pixel, then we
+			// treat it as the same group of current compression
+			// run.
+			//
+			if (currentPixelWithMask == markPixelWithMask) {
+				bool notExactlyTheSameAsMarkPixel;
+				bool exactlyTheSameAsPreviousPixel;
+
+				if (markPixel != currentPixel)
+					notExactlyTheSameAsMarkPixel = true;
+				else
+					notExactlyTheSameAsMarkPixel = false;
+
+				previousPixel = fl2000_ref_get_pixel(
+					source - SourcePixelBytes, SourcePixelBytes);
+
+				if (previousPixel == currentPixel)
+					exactlyTheSameAsPreviousPixel = true;
+				else
+					exactlyTheSameAsPreviousPixel = false;
+
+				// This algorithem check two condtions to prevent worse
+				// color trailing issue.
+				// If we match these two conditions, we have to start a
+				// new compression run.
+				//
+				// 1. Current pixel is *not the same* as repeatDataPointer
+				//    pixel.
+				// 2. Current pixel is *the same* as previous pixel.
+				//
+				if (notExactlyTheSameAsMarkPixel &&
+				    exactlyTheSameAsPreviousPixel) {
+					// Start over a new compression run.
+					//
+					if (repeatCount > 1) {
+						// A real compression run.
+						// And we send device the number of
+						// additional copies - not the length
+						//
+						repeatCount--;
+						fl2000_ref_save_repeated_count2(
+							&target,
+							repeatDataPointer,
+							TargetPixelBytes,
+							repeatCount);
+					}
+					repeatCount = 0;
+				}
+				else if (source >= sourceBoundary) {
+					// USE_COMPRESSION_SKIP_FIRSTPIXEL_WORKAROUND
+					// will hit the case.
+					//
+					if (repeatCount > 1) {
+						repeatCount--;
+						fl2000_ref_save_repeated_count2(
+							&target,
+							repeatDataPointer,
+							TargetPixelBytes,
+							repeatCount);
+					}
+					repeatCount = 0;
+				}
+				else {
+					// After the mask, this pixel is same as
+					// previous one.
+					//
+					repeatCount++;
+					source += SourcePixelBytes;
+				}
+			}
+			else  {
+			// Start over a new compression run.
+			//
+				if (repeatCount > 1) {
+					// A real compression run.
+					// And we send device the number of additional
+					// copies - not the length
+					//
+					repeatCount--;
+					fl2000_ref_save_repeated_count2(
+						&target,
+						repeatDataPointer,
+						TargetPixelBytes,
+						repeatCount);
+				}
+				repeatCount = 0;
+			}
+		}
+
+		if (repeatCount == 0) {
+			fl2000_ref_save_repeated_data2(target, source);
+
+			markPixel = fl2000_ref_get_pixel(
+				source, SourcePixelBytes);
+			repeatDataPointer = source;
+
+			target += TargetPixelBytes;
+			source += SourcePixelBytes;
+
+			repeatCount++;
+		}
+	}
+
+	// When we exit, we could be in the middle of a run. If so we need to do a special termination.
+	//
+	if (repeatCount > 1) {
+		// A real compression run.
+		// And we send device the number of additional copies - not the length
+		//
+		repeatCount--;
+
+		if (repeatCount > 1)
+			fl2000_ref_save_repeated_count2(
+				&target,
+				repeatDataPointer,
+				TargetPixelBytes,
+				repeatCount - 1);
+
+		// Hardware bug: The end of compressed data must be single pixel.
+		//
+		fl2000_ref_save_repeated_data2( target, repeatDataPointer );
+		target += TargetPixelBytes;
+	}
+
+	data_buffer_length = (target - targetOriginalPointer);
+
+	// Make sure compressed data buffer length is aligned.
+	//
+	fl2000_comp_padding_alignment(dev_ctx, target, &data_buffer_length);
+
+	// target is invalid here.
+	//
+	dbg_msg(TRACE_LEVEL_VERBOSE, DBG_COMPRESSION, "<<<<");
+
+	return (data_buffer_length);
+}
+
+
+// eof: fl2000_ref_reference.c
+//
@@ -0,0 +1,391 @@
+// fl2000_fuzz.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Gravity compression fuzz target.
+//
+// The input is a format byte, a mask index byte, then runs of one source
+// pixel followed by a repeat byte. Repeat bytes from 0xE0 up pick the run
+// lengths around the count field limits, so that short inputs still reach
+// them. Built into fl2000_test, or with -DFL2000_LIBFUZZER as a libFuzzer
+// target.
+//
+
+#include "fl2000_test.h"
+
+/*
+ * run lengths around the 0x7F, 0x7FFF and 0x7FFFFF count limits, and around
+ * the 8 pixel steps of the exact run scan.
+ */
+static const uint32_t fuzz_run_lengths[32] = {
+	7, 8, 9, 15, 16, 17, 24, 25,
+	0x7E, 0x7F, 0x80, 0x81, 0xFE, 0xFF, 0x100, 0x101,
+	0x7FFE, 0x7FFF, 0x8000, 0x8001, 0xFFFE, 0xFFFF, 0x10000, 0x10001,
+	0x17FFF, 0x18000, 0x3FFFF, 0x40000, 0x7FFFFE, 0x7FFFFF, 0x800000, 1,
+};
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+static uint32_t
+fuzz_run_length(uint8_t repeat)
+{
+	if (repeat < 0xE0)
+		return repeat + 1U;
+	return fuzz_run_lengths[repeat - 0xE0];
+}
+
+/*
+ * a pixel or count word, little endian.
+ */
+static uint32_t
+fuzz_pixel_value(const uint8_t * pixel, uint32_t pixel_bytes)
+{
+	uint32_t value = 0;
+	uint32_t i;
+
+	for (i = 0; i < pixel_bytes; i++)
+		value |= (uint32_t) pixel[i] << (i * 8);
+	return value;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+uint32_t test_source_bytes(uint32_t format)
+{
+	switch (format) {
+	case TEST_FORMAT_RGB_8:
+		return PIXEL_BYTE_1;
+	case TEST_FORMAT_RGB_16:
+		return PIXEL_BYTE_2;
+	default:
+		return PIXEL_BYTE_3;
+	}
+}
+
+uint32_t test_target_bytes(uint32_t format)
+{
+	if (format == TEST_FORMAT_PACK_555)
+		return PIXEL_BYTE_2;
+	return test_source_bytes(format);
+}
+
+/*
+ * build a frame from (pixel, repeat byte) runs, at most TEST_MAX_PIXELS.
+ */
+uint8_t * test_expand_frame(
+	const uint8_t * data,
+	size_t size,
+	uint32_t format,
+	uint32_t * num_of_pixels)
+{
+	uint32_t const pixel_bytes = test_source_bytes(format);
+	uint32_t const record = pixel_bytes + 1;
+	uint32_t total = 0;
+	uint32_t run;
+	uint32_t i;
+	size_t offset;
+	uint8_t * frame;
+	uint8_t * dst;
+
+	for (offset = 0; offset + record <= size; offset += record) {
+		run = fuzz_run_length(data[offset + pixel_bytes]);
+		if (run > TEST_MAX_PIXELS - total)
+			break;
+		total += run;
+	}
+
+	frame = malloc((size_t) total * pixel_bytes + 1);
+	if (frame == NULL)
+		return NULL;
+
+	dst = frame;
+	for (offset = 0; offset + record <= size; offset += record) {
+		run = fuzz_run_length(data[offset + pixel_bytes]);
+		if (dst + (size_t) run * pixel_bytes >
+		    frame + (size_t) total * pixel_bytes)
+			break;
+		for (i = 0; i < run; i++) {
+			memcpy(dst, data + offset, pixel_bytes);
+			dst += pixel_bytes;
+		}
+	}
+
+	*num_of_pixels = total;
+	return frame;
+}
+
+/*
+ * target buffer of length bytes, followed by guard bytes.
+ */
+uint8_t * test_alloc_target(size_t length)
+{
+	uint8_t * target = malloc(length + TEST_GUARD_BYTES);
+
+	if (target != NULL)
+		memset(target, TEST_GUARD_PATTERN, length + TEST_GUARD_BYTES);
+	return target;
+}
+
+bool test_guard_ok(const uint8_t * target, size_t length)
+{
+	uint32_t i;
+
+	for (i = 0; i < TEST_GUARD_BYTES; i++) {
+		if (target[length + i] != TEST_GUARD_PATTERN)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * decode a gravity stream of pixel_bytes wide words. A word with its top
+ * bit set is a pixel, the others repeat the last pixel that many more
+ * times. Returns the compressed bytes used for num_of_pixels pixels, or 0
+ * if the stream does not decode to exactly that.
+ */
+size_t test_decode(
+	const uint8_t * source,
+	size_t length,
+	uint8_t * target,
+	uint32_t pixel_bytes,
+	uint32_t num_of_pixels)
+{
+	uint32_t const top_bit = 1U << (pixel_bytes * 8 - 1);
+	const uint8_t * const start = source;
+	const uint8_t * const end = source + length;
+	uint8_t * repeat_data = NULL;
+	uint32_t decoded = 0;
+	uint32_t word;
+
+	while (decoded < num_of_pixels) {
+		if (source + pixel_bytes > end)
+			return 0;
+
+		word = fuzz_pixel_value(source, pixel_bytes);
+		source += pixel_bytes;
+
+		if (word & top_bit) {
+			word &= ~top_bit;
+			memcpy(target, &word, pixel_bytes);
+			repeat_data = target;
+			target += pixel_bytes;
+			decoded++;
+			continue;
+		}
+
+		if (repeat_data == NULL || word == 0 ||
+		    word > num_of_pixels - decoded)
+			return 0;
+		while (word--) {
+			memcpy(target, repeat_data, pixel_bytes);
+			target += pixel_bytes;
+			decoded++;
+		}
+	}
+	return source - start;
+}
+
+/*
+ * a source pixel as it decodes with the exact mask.
+ */
+void test_expected_pixel(
+	uint8_t * pixel,
+	const uint8_t * source,
+	uint32_t format)
+{
+	switch (format) {
+	case TEST_FORMAT_RGB_8:
+		pixel[0] = source[0] >> 1;
+		break;
+
+	case TEST_FORMAT_RGB_16:
+		pixel[0] = source[0];
+		pixel[1] = source[1] & 0x7F;
+		break;
+
+	case TEST_FORMAT_RGB_24:
+		pixel[0] = source[0];
+		pixel[1] = source[1];
+		pixel[2] = source[2] >> 1;
+		break;
+
+	default:
+		pixel[1] = ((source[2] >> 3) << 2) | (source[1] >> 6);
+		pixel[0] = (((source[1] >> 3) & 0x07) << 5) | (source[0] >> 3);
+		break;
+	}
+}
+
+/*
+ * check a compressed frame: it decodes to exactly num_of_pixels pixels,
+ * followed by at most 3 bytes of padding, and with the exact mask each
+ * pixel comes back as it went in. 16bpp streams must also decode the same
+ * with the driver's own decompressor.
+ */
+bool test_check_stream(
+	const uint8_t * source,
+	uint32_t num_of_pixels,
+	uint32_t format,
+	uint32_t mask_index,
+	uint8_t * compressed,
+	size_t compressed_length)
+{
+	uint32_t const source_bytes = test_source_bytes(format);
+	uint32_t const target_bytes = test_target_bytes(format);
+	size_t const frame_length = (size_t) num_of_pixels * target_bytes;
+	uint8_t * decoded;
+	uint8_t * checked = NULL;
+	uint8_t expected[4];
+	size_t used;
+	size_t i;
+	bool ok = false;
+
+	if (compressed_length % 4 != 0 ||
+	    compressed_length > frame_length + 3) {
+		test_fail("length %zu for %u pixels, format %u",
+			compressed_length, num_of_pixels, format);
+		return false;
+	}
+
+	decoded = malloc(frame_length + target_bytes);
+	if (decoded == NULL)
+		return false;
+
+	used = test_decode(compressed, compressed_length, decoded,
+		target_bytes, num_of_pixels);
+	if (used == 0 && num_of_pixels != 0) {
+		test_fail("stream of %zu bytes does not decode to %u pixels, "
+			"format %u mask %u", compressed_length, num_of_pixels,
+			format, mask_index);
+		goto exit;
+	}
+	if (compressed_length - used > 3) {
+		test_fail("%zu bytes after %u pixels", compressed_length - used,
+			num_of_pixels);
+		goto exit;
+	}
+	for (i = used; i < compressed_length; i++) {
+		if (compressed[i] != 0x80) {
+			test_fail("padding byte 0x%02x", compressed[i]);
+			goto exit;
+		}
+	}
+
+	if (mask_index == COMPRESSION_MASK_INDEX_MINIMUM) {
+		for (i = 0; i < num_of_pixels; i++) {
+			test_expected_pixel(expected, source + i * source_bytes,
+				format);
+			if (memcmp(expected, decoded + i * target_bytes,
+				   target_bytes) != 0) {
+				test_fail("pixel %zu differs, format %u", i,
+					format);
+				goto exit;
+			}
+		}
+	}
+
+	if (target_bytes == PIXEL_BYTE_2) {
+		struct dev_ctx dev_ctx;
+		size_t checked_length;
+
+		fl2000_shim_dev_init(&dev_ctx, 1);
+		checked = malloc(frame_length + PIXEL_BYTE_2);
+		if (checked == NULL)
+			goto exit;
+		checked_length = fl2000_comp_decompress_and_check(&dev_ctx,
+			compressed_length, compressed, checked, PIXEL_BYTE_2,
+			num_of_pixels);
+		if (checked_length < frame_length ||
+		    memcmp(checked, decoded, frame_length) != 0) {
+			test_fail("fl2000_comp_decompress_and_check differs");
+			goto exit;
+		}
+	}
+	ok = true;
+
+exit:
+	free(checked);
+	free(decoded);
+	return ok;
+}
+
+/*
+ * one fuzz input: compress the frame it describes with the driver, and
+ * check the stream.
+ */
+bool fl2000_fuzz_compression(const uint8_t * data, size_t size)
+{
+	struct dev_ctx dev_ctx;
+	uint32_t format;
+	uint32_t mask_index;
+	uint32_t num_of_pixels;
+	uint32_t source_bytes;
+	uint8_t * source;
+	uint8_t * target;
+	size_t target_length;
+	size_t compressed_length;
+	bool ok = false;
+
+	if (size < 2)
+		return true;
+
+	format = data[0] % TEST_NUM_FORMATS;
+	mask_index = data[1] % (COMPRESSION_MASK_INDEX_MAXIMUM + 1);
+	source_bytes = test_source_bytes(format);
+
+	source = test_expand_frame(data + 2, size - 2, format, &num_of_pixels);
+	if (source == NULL)
+		return true;
+
+	target_length = (size_t) num_of_pixels * test_target_bytes(format) + 4;
+	target = test_alloc_target(target_length);
+	if (target == NULL)
+		goto exit;
+
+	fl2000_shim_dev_init(&dev_ctx, 1);
+	dev_ctx.vr_params.compression_mask_index = mask_index;
+
+	if (format == TEST_FORMAT_PACK_555)
+		compressed_length = fl2000_compression_gravity2(&dev_ctx, NULL,
+			(size_t) num_of_pixels * source_bytes, source, target,
+			num_of_pixels);
+	else
+		compressed_length = fl2000_comp_gravity_low(&dev_ctx, NULL,
+			(size_t) num_of_pixels * source_bytes, source, target,
+			num_of_pixels, source_bytes, false);
+
+	if (!test_guard_ok(target, target_length)) {
+		test_fail("target overrun, %u pixels, format %u",
+			num_of_pixels, format);
+		goto exit;
+	}
+
+	ok = test_check_stream(source, num_of_pixels, format, mask_index,
+		target, compressed_length);
+
+exit:
+	free(target);
+	free(source);
+	return ok;
+}
+
+#ifdef FL2000_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+	if (!fl2000_fuzz_compression(data, size))
+		abort();
+	return 0;
+}
+#endif
+
+// eof: fl2000_fuzz.c
+//
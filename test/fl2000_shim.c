@@ -0,0 +1,92 @@
+// fl2000_shim.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Kernel stubs for building the pixel and compression code in user space.
+//
+
+#include "fl2000_shim.h"
+
+uint32_t currentTraceLevel = TRACE_LEVEL_NONE;
+uint32_t currentTraceFlags = 0;
+unsigned int render_compression_share = 90;
+unsigned int render_compression_stripes = 1;
+
+static struct workqueue_struct shim_comp_wq;
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+static void *
+shim_work_thread(void * arg)
+{
+	struct work_struct * const work = arg;
+
+	work->func(work);
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+bool queue_work(struct workqueue_struct * wq, struct work_struct * work)
+{
+	if (work->queued)
+		return false;
+
+	if (pthread_create(&work->thread, NULL, shim_work_thread, work) != 0) {
+		/*
+		 * no thread, run it right here.
+		 */
+		work->func(work);
+		return true;
+	}
+	work->queued = true;
+	return true;
+}
+
+bool flush_work(struct work_struct * work)
+{
+	if (!work->queued)
+		return false;
+
+	pthread_join(work->thread, NULL);
+	work->queued = false;
+	return true;
+}
+
+/*
+ * a 24bpp device at the full compression mask range, with num_stripes
+ * compression stripes.
+ */
+void fl2000_shim_dev_init(struct dev_ctx * dev_ctx, uint32_t num_stripes)
+{
+	uint32_t i;
+
+	memset(dev_ctx, 0, sizeof(*dev_ctx));
+	dev_ctx->vr_params.freq = 60;
+	dev_ctx->vr_params.use_compression = 1;
+	dev_ctx->vr_params.compression_mask_index = COMPRESSION_MASK_INDEX_MINIMUM;
+	dev_ctx->vr_params.compression_mask_index_min = COMPRESSION_MASK_INDEX_MINIMUM;
+	dev_ctx->vr_params.compression_mask_index_max = COMPRESSION_MASK_INDEX_MAXIMUM;
+	dev_ctx->vr_params.input_bytes_per_pixel = PIXEL_BYTE_3;
+	dev_ctx->vr_params.output_image_type = OUTPUT_IMAGE_TYPE_RGB_24;
+
+	for (i = 0; i < MAX_COMPRESSION_STRIPES; i++)
+		INIT_WORK(&dev_ctx->render.comp_stripe[i].work,
+			fl2000_comp_stripe_work);
+
+	render_compression_stripes = num_stripes;
+	if (num_stripes != 1)
+		dev_ctx->render.comp_wq = &shim_comp_wq;
+}
+
+// eof: fl2000_shim.c
+//
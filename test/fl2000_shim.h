@@ -0,0 +1,196 @@
+// fl2000_shim.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Kernel stubs for building the pixel and compression code in user space.
+//
+
+#ifndef _FL2000_SHIM_H_
+#define _FL2000_SHIM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * keep src/fl2000_include.h, and with it the kernel headers, out.
+ */
+#define _FL2000_INCLUDE_H_
+
+/////////////////////////////////////////////////////////////////////////////////
+// Kernel Porting
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONFIG_X86
+#elif defined(__aarch64__)
+#define CONFIG_ARM64
+#define CONFIG_KERNEL_MODE_NEON
+#endif
+
+#ifndef __always_inline
+#define __always_inline		inline __attribute__((__always_inline__))
+#endif
+#define __init
+#define printk			printf
+#define ASSERT(cond)		assert(cond)
+
+#define U32_MAX			((uint32_t) ~0U)
+
+#define min(x, y)		((x) < (y) ? (x) : (y))
+#define max(x, y)		((x) > (y) ? (x) : (y))
+#define min_t(type, x, y)	((type) (x) < (type) (y) ? (type) (x) : (type) (y))
+#define max_t(type, x, y)	((type) (x) > (type) (y) ? (type) (x) : (type) (y))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+
+#define container_of(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
+
+static inline uint64_t rol64(uint64_t word, unsigned int shift)
+{
+	return (word << (shift & 63)) | (word >> ((-shift) & 63));
+}
+
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+	return dividend / divisor;
+}
+
+static inline unsigned int num_online_cpus(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? (unsigned int) cpus : 1;
+}
+
+/*
+ * a work item is a thread: queue_work starts it and flush_work joins it.
+ */
+struct workqueue_struct {
+	int	unused;
+};
+
+struct work_struct {
+	void	(*func)(struct work_struct * work);
+	pthread_t	thread;
+	bool	queued;
+};
+
+#define INIT_WORK(work, fn)	\
+	do { (work)->func = (fn); (work)->queued = false; } while (0)
+
+bool queue_work(struct workqueue_struct * wq, struct work_struct * work);
+bool flush_work(struct work_struct * work);
+
+/////////////////////////////////////////////////////////////////////////////////
+// Driver Context
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * only the fields the pixel and compression code use; the names follow
+ * src/fl2000_ctx.h so that the sources build unchanged.
+ */
+#define MAX_COMPRESSION_STRIPES	8
+
+struct comp_stripe {
+	struct work_struct	work;
+	uint8_t *		source;
+	uint8_t *		source_boundary;
+	uint8_t *		target;
+	uint32_t		num_of_pixels;
+	uint32_t		bytes_per_pixel;
+	uint32_t		mask;
+	bool			pack_555;
+	size_t			length;
+};
+
+struct vr_params {
+	uint32_t	freq;
+	uint32_t	use_compression;
+	uint32_t	compression_mask_index;
+	uint32_t	compression_mask_index_min;
+	uint32_t	compression_mask_index_max;
+	uint32_t	input_bytes_per_pixel;
+	uint32_t	output_image_type;
+};
+
+struct render {
+	uint64_t			link_bytes_per_sec;
+	uint32_t			comp_budget;
+	uint32_t			comp_calm_frames;
+	struct workqueue_struct *	comp_wq;
+	struct comp_stripe		comp_stripe[MAX_COMPRESSION_STRIPES];
+	uint32_t			last_comp_stripes;
+};
+
+struct dev_ctx {
+	struct vr_params	vr_params;
+	struct render		render;
+};
+
+struct render_ctx {
+	int	unused;
+};
+
+extern unsigned int render_compression_share;
+extern unsigned int render_compression_stripes;
+
+#include "../src/fl2000_log.h"
+#include "../src/fl2000_def.h"
+#include "../src/fl2000_compression.h"
+#include "../src/fl2000_pixel.h"
+
+/*
+ * not in the driver headers.
+ */
+size_t fl2000_comp_decompress_low(
+	struct dev_ctx * dev_ctx,
+	size_t CompressedBufferLength,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t bytes_per_pixel,
+	uint32_t num_of_pixels);
+
+void fl2000_comp_padding_alignment(
+	struct dev_ctx * dev_ctx,
+	uint8_t * target,
+	size_t *data_buffer_length);
+
+size_t fl2000_ref_gravity_low(
+	struct dev_ctx * dev_ctx,
+	struct render_ctx * render_ctx,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t num_of_pixels,
+	uint32_t bytes_per_pixel,
+	bool NoCompressionToFirst1K);
+size_t fl2000_ref_gravity_low2(
+	struct dev_ctx * dev_ctx,
+	struct render_ctx * render_ctx,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint32_t SourcePixelBytes,
+	uint8_t * target,
+	uint32_t TargetPixelBytes,
+	uint32_t num_of_pixels,
+	bool NoCompressionToFirst1K);
+
+void fl2000_shim_dev_init(struct dev_ctx * dev_ctx, uint32_t num_stripes);
+const char * fl2000_shim_pixel_select(uint32_t index);
+
+#endif // _FL2000_SHIM_H_
+
+// eof: fl2000_shim.h
+//
@@ -0,0 +1,12 @@
+// fl2000_shim_compression.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: User space build of fl2000_compression.c.
+//
+
+#include "fl2000_shim.h"
+#include "../src/fl2000_compression.c"
@@ -0,0 +1,48 @@
+// fl2000_shim_pixel.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: User space build of fl2000_pixel.c.
+//
+
+#include "fl2000_shim.h"
+#include "../src/fl2000_pixel.c"
+
+/*
+ * pick the index'th SIMD kernels of pixel_swap and pixel_pack_16, so that
+ * each one the CPU has can be checked. Returns its name, or NULL past the last one.
+ */
+const char * fl2000_shim_pixel_select(uint32_t index)
+{
+#if defined(CONFIG_X86)
+	if (boot_cpu_has(X86_FEATURE_AVX2) && boot_cpu_has(X86_FEATURE_AVX)) {
+		if (index-- == 0) {
+			pixel_swap_simd = pixel_swap_avx2;
+			pixel_pack_simd = pixel_pack_avx2;
+			pixel_simd_block = 128;
+			pixel_pack_block = 16;
+			return pixel_swap_name = "avx2";
+		}
+	}
+	if (boot_cpu_has(X86_FEATURE_XMM2) && index == 0) {
+		pixel_swap_simd = pixel_swap_sse2;
+		pixel_pack_simd = pixel_pack_sse2;
+		pixel_simd_block = 64;
+		pixel_pack_block = 8;
+		return pixel_swap_name = "sse2";
+	}
+#elif defined(CONFIG_ARM64) && defined(CONFIG_KERNEL_MODE_NEON)
+	if (index == 0) {
+		pixel_swap_simd = pixel_swap_neon;
+		pixel_pack_simd = pixel_pack_neon;
+		return pixel_swap_name = "neon";
+	}
+#endif
+	return NULL;
+}
+
+// eof: fl2000_shim_pixel.c
+//
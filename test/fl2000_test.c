@@ -0,0 +1,836 @@
+// fl2000_test.c
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: User space tests and benchmarks of the pixel and compression code.
+//
+// usage: fl2000_test [test or bench name]...
+// Without names, all tests run. Benchmarks only run when named, or with
+// "bench" for all of them.
+//
+
+#include <time.h>
+#include "fl2000_test.h"
+
+#define FUZZ_ITERATIONS		2000
+#define FUZZ_MAX_RUNS		64
+#define FUZZ_MAX_INPUT		(2 + FUZZ_MAX_RUNS * (PIXEL_BYTE_3 + 1))
+#define EQUIVALENCE_ITERATIONS	300
+#define BENCH_WIDTH		1920
+#define BENCH_HEIGHT		1080
+#define BENCH_FRAMES		20
+
+struct test_case {
+	const char *	name;
+	bool		(*run)(void);
+	bool		bench;
+};
+
+static uint32_t test_random_state = 1;
+
+/////////////////////////////////////////////////////////////////////////////////
+// P R I V A T E
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * a random fuzz input of FUZZ_MAX_INPUT bytes at most, with the repeat
+ * bytes biased to the long run lengths.
+ */
+static size_t
+test_fuzz_input(uint8_t * data, uint32_t format)
+{
+	uint32_t const record = test_source_bytes(format) + 1;
+	uint32_t const num_runs = test_random() % FUZZ_MAX_RUNS;
+	size_t const size = 2 + num_runs * record;
+	size_t i;
+
+	data[0] = format;
+	data[1] = test_random();
+	for (i = 2; i < size; i++)
+		data[i] = test_random();
+
+	/*
+	 * few distinct colors, so neighbouring runs merge or trail.
+	 */
+	for (i = 2; i < size; i++) {
+		if ((i - 2) % record == record - 1) {
+			if (test_random() % 4 == 0)
+				data[i] = 0xE0 + test_random() % 32;
+			else
+				data[i] = test_random() % 12;
+		} else if (test_random() % 2)
+			data[i] = data[2 + (i - 2) % record] ^
+				(test_random() % 2);
+	}
+	return size;
+}
+
+/*
+ * compress with the driver, or with the reference loop.
+ */
+static size_t
+test_compress(
+	struct dev_ctx * dev_ctx,
+	bool reference,
+	uint32_t format,
+	size_t data_buffer_length,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t num_of_pixels)
+{
+	uint32_t const source_bytes = test_source_bytes(format);
+
+	if (format == TEST_FORMAT_PACK_555) {
+		if (reference)
+			return fl2000_ref_gravity_low2(dev_ctx, NULL,
+				data_buffer_length, source, PIXEL_BYTE_3,
+				target, PIXEL_BYTE_2, num_of_pixels, false);
+		return fl2000_compression_gravity2(dev_ctx, NULL,
+			data_buffer_length, source, target, num_of_pixels);
+	}
+
+	if (reference)
+		return fl2000_ref_gravity_low(dev_ctx, NULL, data_buffer_length,
+			source, target, num_of_pixels, source_bytes, false);
+	return fl2000_comp_gravity_low(dev_ctx, NULL, data_buffer_length,
+		source, target, num_of_pixels, source_bytes, false);
+}
+
+static bool
+test_comp_fuzz(void)
+{
+	uint8_t data[FUZZ_MAX_INPUT];
+	uint32_t iteration;
+	size_t size;
+
+	test_random_seed(11);
+	for (iteration = 0; iteration < FUZZ_ITERATIONS; iteration++) {
+		size = test_fuzz_input(data, iteration % TEST_NUM_FORMATS);
+		if (!fl2000_fuzz_compression(data, size)) {
+			test_fail("iteration %u", iteration);
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * frames of random pixels, where nothing repeats: every pixel is single.
+ */
+static bool
+test_comp_noise(void)
+{
+	struct dev_ctx dev_ctx;
+	uint32_t const num_of_pixels = 640 * 480;
+	uint32_t format;
+	uint8_t * source;
+	uint8_t * target;
+	size_t target_length;
+	size_t length;
+	bool ok = true;
+
+	for (format = 0; format < TEST_NUM_FORMATS && ok; format++) {
+		source = test_random_frame(format, num_of_pixels);
+		target_length =
+			(size_t) num_of_pixels * test_target_bytes(format) + 4;
+		target = test_alloc_target(target_length);
+		if (source == NULL || target == NULL) {
+			free(target);
+			free(source);
+			return false;
+		}
+
+		fl2000_shim_dev_init(&dev_ctx, 1);
+		if (format == TEST_FORMAT_PACK_555)
+			length = fl2000_compression_gravity2(&dev_ctx, NULL,
+				(size_t) num_of_pixels * PIXEL_BYTE_3, source,
+				target, num_of_pixels);
+		else
+			length = fl2000_comp_gravity_low(&dev_ctx, NULL,
+				(size_t) num_of_pixels *
+					test_source_bytes(format),
+				source, target, num_of_pixels,
+				test_source_bytes(format), false);
+
+		ok = test_guard_ok(target, target_length) &&
+			test_check_stream(source, num_of_pixels, format,
+				COMPRESSION_MASK_INDEX_MINIMUM, target, length);
+		free(target);
+		free(source);
+	}
+	return ok;
+}
+
+/*
+ * the FL2000 word order: the two 32-bit words of each 8-byte group swapped.
+ */
+static void
+test_swap_reference(uint8_t * dst, const uint8_t * src, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i += 8) {
+		memcpy(dst + i, src + i + 4, 4);
+		memcpy(dst + i + 4, src + i, 4);
+	}
+}
+
+/*
+ * every SIMD kernel of pixel_swap against the scalar one, over lengths
+ * around the SIMD block and chunk sizes, and unaligned buffers. Bytes
+ * around the destination must stay untouched.
+ */
+static bool
+test_pixel_swap(void)
+{
+	static const uint32_t lengths[] = {
+		0, 8, 16, 56, 64, 72, 120, 128, 136, 192, 256, 1000, 4096,
+		64 * 1024 - 8, 64 * 1024, 64 * 1024 + 8, 200 * 1024 + 24,
+		1920 * 3 * 8,
+	};
+	uint32_t const max_length = 256 * 1024;
+	uint8_t * const src = malloc(max_length + 64);
+	uint8_t * const dst = malloc(max_length + 64);
+	uint8_t * const ref = malloc(max_length + 64);
+	const char * name;
+	uint32_t kernel;
+	uint32_t i;
+	uint32_t offset;
+	uint32_t len;
+	bool ok = true;
+
+	if (src == NULL || dst == NULL || ref == NULL) {
+		ok = false;
+		goto exit;
+	}
+	for (i = 0; i < max_length + 64; i++)
+		src[i] = test_random();
+
+	for (kernel = 0; (name = fl2000_shim_pixel_select(kernel)) != NULL;
+	     kernel++) {
+		for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+			for (offset = 0; offset < 16; offset += 3) {
+				len = lengths[i];
+				memset(dst, 0, max_length + 64);
+				memset(ref, 0, max_length + 64);
+				test_swap_reference(ref + offset, src + offset,
+					len);
+				pixel_swap(dst + offset, src + offset, len);
+
+				if (memcmp(dst, ref, max_length + 64) != 0) {
+					test_fail("%s differs at length %u, "
+						"offset %u", name, len, offset);
+					ok = false;
+				}
+			}
+		}
+		printf("%-24s %s\n", "  pixel_swap", name);
+	}
+
+exit:
+	free(ref);
+	free(dst);
+	free(src);
+	return ok;
+}
+
+/*
+ * one pixel of pixel_pack_16, from its B, G, R bytes.
+ */
+static uint16_t
+test_pack_reference_one(const uint8_t * p, uint32_t flags, uint32_t threshold)
+{
+	static const uint32_t g_drop[2] = { 2, 3 };
+	uint32_t const is_555 = (flags & PIXEL_PACK_555) ? 1 : 0;
+	uint32_t b = p[0];
+	uint32_t g = p[1];
+	uint32_t r = p[2];
+
+	if (flags & PIXEL_PACK_DITHER) {
+		b = min(b + (threshold >> 1), 255U);
+		r = min(r + (threshold >> 1), 255U);
+		g = min(g + (threshold >> (is_555 ? 1 : 2)), 255U);
+	}
+	return (uint16_t) (((r >> 3) << (is_555 ? 10 : 11)) |
+		((g >> g_drop[is_555]) << 5) | (b >> 3));
+}
+
+/*
+ * pixel_pack_16 of num_pixels pixels from the start of a row of width
+ * pixels. Source bytes past the last pixel count as 0 before a wire order
+ * source is swapped back.
+ */
+static void
+test_pack_reference(
+	uint8_t * dst,
+	const uint8_t * src,
+	uint32_t num_pixels,
+	uint32_t width,
+	uint32_t flags)
+{
+	static const uint8_t bayer[4][4] = {
+		{  0,  8,  2, 10 },
+		{ 12,  4, 14,  6 },
+		{  3, 11,  1,  9 },
+		{ 15,  7, 13,  5 },
+	};
+	uint32_t const src_length = (num_pixels * 3 + 7) & ~7U;
+	uint32_t const dst_length = (num_pixels * 2 + 7) & ~7U;
+	uint8_t * const in = calloc(src_length + 8, 1);
+	uint16_t * const out = calloc(dst_length + 8, 1);
+	uint32_t i;
+
+	memcpy(in, src, num_pixels * 3);
+	if (flags & PIXEL_PACK_SWAPPED_SRC) {
+		uint8_t * const swapped = malloc(src_length + 8);
+
+		memcpy(swapped, in, src_length);
+		test_swap_reference(in, swapped, src_length);
+		free(swapped);
+	}
+	for (i = 0; i < num_pixels; i++)
+		out[i ^ 2] = test_pack_reference_one(in + i * 3, flags,
+			bayer[(i / width) & 3][(i % width) & 3]);
+	memcpy(dst, out, num_pixels * 2);
+	free(out);
+	free(in);
+}
+
+/*
+ * every SIMD kernel of pixel_pack_16 against the reference, for 565 and 555,
+ * with and without a wire order source and dithering, over pixel counts
+ * around the SIMD block and chunk sizes. Bytes after the destination must
+ * stay untouched.
+ */
+static bool
+test_pixel_pack(void)
+{
+	static const uint32_t counts[] = {
+		0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 23, 24, 31, 33, 1000,
+		21823, 21824, 21825, 21840, 21841, 50001,
+	};
+	static const uint32_t flag_sets[] = {
+		0,
+		PIXEL_PACK_555,
+		PIXEL_PACK_SWAPPED_SRC,
+		PIXEL_PACK_555 | PIXEL_PACK_SWAPPED_SRC,
+		PIXEL_PACK_DITHER,
+		PIXEL_PACK_DITHER | PIXEL_PACK_555 | PIXEL_PACK_SWAPPED_SRC,
+	};
+	uint32_t const max_pixels = 64 * 1024;
+	uint32_t const width = 100;
+	uint8_t * const src = malloc(max_pixels * 3 + 64);
+	uint8_t * const dst = malloc(max_pixels * 2 + 64);
+	uint8_t * const ref = malloc(max_pixels * 2 + 64);
+	const char * name;
+	uint32_t kernel;
+	uint32_t i;
+	uint32_t f;
+	uint32_t offset;
+	uint32_t count;
+	bool ok = true;
+
+	if (src == NULL || dst == NULL || ref == NULL) {
+		ok = false;
+		goto exit;
+	}
+	for (i = 0; i < max_pixels * 3 + 64; i++)
+		src[i] = test_random();
+
+	for (kernel = 0; (name = fl2000_shim_pixel_select(kernel)) != NULL;
+	     kernel++) {
+		for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+			for (f = 0; f < sizeof(flag_sets) / sizeof(flag_sets[0]);
+			     f++) {
+				for (offset = 0; offset < 8; offset += 5) {
+					count = counts[i];
+					memset(dst, 0x5A, max_pixels * 2 + 64);
+					memset(ref, 0x5A, max_pixels * 2 + 64);
+					test_pack_reference(ref + offset,
+						src + offset, count, width,
+						flag_sets[f]);
+					pixel_pack_16(dst + offset,
+						src + offset, 0, count, width,
+						flag_sets[f]);
+
+					if (memcmp(dst, ref,
+						   max_pixels * 2 + 64) != 0) {
+						test_fail("%s differs at %u "
+							"pixels, flags 0x%x, "
+							"offset %u", name,
+							count, flag_sets[f],
+							offset);
+						ok = false;
+					}
+				}
+			}
+		}
+		printf("%-24s %s\n", "  pixel_pack_16", name);
+	}
+
+exit:
+	free(ref);
+	free(dst);
+	free(src);
+	return ok;
+}
+
+/*
+ * the specialized run loops against the reference per pixel loop: the same
+ * bytes for 8, 16 and 24bpp and RGB555 packing, at every mask, over runs
+ * past the 0x7F and 0x7FFF count limits. Every other frame sets the source
+ * boundary inside the frame, where runs must stop.
+ */
+static bool
+test_comp_equivalence(void)
+{
+	struct dev_ctx dev_ctx;
+	uint8_t data[FUZZ_MAX_INPUT];
+	uint32_t iteration;
+	uint32_t format;
+	uint32_t mask_index;
+	uint32_t num_of_pixels;
+	uint32_t source_bytes;
+	uint8_t * source;
+	uint8_t * target;
+	uint8_t * expected;
+	size_t target_length;
+	size_t data_buffer_length;
+	size_t length;
+	size_t expected_length;
+	size_t size;
+	bool ok = true;
+
+	test_random_seed(10);
+	for (iteration = 0; iteration < EQUIVALENCE_ITERATIONS && ok;
+	     iteration++) {
+		format = iteration % TEST_NUM_FORMATS;
+		source_bytes = test_source_bytes(format);
+		size = test_fuzz_input(data, format);
+		source = test_expand_frame(data + 2, size - 2, format,
+			&num_of_pixels);
+		if (source == NULL)
+			return false;
+
+		data_buffer_length = (size_t) num_of_pixels * source_bytes;
+		if (iteration % 2 && num_of_pixels > 1)
+			data_buffer_length = (test_random() % num_of_pixels) *
+				source_bytes;
+
+		target_length =
+			(size_t) num_of_pixels * test_target_bytes(format) + 4;
+		target = test_alloc_target(target_length);
+		expected = test_alloc_target(target_length);
+		if (target == NULL || expected == NULL) {
+			ok = false;
+			goto next;
+		}
+
+		for (mask_index = COMPRESSION_MASK_INDEX_MINIMUM;
+		     mask_index <= COMPRESSION_MASK_INDEX_MAXIMUM && ok;
+		     mask_index++) {
+			fl2000_shim_dev_init(&dev_ctx, 1);
+			dev_ctx.vr_params.compression_mask_index = mask_index;
+			expected_length = test_compress(&dev_ctx, true, format,
+				data_buffer_length, source, expected,
+				num_of_pixels);
+			length = test_compress(&dev_ctx, false, format,
+				data_buffer_length, source, target,
+				num_of_pixels);
+
+			if (length != expected_length ||
+			    memcmp(target, expected, length) != 0 ||
+			    !test_guard_ok(target, target_length)) {
+				test_fail("iteration %u: format %u mask %u, "
+					"%u pixels, boundary %zu: %zu bytes, "
+					"reference %zu", iteration, format,
+					mask_index, num_of_pixels,
+					data_buffer_length, length,
+					expected_length);
+				ok = false;
+			}
+		}
+
+next:
+		free(expected);
+		free(target);
+		free(source);
+	}
+	return ok;
+}
+
+/*
+ * a desktop-like frame: flat windows, a gradient, text-like noise and a
+ * photo-like area with small color steps.
+ */
+static uint8_t *
+test_desktop_frame(uint32_t format, uint32_t width, uint32_t height)
+{
+	uint32_t const bytes = test_source_bytes(format);
+	uint8_t * const frame = malloc((size_t) width * height * bytes);
+	uint8_t pixel[PIXEL_BYTE_3];
+	uint32_t x;
+	uint32_t y;
+	uint32_t i;
+
+	if (frame == NULL)
+		return NULL;
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			if (y < height / 16) {
+				pixel[0] = 0x30;
+				pixel[1] = 0x30;
+				pixel[2] = x * 255 / width;
+			} else if (x < width / 2 && y < height / 2) {
+				pixel[0] = pixel[1] = pixel[2] =
+					(test_random() % 8) ? 0xF0 : 0x10;
+			} else if (x >= width / 2 && y >= height / 2) {
+				pixel[0] = (x / 4) ^ (y / 4);
+				pixel[1] = (x + y) / 8;
+				pixel[2] = (y / 2) + (test_random() % 3);
+			} else {
+				pixel[0] = 0x20;
+				pixel[1] = 0x40;
+				pixel[2] = 0x80;
+			}
+			for (i = 0; i < bytes; i++)
+				frame[((size_t) y * width + x) * bytes + i] =
+					pixel[i];
+		}
+	}
+	return frame;
+}
+
+/*
+ * gravity compression throughput of the specialized run loops against the
+ * reference loop, per pixel layout, on a 1080p desktop-like frame.
+ */
+static bool
+bench_comp_gravity(void)
+{
+	static const char * const format_names[TEST_NUM_FORMATS] = {
+		"rgb8", "rgb16", "rgb24", "rgb24->555",
+	};
+	uint32_t const num_of_pixels = BENCH_WIDTH * BENCH_HEIGHT;
+	struct dev_ctx dev_ctx;
+	uint32_t format;
+	uint32_t frame;
+	uint32_t pass;
+	uint8_t * source;
+	uint8_t * target;
+	size_t data_buffer_length;
+	size_t length = 0;
+	double start;
+	double seconds[2];
+	bool ok = true;
+
+	test_random_seed(5);
+	for (format = 0; format < TEST_NUM_FORMATS && ok; format++) {
+		source = test_desktop_frame(format, BENCH_WIDTH, BENCH_HEIGHT);
+		target = test_alloc_target(
+			(size_t) num_of_pixels * test_target_bytes(format) + 4);
+		if (source == NULL || target == NULL) {
+			ok = false;
+			goto next;
+		}
+		data_buffer_length =
+			(size_t) num_of_pixels * test_source_bytes(format);
+
+		for (pass = 0; pass < 2; pass++) {
+			fl2000_shim_dev_init(&dev_ctx, 1);
+			start = test_now_sec();
+			for (frame = 0; frame < BENCH_FRAMES; frame++)
+				length = test_compress(&dev_ctx, pass == 0,
+					format, data_buffer_length, source,
+					target, num_of_pixels);
+			seconds[pass] = (test_now_sec() - start) / BENCH_FRAMES;
+		}
+
+		printf("  %-12s %7.2f ms reference, %7.2f ms specialized, "
+			"%.2fx, %zu bytes\n", format_names[format],
+			seconds[0] * 1000, seconds[1] * 1000,
+			seconds[0] / seconds[1], length);
+next:
+		free(target);
+		free(source);
+	}
+	return ok;
+}
+
+/*
+ * striped compression of a frame with the given stripe count.
+ */
+static size_t
+test_compress_striped(
+	uint32_t format,
+	uint32_t num_stripes,
+	uint8_t * source,
+	uint8_t * target,
+	uint32_t width,
+	uint32_t height)
+{
+	struct dev_ctx dev_ctx;
+	size_t const data_buffer_length =
+		(size_t) width * height * test_source_bytes(format);
+
+	fl2000_shim_dev_init(&dev_ctx, num_stripes);
+	if (format == TEST_FORMAT_RGB_16)
+		dev_ctx.vr_params.output_image_type = OUTPUT_IMAGE_TYPE_RGB_16;
+	return fl2000_compression_gravity_striped(&dev_ctx, data_buffer_length,
+		source, target, width, height,
+		format == TEST_FORMAT_PACK_555);
+}
+
+/*
+ * the joined stripes must decode to the original frame, for stripe counts
+ * that do and do not divide the height. 16bpp streams are decoded by
+ * fl2000_comp_decompress_and_check, 24bpp ones by the test decoder.
+ */
+static bool
+test_comp_striped(void)
+{
+	static const uint32_t formats[] = {
+		TEST_FORMAT_RGB_16, TEST_FORMAT_RGB_24, TEST_FORMAT_PACK_555,
+	};
+	static const uint32_t sizes[][2] = {
+		{ 641, 33 }, { 640, 256 + 7 }, { 1920, 1080 },
+	};
+	static const uint32_t stripe_counts[] = { 1, 2, 3, 5, 8 };
+	uint32_t const num_formats = sizeof(formats) / sizeof(formats[0]);
+	uint32_t const num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+	struct dev_ctx dev_ctx;
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_of_pixels;
+	uint32_t c;
+	uint32_t f;
+	uint32_t s;
+	uint32_t n;
+	uint32_t i;
+	uint8_t * source;
+	uint8_t * target;
+	uint8_t * decoded;
+	uint8_t expected[PIXEL_BYTE_3];
+	size_t target_length;
+	size_t length;
+	size_t decoded_length;
+	bool ok = true;
+
+	test_random_seed(12);
+	for (c = 0; c < num_formats * num_sizes && ok; c++) {
+		f = c / num_sizes;
+		s = c % num_sizes;
+		width = sizes[s][0];
+		height = sizes[s][1];
+		num_of_pixels = width * height;
+		source = test_desktop_frame(formats[f], width, height);
+		target_length = (size_t) num_of_pixels *
+			test_target_bytes(formats[f]) + 4;
+		target = test_alloc_target(target_length);
+		decoded = malloc(target_length + PIXEL_BYTE_2);
+		if (source == NULL || target == NULL || decoded == NULL) {
+			ok = false;
+			goto next;
+		}
+
+		for (n = 0; n < sizeof(stripe_counts) / sizeof(stripe_counts[0]);
+		     n++) {
+			length = test_compress_striped(formats[f],
+				stripe_counts[n], source, target, width,
+				height);
+			if (!test_guard_ok(target, target_length) ||
+			    !test_check_stream(source, num_of_pixels,
+				formats[f], COMPRESSION_MASK_INDEX_MINIMUM,
+				target, length)) {
+				ok = false;
+				break;
+			}
+			if (test_target_bytes(formats[f]) != PIXEL_BYTE_2)
+				continue;
+
+			fl2000_shim_dev_init(&dev_ctx, 1);
+			decoded_length = fl2000_comp_decompress_and_check(
+				&dev_ctx, length, target, decoded,
+				PIXEL_BYTE_2, num_of_pixels);
+			if (decoded_length < (size_t) num_of_pixels *
+			    PIXEL_BYTE_2) {
+				ok = false;
+				break;
+			}
+			for (i = 0; i < num_of_pixels; i++) {
+				test_expected_pixel(expected, source +
+					i * test_source_bytes(formats[f]),
+					formats[f]);
+				if (memcmp(expected, decoded + i * PIXEL_BYTE_2,
+					   PIXEL_BYTE_2) != 0)
+					break;
+			}
+			if (i != num_of_pixels) {
+				ok = false;
+				break;
+			}
+		}
+		if (!ok)
+			test_fail("format %u, %ux%u, %u stripes", formats[f],
+				width, height, stripe_counts[n]);
+next:
+		free(decoded);
+		free(target);
+		free(source);
+	}
+	return ok;
+}
+
+/*
+ * striped compression time of a 1080p desktop-like frame for 1 to 8
+ * stripes. The speedup is bounded by the online CPUs.
+ */
+static bool
+bench_comp_striped(void)
+{
+	static const uint32_t stripe_counts[] = { 1, 2, 4, 8 };
+	uint32_t const num_of_pixels = BENCH_WIDTH * BENCH_HEIGHT;
+	uint8_t * source;
+	uint8_t * target;
+	uint32_t n;
+	uint32_t frame;
+	size_t length = 0;
+	double start;
+	double seconds;
+	double single = 0;
+
+	test_random_seed(5);
+	source = test_desktop_frame(TEST_FORMAT_RGB_24, BENCH_WIDTH,
+		BENCH_HEIGHT);
+	target = test_alloc_target((size_t) num_of_pixels * PIXEL_BYTE_3 + 4);
+	if (source == NULL || target == NULL) {
+		free(target);
+		free(source);
+		return false;
+	}
+
+	printf("  %u online cpus\n", num_online_cpus());
+	for (n = 0; n < sizeof(stripe_counts) / sizeof(stripe_counts[0]); n++) {
+		start = test_now_sec();
+		for (frame = 0; frame < BENCH_FRAMES; frame++)
+			length = test_compress_striped(TEST_FORMAT_RGB_24,
+				stripe_counts[n], source, target,
+				BENCH_WIDTH, BENCH_HEIGHT);
+		seconds = (test_now_sec() - start) / BENCH_FRAMES;
+		if (n == 0)
+			single = seconds;
+		printf("  %u stripes  %7.2f ms, %.2fx, %zu bytes\n",
+			stripe_counts[n], seconds * 1000, single / seconds,
+			length);
+	}
+
+	free(target);
+	free(source);
+	return true;
+}
+
+static const struct test_case test_cases[] = {
+	{ "comp_fuzz",		test_comp_fuzz,		false },
+	{ "comp_noise",		test_comp_noise,	false },
+	{ "pixel_swap",		test_pixel_swap,	false },
+	{ "pixel_pack",		test_pixel_pack,	false },
+	{ "comp_equivalence",	test_comp_equivalence,	false },
+	{ "comp_striped",	test_comp_striped,	false },
+	{ "comp_gravity",	bench_comp_gravity,	true },
+	{ "comp_striped_scaling", bench_comp_striped,	true },
+};
+
+static bool
+test_selected(const struct test_case * test, int argc, char * argv[])
+{
+	int i;
+
+	if (argc < 2)
+		return !test->bench;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], test->name) == 0)
+			return true;
+		if (test->bench && strcmp(argv[i], "bench") == 0)
+			return true;
+	}
+	return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+// P U B L I C
+/////////////////////////////////////////////////////////////////////////////////
+//
+
+/*
+ * xorshift32, so that every run sees the same frames.
+ */
+uint32_t test_random(void)
+{
+	uint32_t x = test_random_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	test_random_state = x;
+	return x;
+}
+
+void test_random_seed(uint32_t seed)
+{
+	test_random_state = seed ? seed : 1;
+}
+
+double test_now_sec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+uint8_t * test_random_frame(uint32_t format, uint32_t num_of_pixels)
+{
+	size_t const length = (size_t) num_of_pixels * test_source_bytes(format);
+	uint8_t * frame = malloc(length + 1);
+	size_t i;
+
+	if (frame == NULL)
+		return NULL;
+	for (i = 0; i < length; i++)
+		frame[i] = test_random();
+	return frame;
+}
+
+int main(int argc, char * argv[])
+{
+	uint32_t failed = 0;
+	uint32_t ran = 0;
+	uint32_t i;
+	bool ok;
+
+	for (i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+		if (!test_selected(&test_cases[i], argc, argv))
+			continue;
+
+		ok = test_cases[i].run();
+		printf("%-24s %s\n", test_cases[i].name, ok ? "ok" : "FAIL");
+		if (!ok)
+			failed++;
+		ran++;
+	}
+
+	if (ran == 0) {
+		fprintf(stderr, "no such test\n");
+		return 2;
+	}
+	return failed ? 1 : 0;
+}
+
+// eof: fl2000_test.c
+//
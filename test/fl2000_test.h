@@ -0,0 +1,69 @@
+// fl2000_test.h
+//
+// (c)Copyright 2017, Fresco Logic, Incorporated.
+//
+// The contents of this file are property of Fresco Logic, Incorporated and are strictly protected
+// by Non Disclosure Agreements. Distribution in any form to unauthorized parties is strictly prohibited.
+//
+// Purpose: Companion file.
+//
+
+#ifndef _FL2000_TEST_H_
+#define _FL2000_TEST_H_
+
+#include "fl2000_shim.h"
+
+/*
+ * frame layouts of the fuzz input, in its first byte.
+ */
+#define TEST_FORMAT_RGB_8		0
+#define TEST_FORMAT_RGB_16		1
+#define TEST_FORMAT_RGB_24		2
+#define TEST_FORMAT_PACK_555		3
+#define TEST_NUM_FORMATS		4
+
+#define TEST_GUARD_BYTES		64
+#define TEST_GUARD_PATTERN		0xA5
+#define TEST_MAX_PIXELS			(4 * 1024 * 1024)
+
+#define test_fail(fmt, ...) \
+	fprintf(stderr, "%s: " fmt "\n", __func__, ##__VA_ARGS__)
+
+uint32_t test_random(void);
+void test_random_seed(uint32_t seed);
+double test_now_sec(void);
+
+uint32_t test_source_bytes(uint32_t format);
+uint32_t test_target_bytes(uint32_t format);
+uint8_t * test_expand_frame(
+	const uint8_t * data,
+	size_t size,
+	uint32_t format,
+	uint32_t * num_of_pixels);
+uint8_t * test_random_frame(uint32_t format, uint32_t num_of_pixels);
+uint8_t * test_alloc_target(size_t length);
+bool test_guard_ok(const uint8_t * target, size_t length);
+size_t test_decode(
+	const uint8_t * source,
+	size_t length,
+	uint8_t * target,
+	uint32_t pixel_bytes,
+	uint32_t num_of_pixels);
+void test_expected_pixel(
+	uint8_t * pixel,
+	const uint8_t * source,
+	uint32_t format);
+bool test_check_stream(
+	const uint8_t * source,
+	uint32_t num_of_pixels,
+	uint32_t format,
+	uint32_t mask_index,
+	uint8_t * compressed,
+	size_t compressed_length);
+
+bool fl2000_fuzz_compression(const uint8_t * data, size_t size);
+
+#endif // _FL2000_TEST_H_
+
+// eof: fl2000_test.h
+//
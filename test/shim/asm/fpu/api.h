@@ -0,0 +1,32 @@
+// api.h
+//
+// Purpose: x86 FPU stubs for the user space build of fl2000_pixel.c. User
+// space owns the SIMD registers; the kernels are picked from the CPU flags.
+//
+
+#ifndef _FL2000_SHIM_FPU_API_H_
+#define _FL2000_SHIM_FPU_API_H_
+
+#define X86_FEATURE_XMM2	"sse2"
+#define X86_FEATURE_AVX		"avx"
+#define X86_FEATURE_AVX2	"avx2"
+
+#define boot_cpu_has(feature)	__builtin_cpu_supports(feature)
+
+static inline bool irq_fpu_usable(void)
+{
+	return true;
+}
+
+static inline void kernel_fpu_begin(void)
+{
+}
+
+static inline void kernel_fpu_end(void)
+{
+}
+
+#endif // _FL2000_SHIM_FPU_API_H_
+
+// eof: api.h
+//
@@ -0,0 +1,20 @@
+// neon.h
+//
+// Purpose: arm64 NEON stubs for the user space build of fl2000_pixel.c.
+//
+
+#ifndef _FL2000_SHIM_NEON_H_
+#define _FL2000_SHIM_NEON_H_
+
+static inline void kernel_neon_begin(void)
+{
+}
+
+static inline void kernel_neon_end(void)
+{
+}
+
+#endif // _FL2000_SHIM_NEON_H_
+
+// eof: neon.h
+//
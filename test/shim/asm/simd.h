@@ -0,0 +1,17 @@
+// simd.h
+//
+// Purpose: arm64 SIMD stubs for the user space build of fl2000_pixel.c.
+//
+
+#ifndef _FL2000_SHIM_SIMD_H_
+#define _FL2000_SHIM_SIMD_H_
+
+static inline bool may_use_simd(void)
+{
+	return true;
+}
+
+#endif // _FL2000_SHIM_SIMD_H_
+
+// eof: simd.h
+//